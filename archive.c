@@ -0,0 +1,1026 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include "archive.h"
+#include "iosched.h"
+#include "util.h"
+
+
+
+#define TAR_BLOCK   512
+#define CHUNK       (128 * 1024)
+// member data is skipped in steps of this, to notice cancellation in between
+#define SKIP_STEP   (8 * CHUNK)
+#define CACHE_SIZE  4
+// the end of central directory record is at most this far from the end
+#define ZIP_EOCD_MAX (22 + 0xffff)
+
+struct Archive {
+    char path[PATH_MAX];
+    ArchiveFormat format;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    unsigned refs;
+
+    ArchiveMember *members;
+    size_t count;
+    size_t capacity;
+    size_t *slots; // open-addressing index by path, storing `index + 1`
+    size_t slot_count;
+};
+
+struct ArchiveJob {
+    Archive *a;     // being indexed, or taken from the cache
+    IoGroup *group; // foreground, NULL for cached archives
+    int err;        // errno of a failed index
+
+    pthread_mutex_t lock; // guards `cancelled` and `progress`
+    pthread_cond_t done;
+    bool cancelled;
+    ArchiveProgress progress;
+};
+
+// recently opened archives, each holding a reference
+static Archive *cache[CACHE_SIZE] = { 0 };
+static size_t cache_next = 0;
+
+
+
+static size_t hash_path(const char *path) {
+    // FNV-1a
+    size_t hash = 14695981039346656037u;
+    for (; *path != '\0'; ++path) {
+        hash ^= (unsigned char) *path;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+static size_t probe(const Archive *a, const char *path) {
+    size_t mask = a->slot_count - 1;
+    size_t slot = hash_path(path) & mask;
+
+    while (a->slots[slot] != 0 && strcmp(a->members[a->slots[slot] - 1].path, path))
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+static void rehash(Archive *a, size_t slot_count) {
+    free(a->slots);
+    a->slots = calloc(slot_count, sizeof(size_t));
+    NON_NULL(a->slots);
+    a->slot_count = slot_count;
+
+    for (size_t i=0; i < a->count; ++i)
+        a->slots[probe(a, a->members[i].path)] = i + 1;
+}
+
+// returns the index of the member at `path`, -1 if there is none
+ssize_t archive_lookup(const Archive *a, const char *path) {
+    if (a->slot_count == 0) return -1;
+
+    size_t slot = probe(a, path);
+    return a->slots[slot] == 0 ? -1 : (ssize_t) a->slots[slot] - 1;
+}
+
+static size_t add_member(Archive *a, const char *path, unsigned int mode);
+
+// the member at `path`, which is created as a directory if it is missing
+static size_t ensure_dir(Archive *a, const char *path) {
+    ssize_t index = archive_lookup(a, path);
+    return index != -1 ? (size_t) index : add_member(a, path, S_IFDIR | 0755);
+}
+
+// `path` has to be normalized. replaces the metadata of an existing member
+static size_t add_member(Archive *a, const char *path, unsigned int mode) {
+
+    ssize_t existing = archive_lookup(a, path);
+    if (existing != -1) {
+        a->members[existing].mode = mode;
+        return existing;
+    }
+
+    // the parent first, which may rehash or reallocate
+    size_t parent = 0;
+    const char *slash = strrchr(path, '/');
+
+    if (*path != '\0') {
+        char dir[PATH_MAX] = { 0 };
+        if (slash != NULL)
+            snprintf(dir, ARRAY_LEN(dir), "%.*s", (int) (slash - path), path);
+        parent = ensure_dir(a, dir);
+    }
+
+    // keep the load factor below 1/2
+    if ((a->count + 1) * 2 > a->slot_count)
+        rehash(a, a->slot_count ? a->slot_count * 2 : 256);
+
+    if (a->count == a->capacity) {
+        a->capacity = a->capacity ? a->capacity * 2 : 256;
+        a->members = realloc(a->members, a->capacity * sizeof(ArchiveMember));
+        NON_NULL(a->members);
+    }
+
+    size_t index = a->count++;
+    ArchiveMember *m = &a->members[index];
+    *m = (ArchiveMember) {
+        .path   = strdup(path),
+        .mode   = mode,
+        .parent = parent,
+    };
+    NON_NULL(m->path);
+    m->name = slash != NULL ? m->path + (slash - path) + 1 : m->path;
+
+    a->slots[probe(a, path)] = index + 1;
+
+    if (index != 0) {
+        m->next_sibling = a->members[parent].first_child;
+        a->members[parent].first_child = index;
+    }
+
+    return index;
+}
+
+// strips "./", leading and trailing slashes. returns false for paths which
+// would escape the archive, and for the root itself
+static bool normalize(const char *path, char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+
+    while (*path != '\0') {
+        while (*path == '/') path++;
+
+        size_t n = strcspn(path, "/");
+        if (n == 0) break;
+
+        if (n == 2 && !strncmp(path, "..", 2)) return false;
+
+        if (!(n == 1 && *path == '.')) {
+            if (len + n + 2 > size) return false;
+            if (len > 0) buf[len++] = '/';
+            memcpy(buf + len, path, n);
+            len += n;
+            buf[len] = '\0';
+        }
+
+        path += n;
+    }
+
+    return len > 0;
+}
+
+
+
+static uint64_t parse_octal(const char *field, size_t size) {
+
+    // base-256, for values which don't fit the octal field
+    if ((unsigned char) field[0] & 0x80) {
+        uint64_t value = field[0] & 0x7f;
+        for (size_t i=1; i < size; ++i)
+            value = (value << 8) | (unsigned char) field[i];
+        return value;
+    }
+
+    uint64_t value = 0;
+    for (size_t i=0; i < size && field[i] != '\0'; ++i) {
+        if (field[i] == ' ') continue;
+        if (field[i] < '0' || field[i] > '7') break;
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+static bool tar_checksum_ok(const unsigned char *header) {
+    uint64_t expected = parse_octal((const char*) header + 148, 8);
+
+    uint64_t sum = 0;
+    for (size_t i=0; i < TAR_BLOCK; ++i)
+        sum += i >= 148 && i < 156 ? ' ' : header[i];
+
+    return sum == expected;
+}
+
+static unsigned int tar_type(char flag) {
+    switch (flag) {
+        case '1': return S_IFREG; // see resolve_hardlinks()
+        case '2': return S_IFLNK;
+        case '3': return S_IFCHR;
+        case '4': return S_IFBLK;
+        case '5': return S_IFDIR;
+        case '6': return S_IFIFO;
+        default:  return S_IFREG;
+    }
+}
+
+// reads `size` bytes of extended header data into a fresh string
+static char *tar_read_data(gzFile f, uint64_t size) {
+    if (size >= 1024 * 1024) return NULL;
+
+    char *data = malloc(size + 1);
+    NON_NULL(data);
+
+    if (gzread(f, data, size) != (int) size) {
+        free(data);
+        return NULL;
+    }
+
+    data[size] = '\0';
+    return data;
+}
+
+// the value of `key` in pax extended header records, "<len> <key>=<value>\n"
+static bool pax_value(const char *data, size_t size, const char *key, char *buf, size_t bufsize) {
+    size_t keylen = strlen(key);
+    size_t i = 0;
+
+    while (i < size) {
+        char *end = NULL;
+        unsigned long len = strtoul(data + i, &end, 10);
+        if (len == 0 || i + len > size || *end != ' ') return false;
+
+        const char *record = end + 1;
+        const char *stop = data + i + len - 1; // the newline
+
+        if (!strncmp(record, key, keylen) && record[keylen] == '=') {
+            const char *value = record + keylen + 1;
+            snprintf(buf, bufsize, "%.*s", (int) (stop - value), value);
+            return true;
+        }
+
+        i += len;
+    }
+
+    return false;
+}
+
+// publishes the progress of indexing. returns false once it was cancelled
+static bool keep_going(ArchiveJob *job, gzFile f, size_t members) {
+    pthread_mutex_lock(&job->lock);
+    job->progress.read = gzoffset(f);
+    job->progress.members = members - 1; // but the root
+    bool cancelled = job->cancelled;
+    pthread_mutex_unlock(&job->lock);
+    return !cancelled;
+}
+
+// seeks over `size` bytes of member data. returns -1 at the end of the
+// archive, errors, or once cancelled
+static int skip(ArchiveJob *job, gzFile f, uint64_t size) {
+    while (size > 0) {
+        uint64_t n = size < SKIP_STEP ? size : SKIP_STEP;
+        if (gzseek(f, n, SEEK_CUR) == -1) return -1;
+        if (!keep_going(job, f, job->a->count)) return -1;
+        size -= n;
+    }
+    return 0;
+}
+
+typedef struct {
+    size_t member;
+    char *target; // normalized
+} Hardlink;
+
+// hardlink members have no data of their own, they share that of the
+// (earlier) member they link to. links to missing members stay empty
+static void resolve_hardlinks(Archive *a, Hardlink *links, size_t count) {
+    for (size_t i=0; i < count; ++i) {
+        ArchiveMember *m = &a->members[links[i].member];
+        ssize_t target = archive_lookup(a, links[i].target);
+
+        if (target != -1 && (size_t) target != links[i].member && S_ISREG(a->members[target].mode)) {
+            m->size = a->members[target].size;
+            m->offset = a->members[target].offset;
+        }
+
+        free(links[i].target);
+    }
+}
+
+static int index_tar(ArchiveJob *job) {
+    Archive *a = job->a;
+
+    gzFile f = gzopen(a->path, "rb");
+    if (f == NULL) return -1;
+    gzbuffer(f, CHUNK);
+
+    unsigned char header[TAR_BLOCK];
+    char longname[PATH_MAX] = { 0 };
+    char longlink[PATH_MAX] = { 0 };
+    bool first = true;
+    int err = 0;
+
+    Hardlink *links = NULL;
+    size_t link_count = 0;
+    size_t link_cap = 0;
+
+    while (gzread(f, header, TAR_BLOCK) == TAR_BLOCK) {
+
+        if (!keep_going(job, f, a->count)) {
+            err = -1;
+            break;
+        }
+
+        // the archive ends with zero blocks
+        if (header[0] == '\0') break;
+
+        if (!tar_checksum_ok(header)) {
+            errno = EINVAL;
+            if (first) err = -1;
+            break;
+        }
+        first = false;
+
+        const char *h = (const char*) header;
+        uint64_t size = parse_octal(h + 124, 12);
+        char flag = h[156];
+        uint64_t padded = (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+
+        // names of the next member which don't fit the header
+        if (flag == 'L' || flag == 'K' || flag == 'x') {
+            char *data = tar_read_data(f, size);
+            if (data == NULL) break;
+
+            if (flag == 'L') snprintf(longname, ARRAY_LEN(longname), "%s", data);
+            if (flag == 'K') snprintf(longlink, ARRAY_LEN(longlink), "%s", data);
+            if (flag == 'x') {
+                pax_value(data, size, "path", longname, ARRAY_LEN(longname));
+                pax_value(data, size, "linkpath", longlink, ARRAY_LEN(longlink));
+            }
+
+            free(data);
+            gzseek(f, padded - size, SEEK_CUR);
+            continue;
+        }
+
+        char name[PATH_MAX] = { 0 };
+        if (*longname != '\0')
+            snprintf(name, ARRAY_LEN(name), "%s", longname);
+        else if (!memcmp(h + 257, "ustar", 5) && h[345] != '\0')
+            snprintf(name, ARRAY_LEN(name), "%.155s/%.100s", h + 345, h);
+        else
+            snprintf(name, ARRAY_LEN(name), "%.100s", h);
+
+        char target[PATH_MAX] = { 0 };
+        if (*longlink != '\0')
+            snprintf(target, ARRAY_LEN(target), "%s", longlink);
+        else
+            snprintf(target, ARRAY_LEN(target), "%.100s", h + 157);
+
+        char path[PATH_MAX] = { 0 };
+        if (flag != 'g' && normalize(name, path, ARRAY_LEN(path))) {
+            unsigned int mode = tar_type(flag) | (parse_octal(h + 100, 8) & 07777);
+            size_t index = add_member(a, path, mode);
+
+            ArchiveMember *m = &a->members[index];
+            m->size = S_ISREG(mode) && flag != '1' ? size : 0;
+            m->mtime.tv_sec = parse_octal(h + 136, 12);
+            m->offset = gztell(f);
+
+            if (flag == '2') {
+                free(m->link);
+                m->link = strdup(target);
+                NON_NULL(m->link);
+            }
+
+            char normalized[PATH_MAX] = { 0 };
+            if (flag == '1' && normalize(target, normalized, ARRAY_LEN(normalized))) {
+                if (link_count == link_cap) {
+                    link_cap = link_cap ? link_cap * 2 : 16;
+                    links = realloc(links, link_cap * sizeof(Hardlink));
+                    NON_NULL(links);
+                }
+
+                links[link_count] = (Hardlink) { .member = index, .target = strdup(normalized) };
+                NON_NULL(links[link_count].target);
+                link_count++;
+            }
+        }
+
+        *longname = '\0';
+        *longlink = '\0';
+
+        if (skip(job, f, padded) == -1) break;
+    }
+
+    if (!keep_going(job, f, a->count)) {
+        errno = ECANCELED;
+        err = -1;
+    }
+
+    resolve_hardlinks(a, links, link_count);
+    free(links);
+    gzclose(f);
+    return err;
+}
+
+
+
+static uint16_t le16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const unsigned char *p) {
+    return (uint32_t) le16(p) | (uint32_t) le16(p + 2) << 16;
+}
+
+static uint64_t le64(const unsigned char *p) {
+    return (uint64_t) le32(p) | (uint64_t) le32(p + 4) << 32;
+}
+
+static time_t dos_time(uint16_t time, uint16_t date) {
+    struct tm tm = {
+        .tm_sec   = (time & 0x1f) * 2,
+        .tm_min   = (time >> 5) & 0x3f,
+        .tm_hour  = time >> 11,
+        .tm_mday  = date & 0x1f,
+        .tm_mon   = ((date >> 5) & 0x0f) - 1,
+        .tm_year  = (date >> 9) + 80,
+        .tm_isdst = -1,
+    };
+    return mktime(&tm);
+}
+
+// finds the central directory via the end of central directory record,
+// or its zip64 variant
+static int zip_central_directory(int fd, off_t file_size, uint64_t *offset, uint64_t *size) {
+
+    size_t tail = file_size < ZIP_EOCD_MAX ? file_size : ZIP_EOCD_MAX;
+    unsigned char *buf = malloc(tail + 1);
+    NON_NULL(buf);
+
+    if (pread(fd, buf, tail, file_size - tail) != (ssize_t) tail) {
+        free(buf);
+        return -1;
+    }
+
+    ssize_t eocd = -1;
+    for (ssize_t i = tail - 22; i >= 0; --i) {
+        if (le32(buf + i) == 0x06054b50) {
+            eocd = i;
+            break;
+        }
+    }
+
+    if (eocd == -1) {
+        free(buf);
+        errno = EINVAL;
+        return -1;
+    }
+
+    *size = le32(buf + eocd + 12);
+    *offset = le32(buf + eocd + 16);
+
+    // the zip64 locator precedes the record
+    if ((*offset == 0xffffffff || *size == 0xffffffff) && eocd >= 20 && le32(buf + eocd - 20) == 0x07064b50) {
+        uint64_t at = le64(buf + eocd - 20 + 8);
+        unsigned char z[56];
+
+        if (pread(fd, z, sizeof(z), at) == sizeof(z) && le32(z) == 0x06064b50) {
+            *size = le64(z + 40);
+            *offset = le64(z + 48);
+        }
+    }
+
+    free(buf);
+    return *offset + *size <= (uint64_t) file_size ? 0 : -1;
+}
+
+static int index_zip(Archive *a) {
+
+    int fd = open(a->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    if (zip_central_directory(fd, a->size, &offset, &size) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    unsigned char *cd = malloc(size + 1);
+    NON_NULL(cd);
+
+    if (pread(fd, cd, size, offset) != (ssize_t) size) {
+        free(cd);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    size_t i = 0;
+    while (i + 46 <= size && le32(cd + i) == 0x02014b50) {
+        const unsigned char *e = cd + i;
+
+        uint16_t name_len = le16(e + 28);
+        uint16_t extra_len = le16(e + 30);
+        uint16_t comment_len = le16(e + 32);
+        if (i + 46 + name_len + extra_len > size) break;
+
+        uint64_t usize = le32(e + 24);
+        uint64_t csize = le32(e + 20);
+        uint64_t local = le32(e + 42);
+
+        // zip64 extra field, holding only the values which overflowed
+        const unsigned char *x = e + 46 + name_len;
+        for (size_t j=0; j + 4 <= extra_len; ) {
+            uint16_t id = le16(x + j);
+            uint16_t len = le16(x + j + 2);
+            const unsigned char *v = x + j + 4;
+
+            if (id == 0x0001) {
+                if (usize == 0xffffffff && v + 8 <= x + j + 4 + len) { usize = le64(v); v += 8; }
+                if (csize == 0xffffffff && v + 8 <= x + j + 4 + len) { csize = le64(v); v += 8; }
+                if (local == 0xffffffff && v + 8 <= x + j + 4 + len) { local = le64(v); v += 8; }
+            }
+            j += 4 + len;
+        }
+
+        char name[PATH_MAX] = { 0 };
+        snprintf(name, ARRAY_LEN(name), "%.*s", (int) name_len, e + 46);
+        bool dir = name_len > 0 && name[name_len - 1] == '/';
+
+        // unix permissions, if the archive was made on unix
+        unsigned int mode = le32(e + 38) >> 16;
+        if (le16(e + 4) >> 8 != 3 || mode == 0)
+            mode = dir ? S_IFDIR | 0755 : S_IFREG | 0644;
+
+        char path[PATH_MAX] = { 0 };
+        if (normalize(name, path, ARRAY_LEN(path))) {
+            ArchiveMember *m = &a->members[add_member(a, path, mode)];
+            m->size = S_ISDIR(mode) ? 0 : usize;
+            m->csize = csize;
+            m->offset = local;
+            m->method = le16(e + 10);
+            m->mtime.tv_sec = dos_time(le16(e + 12), le16(e + 14));
+        }
+
+        i += 46 + name_len + extra_len + comment_len;
+    }
+
+    free(cd);
+    return 0;
+}
+
+
+
+// receives the data of a member in chunks. returns 1 to stop early, -1 on errors
+typedef int (*Sink)(void *ctx, const char *data, size_t size);
+
+static int stream_tar(const Archive *a, const ArchiveMember *m, Sink sink, void *ctx) {
+
+    gzFile f = gzopen(a->path, "rb");
+    if (f == NULL) return -1;
+    gzbuffer(f, CHUNK);
+
+    // streams up to the member for compressed archives
+    if (gzseek(f, m->offset, SEEK_SET) == -1) {
+        gzclose(f);
+        return -1;
+    }
+
+    char *buf = malloc(CHUNK);
+    NON_NULL(buf);
+
+    int err = 0;
+    uint64_t left = m->size;
+
+    while (left > 0 && err == 0) {
+        int n = gzread(f, buf, left < CHUNK ? left : CHUNK);
+        if (n <= 0) {
+            err = -1;
+            break;
+        }
+
+        err = sink(ctx, buf, n);
+        left -= n;
+    }
+
+    free(buf);
+    gzclose(f);
+    return err == -1 ? -1 : 0;
+}
+
+static int stream_zip(const Archive *a, const ArchiveMember *m, Sink sink, void *ctx) {
+
+    if (m->method != 0 && m->method != Z_DEFLATED) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    int fd = open(a->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    // the local header has its own name and extra field lengths
+    unsigned char local[30];
+    if (pread(fd, local, sizeof(local), m->offset) != sizeof(local) || le32(local) != 0x04034b50) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    off_t at = m->offset + 30 + le16(local + 26) + le16(local + 28);
+
+    char *in = malloc(CHUNK);
+    char *out = malloc(CHUNK);
+    NON_NULL(in);
+    NON_NULL(out);
+
+    z_stream z = { 0 };
+    if (m->method == Z_DEFLATED)
+        MUST_ZERO(inflateInit2(&z, -MAX_WBITS)); // raw deflate, without a header
+
+    int err = 0;
+    uint64_t left = m->csize;
+
+    while (left > 0 && err == 0) {
+        ssize_t n = pread(fd, in, left < CHUNK ? left : CHUNK, at);
+        if (n <= 0) {
+            err = -1;
+            break;
+        }
+        at += n;
+        left -= n;
+
+        if (m->method == 0) {
+            err = sink(ctx, in, n);
+            continue;
+        }
+
+        z.next_in = (unsigned char*) in;
+        z.avail_in = n;
+
+        while (z.avail_in > 0 && err == 0) {
+            z.next_out = (unsigned char*) out;
+            z.avail_out = CHUNK;
+
+            int ret = inflate(&z, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END) {
+                err = -1;
+                break;
+            }
+
+            size_t produced = CHUNK - z.avail_out;
+            if (produced > 0)
+                err = sink(ctx, out, produced);
+
+            if (ret == Z_STREAM_END) {
+                left = 0;
+                break;
+            }
+        }
+    }
+
+    if (m->method == Z_DEFLATED)
+        inflateEnd(&z);
+
+    free(in);
+    free(out);
+    close(fd);
+    return err == -1 ? -1 : 0;
+}
+
+static int stream(const Archive *a, const ArchiveMember *m, Sink sink, void *ctx) {
+    return a->format == ARCHIVE_ZIP
+        ? stream_zip(a, m, sink, ctx)
+        : stream_tar(a, m, sink, ctx);
+}
+
+
+
+static bool has_suffix(const char *name, const char *suffix) {
+    size_t n = strlen(name);
+    size_t m = strlen(suffix);
+    return n > m && !strcmp(name + n - m, suffix);
+}
+
+// whether `name` looks like an archive that can be opened
+bool archive_detect(const char *name) {
+    static const char *suffixes[] = { ".tar", ".tar.gz", ".tgz", ".zip", ".jar" };
+
+    for (size_t i=0; i < ARRAY_LEN(suffixes); ++i)
+        if (has_suffix(name, suffixes[i]))
+            return true;
+    return false;
+}
+
+static void destroy(Archive *a) {
+    for (size_t i=0; i < a->count; ++i) {
+        free(a->members[i].path);
+        free(a->members[i].link);
+    }
+
+    free(a->members);
+    free(a->slots);
+    free(a);
+}
+
+static ArchiveJob *new_job(void) {
+    ArchiveJob *job = calloc(1, sizeof(ArchiveJob));
+    NON_NULL(job);
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->done, NULL);
+    return job;
+}
+
+static void free_job(ArchiveJob *job) {
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->done);
+    free(job);
+}
+
+static void run_index(void *arg) {
+    ArchiveJob *job = arg;
+
+    int err = -1;
+    if (iosched_cancelled(job->group))
+        errno = ECANCELED; // before it even started
+    else
+        err = job->a->format == ARCHIVE_ZIP ? index_zip(job->a) : index_tar(job);
+
+    pthread_mutex_lock(&job->lock);
+    job->err = err == -1 ? errno : 0;
+    job->progress.members = job->a->count - 1;
+    job->progress.done = true;
+    pthread_cond_broadcast(&job->done);
+    bool cancelled = job->cancelled;
+    pthread_mutex_unlock(&job->lock);
+
+    // nobody waits for it anymore, see archive_cancel()
+    if (cancelled) {
+        archive_close(job->a);
+        free_job(job);
+    }
+}
+
+// starts indexing the archive at `path` as a foreground task, see
+// archive_finish(). an index in the cache, reused while the archive is
+// unchanged, is done right away. returns NULL if `path` can not be read
+ArchiveJob *archive_start(const char *path) {
+
+    struct stat statbuf = { 0 };
+    if (stat(path, &statbuf) == -1) return NULL;
+
+    for (size_t i=0; i < CACHE_SIZE; ++i) {
+        Archive *a = cache[i];
+        bool same = a != NULL
+            && a->dev == statbuf.st_dev
+            && a->ino == statbuf.st_ino
+            && a->size == statbuf.st_size
+            && a->mtime.tv_sec == statbuf.st_mtim.tv_sec
+            && a->mtime.tv_nsec == statbuf.st_mtim.tv_nsec;
+
+        if (same) {
+            ArchiveJob *job = new_job();
+            job->a = archive_ref(a);
+            job->progress = (ArchiveProgress) {
+                .done    = true,
+                .read    = statbuf.st_size,
+                .total   = statbuf.st_size,
+                .members = a->count - 1,
+            };
+            return job;
+        }
+    }
+
+    Archive *a = calloc(1, sizeof(Archive));
+    NON_NULL(a);
+
+    *a = (Archive) {
+        .format = has_suffix(path, ".zip") || has_suffix(path, ".jar") ? ARCHIVE_ZIP : ARCHIVE_TAR,
+        .dev    = statbuf.st_dev,
+        .ino    = statbuf.st_ino,
+        .size   = statbuf.st_size,
+        .mtime  = statbuf.st_mtim,
+        .refs   = 1,
+    };
+
+    if (realpath(path, a->path) == NULL) {
+        free(a);
+        return NULL;
+    }
+
+    add_member(a, "", S_IFDIR | 0755);
+
+    ArchiveJob *job = new_job();
+    job->a = a;
+    job->progress.total = statbuf.st_size;
+    job->group = iosched_group(IO_FOREGROUND);
+    iosched_submit(job->group, statbuf.st_dev, run_index, job);
+    return job;
+}
+
+ArchiveProgress archive_progress(ArchiveJob *job) {
+    pthread_mutex_lock(&job->lock);
+    ArchiveProgress progress = job->progress;
+    pthread_mutex_unlock(&job->lock);
+    return progress;
+}
+
+// waits up to `timeout_ms` for the index, forever if negative.
+// returns true if it is done
+bool archive_wait(ArchiveJob *job, int timeout_ms) {
+
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += timeout_ms / 1000;
+    until.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&job->lock);
+
+    int err = 0;
+    while (!job->progress.done && err == 0) {
+        err = timeout_ms < 0
+            ? pthread_cond_wait(&job->done, &job->lock)
+            : pthread_cond_timedwait(&job->done, &job->lock, &until);
+    }
+
+    bool done = job->progress.done;
+    pthread_mutex_unlock(&job->lock);
+    return done;
+}
+
+// stops indexing and frees `job`, instead of archive_finish(). a task that
+// is still running is left to notice, and frees it when it returns
+void archive_cancel(ArchiveJob *job) {
+
+    if (job->group != NULL) {
+        iosched_cancel(job->group);
+        iosched_release(job->group);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->cancelled = true;
+    bool done = job->progress.done;
+    pthread_mutex_unlock(&job->lock);
+
+    if (done) {
+        archive_close(job->a);
+        free_job(job);
+    }
+}
+
+// waits for the index and frees `job`. returns a reference to the archive,
+// or NULL with errno set if it could not be indexed
+Archive *archive_finish(ArchiveJob *job) {
+
+    if (job->group != NULL) {
+        iosched_wait(job->group);
+        iosched_release(job->group);
+    }
+
+    Archive *a = job->a;
+    int err = job->err;
+    bool fresh = job->group != NULL;
+
+    free_job(job);
+
+    if (err != 0) {
+        destroy(a);
+        errno = err;
+        return NULL;
+    }
+
+    if (fresh) {
+        if (cache[cache_next] != NULL)
+            archive_close(cache[cache_next]);
+        cache[cache_next] = archive_ref(a);
+        cache_next = (cache_next + 1) % CACHE_SIZE;
+    }
+
+    return a;
+}
+
+// returns a reference to the indexed archive at `path`, or NULL if it could
+// not be read. blocks while indexing, see archive_start()
+Archive *archive_open(const char *path) {
+    ArchiveJob *job = archive_start(path);
+    return job != NULL ? archive_finish(job) : NULL;
+}
+
+Archive *archive_ref(Archive *a) {
+    a->refs++;
+    return a;
+}
+
+void archive_close(Archive *a) {
+    if (--a->refs == 0)
+        destroy(a);
+}
+
+const char *archive_path(const Archive *a) {
+    return a->path;
+}
+
+const ArchiveMember *archive_member(const Archive *a, size_t index) {
+    return index < a->count ? &a->members[index] : NULL;
+}
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+} ReadCtx;
+
+static int read_sink(void *ctx, const char *data, size_t size) {
+    ReadCtx *r = ctx;
+
+    size_t n = size < r->size - r->len ? size : r->size - r->len;
+    memcpy(r->buf + r->len, data, n);
+    r->len += n;
+
+    return r->len == r->size ? 1 : 0;
+}
+
+// reads the first `size` bytes of a file member into `buf`.
+// returns the amount read, -1 on errors
+ssize_t archive_read(Archive *a, size_t index, char *buf, size_t size) {
+    const ArchiveMember *m = archive_member(a, index);
+    if (m == NULL || !S_ISREG(m->mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ReadCtx ctx = { .buf = buf, .size = size };
+    if (size > 0 && stream(a, m, read_sink, &ctx) == -1) return -1;
+    return ctx.len;
+}
+
+static int write_sink(void *ctx, const char *data, size_t size) {
+    int fd = *(int*) ctx;
+
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n == -1) return -1;
+        data += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+// extracts a member into the directory `dirfd`, under its own name.
+// directories are extracted with everything below them. existing files are
+// not overwritten. returns -1 on the first error
+int archive_extract(Archive *a, size_t index, int dirfd) {
+    const ArchiveMember *m = archive_member(a, index);
+    if (m == NULL || index == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (S_ISDIR(m->mode)) {
+        if (mkdirat(dirfd, m->name, (m->mode & 0777) | 0700) == -1 && errno != EEXIST)
+            return -1;
+
+        int fd = openat(dirfd, m->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) return -1;
+
+        int err = 0;
+        for (size_t c = m->first_child; c != 0 && err == 0; c = a->members[c].next_sibling)
+            err = archive_extract(a, c, fd);
+
+        close(fd);
+        return err;
+    }
+
+    // zip archives store link targets as the content
+    if (S_ISLNK(m->mode)) {
+        char target[PATH_MAX] = { 0 };
+        ReadCtx ctx = { .buf = target, .size = ARRAY_LEN(target) - 1 };
+
+        if (m->link != NULL)
+            snprintf(target, ARRAY_LEN(target), "%s", m->link);
+        else if (stream(a, m, read_sink, &ctx) == -1)
+            return -1;
+
+        return symlinkat(target, dirfd, m->name);
+    }
+
+    // devices and fifos are skipped
+    if (!S_ISREG(m->mode)) return 0;
+
+    int fd = openat(dirfd, m->name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, m->mode & 0777);
+    if (fd == -1) return -1;
+
+    int err = stream(a, m, write_sink, &fd);
+    close(fd);
+    return err;
+}
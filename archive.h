@@ -0,0 +1,72 @@
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+// read-only access to tar, tar.gz and zip archives, without extracting them.
+// opening builds an index of the members once: zip archives are indexed from
+// their central directory, tar archives by streaming over their headers, in a
+// foreground task that reports progress and can be cancelled. indices are
+// cached by path, size and mtime of the archive. hardlink members share the
+// data of the member they link to.
+//
+// members form a tree, rooted at index 0, with directories missing from the
+// archive filled in. single members are read by seeking to their data
+// (streaming up to it, for compressed tar archives)
+
+
+
+typedef enum {
+    ARCHIVE_TAR, // compressed or not
+    ARCHIVE_ZIP,
+} ArchiveFormat;
+
+typedef struct {
+    char *path;       // within the archive, "" for the root
+    const char *name; // last component of `path`
+    char *link;       // symlink target, or NULL
+    size_t size;
+    unsigned int mode;
+    struct timespec mtime;
+    uint64_t offset;  // tar: of the data, uncompressed. zip: of the local header
+    uint64_t csize;   // zip: compressed size
+    int method;       // zip: compression method
+    size_t parent;
+    size_t first_child; // 0 if there is none, as the root is no child
+    size_t next_sibling;
+} ArchiveMember;
+
+typedef struct {
+    bool done;
+    uint64_t read;  // bytes of the archive file, compressed
+    uint64_t total;
+    size_t members;
+} ArchiveProgress;
+
+typedef struct Archive Archive;
+typedef struct ArchiveJob ArchiveJob;
+
+
+bool     archive_detect   (const char *name);
+Archive *archive_open     (const char *path);
+ArchiveJob *archive_start (const char *path);
+ArchiveProgress archive_progress (ArchiveJob *job);
+bool     archive_wait     (ArchiveJob *job, int timeout_ms);
+void     archive_cancel   (ArchiveJob *job);
+Archive *archive_finish   (ArchiveJob *job);
+Archive *archive_ref      (Archive *a);
+void     archive_close    (Archive *a);
+const char *archive_path  (const Archive *a);
+const ArchiveMember *archive_member (const Archive *a, size_t index);
+ssize_t  archive_lookup   (const Archive *a, const char *path);
+ssize_t  archive_read     (Archive *a, size_t index, char *buf, size_t size);
+int      archive_extract  (Archive *a, size_t index, int dirfd);
+
+
+
+#endif // _ARCHIVE_H
@@ -0,0 +1,218 @@
+#define _GNU_SOURCE // statx()
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+
+#include "astat.h"
+#include "iosched.h"
+#include "timing.h"
+#include "util.h"
+
+
+
+typedef struct Job {
+    struct AstatBatch *batch;
+    size_t index;
+    char *name;
+    uint64_t submitted;
+    uint64_t started; // 0 while queued
+    bool timed_out;
+    struct Job *prev, *next; // in `AstatBatch.jobs`
+} Job;
+
+// everything below is guarded by `lock`. jobs hold a reference to their
+// batch, so it outlives astat_cancel() until the last job returns
+struct AstatBatch {
+    int fd;
+    dev_t dev;
+    unsigned int mask;
+    IoGroup *group; // foreground, the listing on screen waits for it
+    size_t refs;
+    bool cancelled;
+    size_t active;   // queued or running, and not timed out
+    Job *jobs;       // queued or running
+    uint64_t progress; // when a stat last returned, or the batch started
+    AstatResult *results;
+    size_t result_count;
+    size_t result_cap;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void release_batch(AstatBatch *b) {
+    if (--b->refs != 0) return;
+
+    close(b->fd);
+    iosched_release(b->group);
+    free(b->results);
+    free(b);
+}
+
+static void push_result(AstatBatch *b, AstatResult r) {
+
+    if (b->result_count == b->result_cap) {
+        b->result_cap = b->result_cap ? b->result_cap * 2 : 64;
+        b->results = realloc(b->results, b->result_cap * sizeof(AstatResult));
+        NON_NULL(b->results);
+    }
+
+    b->results[b->result_count++] = r;
+}
+
+static void unlink_job(AstatBatch *b, Job *job) {
+    if (job->prev != NULL) job->prev->next = job->next;
+    else                   b->jobs = job->next;
+    if (job->next != NULL) job->next->prev = job->prev;
+}
+
+static void run_job(void *arg) {
+    Job *job = arg;
+    AstatBatch *b = job->batch;
+
+    pthread_mutex_lock(&lock);
+
+    // timed out while queued, behind stats hung on the same device
+    if (b->cancelled || job->timed_out) {
+        unlink_job(b, job);
+        release_batch(b);
+        pthread_mutex_unlock(&lock);
+        free(job->name);
+        free(job);
+        return;
+    }
+
+    job->started = now_ns();
+    pthread_mutex_unlock(&lock);
+
+    struct statx stx = { 0 };
+    int err = statx(b->fd, job->name, AT_SYMLINK_NOFOLLOW, b->mask, &stx) == -1 ? errno : 0;
+    uint64_t latency = now_ns() - job->started;
+
+    pthread_mutex_lock(&lock);
+
+    unlink_job(b, job);
+    b->progress = now_ns();
+
+    // a timed out job was already reported
+    if (!job->timed_out && !b->cancelled) {
+        b->active--;
+        push_result(b, (AstatResult) {
+            .index      = job->index,
+            .err        = err,
+            .stx        = stx,
+            .latency_ns = latency,
+        });
+    }
+
+    release_batch(b);
+    pthread_mutex_unlock(&lock);
+
+    free(job->name);
+    free(job);
+}
+
+// `dirfd` is duplicated, names passed to astat_submit() are relative to it.
+// `mask` is the STATX_* fields to request
+AstatBatch *astat_start(int dirfd, unsigned int mask) {
+
+    AstatBatch *b = malloc(sizeof(AstatBatch));
+    NON_NULL(b);
+
+    struct stat st = { 0 };
+    fstat(dirfd, &st);
+
+    *b = (AstatBatch) {
+        .fd    = fcntl(dirfd, F_DUPFD_CLOEXEC, 0),
+        .dev   = st.st_dev,
+        .mask  = mask,
+        .group = iosched_group(IO_FOREGROUND),
+        .refs  = 1,
+        .progress = now_ns(),
+    };
+
+    return b;
+}
+
+void astat_submit(AstatBatch *b, size_t index, const char *name) {
+
+    Job *job = malloc(sizeof(Job));
+    NON_NULL(job);
+
+    *job = (Job) {
+        .batch     = b,
+        .index     = index,
+        .name      = strdup(name),
+        .submitted = now_ns(),
+    };
+    NON_NULL(job->name);
+
+    pthread_mutex_lock(&lock);
+    b->refs++;
+    b->active++;
+    job->next = b->jobs;
+    if (b->jobs != NULL)
+        b->jobs->prev = job;
+    b->jobs = job;
+    pthread_mutex_unlock(&lock);
+
+    iosched_submit(b->group, b->dev, run_job, job);
+}
+
+// moves up to `max` results into `out`. stats running for longer than
+// `timeout_ns` are reported once, with `err` set to ETIMEDOUT. so are queued
+// ones, once they waited that long without any stat of the batch returning
+// meanwhile: the ones running are hung, and hold the slots of the device
+size_t astat_poll(AstatBatch *b, AstatResult *out, size_t max, uint64_t timeout_ns) {
+
+    pthread_mutex_lock(&lock);
+
+    size_t n = 0;
+    while (n < max && b->result_count > 0)
+        out[n++] = b->results[--b->result_count];
+
+    uint64_t now = now_ns();
+    bool stalled = now - b->progress >= timeout_ns;
+
+    for (Job *job = b->jobs; job != NULL && n < max; job = job->next) {
+        if (job->timed_out) continue;
+
+        bool expired = job->started != 0
+            ? now - job->started >= timeout_ns
+            : stalled && now - job->submitted >= timeout_ns;
+        if (!expired) continue;
+
+        // a queued one is dropped when its turn comes
+        job->timed_out = true;
+        b->active--;
+        out[n++] = (AstatResult) {
+            .index      = job->index,
+            .err        = ETIMEDOUT,
+            .latency_ns = now - (job->started != 0 ? job->started : job->submitted),
+        };
+    }
+
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+bool astat_pending(const AstatBatch *b) {
+    pthread_mutex_lock(&lock);
+    bool pending = b->active > 0 || b->result_count > 0;
+    pthread_mutex_unlock(&lock);
+    return pending;
+}
+
+// drops all queued stats and releases `b`
+void astat_cancel(AstatBatch *b) {
+    iosched_cancel(b->group);
+
+    pthread_mutex_lock(&lock);
+    b->cancelled = true;
+    release_batch(b);
+    pthread_mutex_unlock(&lock);
+}
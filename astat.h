@@ -0,0 +1,38 @@
+#ifndef _ASTAT_H
+#define _ASTAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <linux/stat.h> // struct statx, without _GNU_SOURCE
+
+// stats on worker threads, for directories on slow or hung filesystems.
+// a stat that blocks in the kernel cannot be interrupted, so instead of
+// waiting for it, astat_poll() reports it as timed out (ETIMEDOUT) and the
+// result is dropped once the call eventually returns. stats queued behind
+// hung ones time out as well, without ever being made.
+// stats are statx() calls, requesting the fields in the mask of the batch
+
+
+
+typedef struct {
+    size_t index;  // as passed to astat_submit()
+    int err;       // 0 on success, errno otherwise
+    struct statx stx;
+    uint64_t latency_ns;
+} AstatResult;
+
+typedef struct AstatBatch AstatBatch;
+
+
+AstatBatch *astat_start   (int dirfd, unsigned int mask);
+void        astat_submit  (AstatBatch *b, size_t index, const char *name);
+size_t      astat_poll    (AstatBatch *b, AstatResult *out, size_t max, uint64_t timeout_ns);
+bool        astat_pending (const AstatBatch *b);
+void        astat_cancel  (AstatBatch *b);
+
+
+
+#endif // _ASTAT_H
@@ -0,0 +1,516 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <grp.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+
+#include "attrs.h"
+#include "iosched.h"
+#include "util.h"
+
+
+
+#define SEED_CHUNK    64  // given paths changed per task
+#define CHECK_EVERY   256 // entries between checks for cancellation
+
+struct AttrJob {
+    AttrChange change;
+    pthread_t thread;
+    IoGroup *group; // bulk
+
+    pthread_mutex_t lock; // guards `cancelled` and `progress`
+    pthread_cond_t done;
+    bool cancelled;
+    AttrProgress progress;
+
+    AttrResult *results; // one per given path, each written by one task
+    size_t count;
+};
+
+typedef struct {
+    AttrJob *job;
+    size_t first;
+    size_t count;
+} SeedTask;
+
+typedef struct {
+    AttrJob *job;
+    char *path;
+    dev_t dev;
+} WalkTask;
+
+// `who` of `u`, `g`, `o` and `a`
+static mode_t who_bits(char c) {
+    switch (c) {
+        case 'u': return S_ISUID | S_IRWXU;
+        case 'g': return S_ISGID | S_IRWXG;
+        case 'o': return S_ISVTX | S_IRWXO;
+        default:  return 07777;
+    }
+}
+
+static mode_t perm_bits(char c) {
+    switch (c) {
+        case 'r': return S_IRUSR | S_IRGRP | S_IROTH;
+        case 'w': return S_IWUSR | S_IWGRP | S_IWOTH;
+        case 'x': return S_IXUSR | S_IXGRP | S_IXOTH;
+        case 's': return S_ISUID | S_ISGID;
+        case 't': return S_ISVTX;
+        default:  return 0;
+    }
+}
+
+static int parse_mode(AttrChange *c, const char *str) {
+
+    // octal, which sets every bit
+    if (*str >= '0' && *str <= '7') {
+        char *end = NULL;
+        unsigned long mode = strtoul(str, &end, 8);
+        if (*end != '\0' || mode > 07777) return -1;
+
+        c->clauses[0] = (ModeClause) { .who = 07777, .allow = 07777, .op = '=', .perm = mode };
+        c->clause_count = 1;
+        return 0;
+    }
+
+    // like chmod, without `ugoa` the umask applies
+    mode_t mask = umask(0);
+    umask(mask);
+
+    const char *p = str;
+    while (1) {
+        mode_t who = 0;
+        for (; *p != '\0' && strchr("ugoa", *p); ++p)
+            who |= who_bits(*p);
+
+        mode_t allow = who != 0 ? who : 07777 & ~mask;
+        if (who == 0) who = 07777;
+
+        if (*p == '\0' || !strchr("+-=", *p)) return -1;
+
+        while (*p != '\0' && strchr("+-=", *p)) {
+            if (c->clause_count == ATTRS_CLAUSES) return -1;
+
+            ModeClause *cl = &c->clauses[c->clause_count++];
+            *cl = (ModeClause) { .who = who, .allow = allow, .op = *p++ };
+
+            for (; *p != '\0' && strchr("rwxXst", *p); ++p) {
+                if (*p == 'X') cl->exec_if = true;
+                else           cl->perm |= perm_bits(*p);
+            }
+        }
+
+        if (*p == '\0') return 0;
+        if (*p++ != ',') return -1;
+    }
+}
+
+// a user or group id, by name or number. -1 (ENOENT) if there is none
+static int parse_id(const char *str, bool user, unsigned int *id) {
+
+    char *end = NULL;
+    unsigned long n = strtoul(str, &end, 10);
+    if (*end == '\0' && end != str) {
+        *id = n;
+        return 0;
+    }
+
+    if (user) {
+        struct passwd *pw = getpwnam(str);
+        if (pw != NULL) *id = pw->pw_uid;
+        errno = ENOENT;
+        return pw != NULL ? 0 : -1;
+    }
+
+    struct group *gr = getgrnam(str);
+    if (gr != NULL) *id = gr->gr_gid;
+    errno = ENOENT;
+    return gr != NULL ? 0 : -1;
+}
+
+// `user`, `user:group`, `:group` or `user:`
+static int parse_owner(AttrChange *c, char *str) {
+
+    char *group = strchr(str, ':');
+    if (group != NULL) *group++ = '\0';
+
+    unsigned int uid = -1;
+    unsigned int gid = -1;
+
+    if (*str == '\0' && (group == NULL || *group == '\0')) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (*str != '\0' && parse_id(str, true, &uid) == -1) return -1;
+    if (group != NULL && *group != '\0' && parse_id(group, false, &gid) == -1) return -1;
+
+    c->uid = uid;
+    c->gid = gid;
+    return 0;
+}
+
+// parses `cmd` (see attrs.h) into `c`. returns -1 with errno set to EINVAL if
+// it is none of them, or to ENOENT for an unknown user or group
+int attrs_parse(AttrChange *c, const char *cmd) {
+
+    *c = (AttrChange) { .uid = -1, .gid = -1 };
+
+    char buf[256] = { 0 };
+    snprintf(buf, ARRAY_LEN(buf), "%s", cmd);
+
+    char *save = NULL;
+    char *kind = strtok_r(buf, " ", &save);
+    char *arg = strtok_r(NULL, " ", &save);
+
+    if (arg != NULL && !strcmp(arg, "-R")) {
+        c->recursive = true;
+        arg = strtok_r(NULL, " ", &save);
+    }
+
+    errno = EINVAL;
+    if (kind == NULL || strtok_r(NULL, " ", &save) != NULL) return -1;
+
+    if (!strcmp(kind, "chmod") && arg != NULL) {
+        c->kind = ATTR_CHMOD;
+        return parse_mode(c, arg);
+    }
+
+    if (!strcmp(kind, "chown") && arg != NULL) {
+        c->kind = ATTR_CHOWN;
+        return parse_owner(c, arg);
+    }
+
+    if (!strcmp(kind, "touch") && arg == NULL) {
+        c->kind = ATTR_TOUCH;
+        return 0;
+    }
+
+    return -1;
+}
+
+// `mode` after applying the mode of `c`, keeping its file type
+mode_t attrs_mode(const AttrChange *c, mode_t mode) {
+
+    mode_t bits = mode & 07777;
+
+    for (size_t i=0; i < c->clause_count; ++i) {
+        const ModeClause *cl = &c->clauses[i];
+
+        mode_t perm = cl->perm;
+        if (cl->exec_if && (S_ISDIR(mode) || (bits & (S_IXUSR | S_IXGRP | S_IXOTH))))
+            perm |= S_IXUSR | S_IXGRP | S_IXOTH;
+        perm &= cl->allow;
+
+        switch (cl->op) {
+            case '+': bits |= perm; break;
+            case '-': bits &= ~perm; break;
+            default:  bits = (bits & ~cl->who) | perm; break;
+        }
+    }
+
+    return (mode & S_IFMT) | bits;
+}
+
+static bool cancelled(AttrJob *job) {
+    pthread_mutex_lock(&job->lock);
+    bool c = job->cancelled;
+    pthread_mutex_unlock(&job->lock);
+    return c;
+}
+
+static void add_changed(AttrJob *job, size_t changed) {
+    pthread_mutex_lock(&job->lock);
+    job->progress.changed += changed;
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void fail(AttrJob *job, const char *path, int error) {
+    pthread_mutex_lock(&job->lock);
+
+    if (job->progress.failed++ == 0) {
+        job->progress.error = error;
+        snprintf(job->progress.error_path, ARRAY_LEN(job->progress.error_path), "%s", path);
+    }
+
+    pthread_mutex_unlock(&job->lock);
+}
+
+// changes `name` in `fd`. `*mode` is its mode, which chmod needs, and
+// anything else only its type of. it becomes the mode after the change
+static int change_at(const AttrChange *c, int fd, const char *name, mode_t *mode) {
+
+    switch (c->kind) {
+        case ATTR_CHMOD: {
+            if (S_ISLNK(*mode)) return 0;
+
+            mode_t next = attrs_mode(c, *mode);
+            if (next != *mode && fchmodat(fd, name, next & 07777, 0) == -1)
+                return -1;
+
+            *mode = next;
+            return 0;
+        }
+
+        case ATTR_CHOWN:
+            if (fchownat(fd, name, c->uid, c->gid, AT_SYMLINK_NOFOLLOW) == -1)
+                return -1;
+
+            // which the kernel does for anything but directories
+            if (!S_ISDIR(*mode) && !S_ISLNK(*mode)) {
+                *mode &= ~S_ISUID;
+                if (*mode & S_IXGRP) *mode &= ~S_ISGID;
+            }
+            return 0;
+
+        case ATTR_TOUCH: {
+            const struct timespec times[2] = { c->time, c->time };
+            return utimensat(fd, name, times, AT_SYMLINK_NOFOLLOW);
+        }
+    }
+
+    UNREACHABLE();
+}
+
+static void submit_walk(AttrJob *job, const char *path, dev_t dev);
+
+static void walk(void *arg) {
+    WalkTask *task = arg;
+    AttrJob *job = task->job;
+    const AttrChange *c = &job->change;
+
+    DIR *d = cancelled(job) ? NULL : opendir(task->path);
+    if (d == NULL && !cancelled(job))
+        fail(job, task->path, errno);
+
+    size_t changed = 0;
+    size_t seen = 0;
+    struct dirent *ent = NULL;
+
+    while (d != NULL && (ent = readdir(d)) != NULL) {
+        const char *name = ent->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+
+        if (++seen % CHECK_EVERY == 0) {
+            add_changed(job, changed);
+            changed = 0;
+            if (cancelled(job)) break;
+        }
+
+        char path[PATH_MAX] = { 0 };
+        snprintf(path, ARRAY_LEN(path), "%s/%s", strcmp(task->path, "/") ? task->path : "", name);
+
+        // the type alone is enough, unless chmod needs the mode
+        mode_t mode = DTTOIF(ent->d_type);
+        if (c->kind == ATTR_CHMOD || ent->d_type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                fail(job, path, errno);
+                continue;
+            }
+            mode = st.st_mode;
+        }
+
+        if (change_at(c, dirfd(d), name, &mode) == -1)
+            fail(job, path, errno);
+        else
+            changed++;
+
+        if (c->recursive && S_ISDIR(mode))
+            submit_walk(job, path, task->dev);
+    }
+
+    if (d != NULL) closedir(d);
+
+    pthread_mutex_lock(&job->lock);
+    job->progress.changed += changed;
+    job->progress.pending--;
+    pthread_mutex_unlock(&job->lock);
+
+    free(task->path);
+    free(task);
+}
+
+// `dev` is the one of the parent directory, mount points are rare enough
+static void submit_walk(AttrJob *job, const char *path, dev_t dev) {
+    WalkTask *task = malloc(sizeof(WalkTask));
+    NON_NULL(task);
+
+    task->job = job;
+    task->path = strdup(path);
+    task->dev = dev;
+    NON_NULL(task->path);
+
+    pthread_mutex_lock(&job->lock);
+    job->progress.pending++;
+    pthread_mutex_unlock(&job->lock);
+
+    iosched_submit(job->group, dev, walk, task);
+}
+
+static void change_seeds(void *arg) {
+    SeedTask *task = arg;
+    AttrJob *job = task->job;
+    const AttrChange *c = &job->change;
+
+    size_t changed = 0;
+
+    for (size_t i=task->first; i < task->first + task->count && !cancelled(job); ++i) {
+        AttrResult *r = &job->results[i];
+
+        struct stat st;
+        if (lstat(r->path, &st) == -1) {
+            fail(job, r->path, errno);
+            continue;
+        }
+
+        mode_t mode = st.st_mode;
+        if (change_at(c, AT_FDCWD, r->path, &mode) == -1) {
+            fail(job, r->path, errno);
+            continue;
+        }
+
+        r->changed = true;
+        r->mode = mode;
+        r->uid = c->kind == ATTR_CHOWN && c->uid != (uid_t) -1 ? c->uid : st.st_uid;
+        r->gid = c->kind == ATTR_CHOWN && c->gid != (gid_t) -1 ? c->gid : st.st_gid;
+        r->mtime = c->kind == ATTR_TOUCH ? c->time : st.st_mtim;
+        changed++;
+
+        if (c->recursive && S_ISDIR(mode))
+            submit_walk(job, r->path, st.st_dev);
+    }
+
+    add_changed(job, changed);
+    free(task);
+}
+
+static void *job_thread(void *arg) {
+    AttrJob *job = arg;
+
+    for (size_t i=0; i < job->count; i += SEED_CHUNK) {
+        SeedTask *task = malloc(sizeof(SeedTask));
+        NON_NULL(task);
+
+        *task = (SeedTask) {
+            .job   = job,
+            .first = i,
+            .count = job->count - i < SEED_CHUNK ? job->count - i : SEED_CHUNK,
+        };
+        // selections are rarely spread over devices
+        struct stat st = { 0 };
+        lstat(job->results[i].path, &st);
+        iosched_submit(job->group, st.st_dev, change_seeds, task);
+    }
+
+    // walks submit more walks, waiting for the group waits for them too
+    iosched_wait(job->group);
+
+    pthread_mutex_lock(&job->lock);
+    job->progress.done = true;
+    pthread_cond_broadcast(&job->done);
+    pthread_mutex_unlock(&job->lock);
+
+    return NULL;
+}
+
+// applies `c` to `paths`, and below them if it is recursive
+AttrJob *attrs_start(const AttrChange *c, const char *const *paths, size_t count) {
+
+    AttrJob *job = calloc(1, sizeof(AttrJob));
+    NON_NULL(job);
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->done, NULL);
+
+    job->change = *c;
+    job->group = iosched_group(IO_BULK);
+    if (c->kind == ATTR_TOUCH)
+        clock_gettime(CLOCK_REALTIME, &job->change.time);
+
+    job->results = calloc(count + 1, sizeof(AttrResult));
+    NON_NULL(job->results);
+    job->count = count;
+
+    for (size_t i=0; i < count; ++i) {
+        job->results[i].path = strdup(paths[i]);
+        NON_NULL(job->results[i].path);
+    }
+
+    MUST_ZERO(pthread_create(&job->thread, NULL, job_thread, job));
+    return job;
+}
+
+AttrProgress attrs_progress(AttrJob *job) {
+    pthread_mutex_lock(&job->lock);
+    AttrProgress progress = job->progress;
+    pthread_mutex_unlock(&job->lock);
+    return progress;
+}
+
+// waits up to `timeout_ms` for the job to finish, forever if negative.
+// returns true if it is done
+bool attrs_wait(AttrJob *job, int timeout_ms) {
+
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += timeout_ms / 1000;
+    until.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&job->lock);
+
+    int err = 0;
+    while (!job->progress.done && err == 0) {
+        err = timeout_ms < 0
+            ? pthread_cond_wait(&job->done, &job->lock)
+            : pthread_cond_timedwait(&job->done, &job->lock, &until);
+    }
+
+    bool done = job->progress.done;
+    pthread_mutex_unlock(&job->lock);
+    return done;
+}
+
+// stops the job soon. what was changed until then stays changed
+void attrs_cancel(AttrJob *job) {
+    pthread_mutex_lock(&job->lock);
+    job->cancelled = true;
+    pthread_mutex_unlock(&job->lock);
+
+    iosched_cancel(job->group);
+}
+
+// the given paths with their new attributes, NULL until the job is done
+const AttrResult *attrs_result(AttrJob *job, size_t *count) {
+    if (!attrs_progress(job).done) return NULL;
+
+    *count = job->count;
+    return job->results;
+}
+
+// cancels the job if it is still running
+void attrs_free(AttrJob *job) {
+
+    attrs_cancel(job);
+    pthread_join(job->thread, NULL);
+    iosched_release(job->group);
+
+    for (size_t i=0; i < job->count; ++i)
+        free((char*) job->results[i].path);
+
+    free(job->results);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->done);
+    free(job);
+}
@@ -0,0 +1,90 @@
+#ifndef _ATTRS_H
+#define _ATTRS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <limits.h>
+
+#include <sys/types.h>
+
+// changes the mode, owner or times of many paths at once, like chmod, chown
+// and touch, without a process per path. a change is parsed from one of
+//
+//   chmod [-R] <mode>          octal, or symbolic (`u+x,go-w`, `a=rX`)
+//   chown [-R] <user>[:<group>]  names or ids, either may be left out
+//   touch [-R]                 sets both times to now
+//
+// and applied on a background thread. with -R directories are walked in
+// parallel, one bulk task per directory (see iosched.h), changing entries
+// through fchmodat(), fchownat() and utimensat() on the directory's fd.
+// symlinks are changed themselves (chown -h, touch -h), except by chmod,
+// which leaves them alone as they have no mode of their own.
+//
+// the new attributes of the given paths are known without reading them again
+// (see AttrResult), so the listing they are in can be updated in place
+
+
+
+#define ATTRS_CLAUSES 16
+
+typedef enum {
+    ATTR_CHMOD,
+    ATTR_CHOWN,
+    ATTR_TOUCH,
+} AttrKind;
+
+// one operation of a symbolic mode, eg: `go-w`
+typedef struct {
+    mode_t who;   // bits `=` replaces
+    mode_t allow; // bits it may set or clear: `who`, less the umask if no
+                  // `ugoa` was given
+    char op;      // '+', '-' or '='
+    mode_t perm;
+    bool exec_if; // `X`: execute, only for directories and executables
+} ModeClause;
+
+typedef struct {
+    AttrKind kind;
+    bool recursive;
+    ModeClause clauses[ATTRS_CLAUSES]; // chmod
+    size_t clause_count;
+    uid_t uid;  // chown, -1 keeps the owner
+    gid_t gid;  // chown, -1 keeps the group
+    struct timespec time; // touch, set by attrs_start()
+} AttrChange;
+
+// the attributes of a given path after the change
+typedef struct {
+    const char *path;
+    bool changed; // false if it failed, or the job was cancelled first
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    struct timespec mtime;
+} AttrResult;
+
+typedef struct {
+    size_t changed;
+    size_t failed;
+    size_t pending; // directories left to walk
+    bool done;
+    int error;      // of the first failure
+    char error_path[PATH_MAX];
+} AttrProgress;
+
+typedef struct AttrJob AttrJob;
+
+
+int    attrs_parse    (AttrChange *c, const char *cmd);
+mode_t attrs_mode     (const AttrChange *c, mode_t mode);
+AttrJob *attrs_start  (const AttrChange *c, const char *const *paths, size_t count);
+AttrProgress attrs_progress (AttrJob *job);
+bool   attrs_wait     (AttrJob *job, int timeout_ms);
+void   attrs_cancel   (AttrJob *job);
+const AttrResult *attrs_result (AttrJob *job, size_t *count);
+void   attrs_free     (AttrJob *job);
+
+
+
+#endif // _ATTRS_H
@@ -0,0 +1,578 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "batch.h"
+#include "strbuf.h"
+#include "timing.h"
+#include "util.h"
+
+
+
+// longer lines are rejected, no path or template needs more
+#define BATCH_LINE (64 * 1024)
+// replies are written out once this much is pending
+#define BATCH_FLUSH (64 * 1024)
+// how long `ls` waits between polls for stats left to worker threads, and
+// how long at most, a little longer than they take to time out
+#define POLL_US 1000
+#define LS_WAIT_NS (4000 * 1000000ull)
+
+typedef struct {
+    int in;
+    int out;
+    char buf[BATCH_LINE];
+    size_t start;
+    size_t end;
+    StrBuf reply; // pending output
+    bool eof;
+    bool cut;      // the last line read did not fit `buf`
+    bool skipping; // over the rest of it
+} Session;
+
+// returns -1 if the replies could not be written, eg: EPIPE once a client
+// hung up
+static int flush_replies(Session *s) {
+    size_t done = 0;
+    while (done < s->reply.len) {
+        ssize_t n = write(s->out, s->reply.data + done, s->reply.len - done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) return -1;
+        done += n;
+    }
+
+    strbuf_clear(&s->reply);
+    return 0;
+}
+
+// the next line, without its newline, or NULL at the end of the input.
+// pending replies are flushed before blocking on a read
+static char *read_line(Session *s) {
+
+    while (1) {
+        char *start = s->buf + s->start;
+        char *nl = memchr(start, '\n', s->end - s->start);
+
+        if (s->skipping) {
+            // the rest of a cut line, up to its newline
+            s->start = nl != NULL ? (size_t) (nl + 1 - s->buf) : s->end;
+            s->skipping = nl == NULL;
+            if (nl != NULL) continue;
+
+        } else if (nl != NULL) {
+            *nl = '\0';
+            s->start = nl + 1 - s->buf;
+            return start;
+
+        } else if (s->start == 0 && s->end == ARRAY_LEN(s->buf) - 1) {
+            // a line filling the whole buffer is cut, the rest of it dropped
+            s->buf[s->end] = '\0';
+            s->start = s->end;
+            s->cut = true;
+            s->skipping = true;
+            return start;
+
+        } else if (s->eof && s->end > s->start) {
+            // the last line may lack its newline
+            s->buf[s->end] = '\0';
+            s->start = s->end;
+            return start;
+        }
+
+        if (s->eof) return NULL;
+
+        memmove(s->buf, s->buf + s->start, s->end - s->start);
+        s->end -= s->start;
+        s->start = 0;
+
+        if (flush_replies(s) == -1) return NULL;
+
+        ssize_t n = read(s->in, s->buf + s->end, ARRAY_LEN(s->buf) - 1 - s->end);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) s->eof = true;
+        else        s->end += n;
+    }
+}
+
+static void json_string(StrBuf *sb, const char *str) {
+    strbuf_append_char(sb, '"');
+
+    for (const unsigned char *p = (const unsigned char *) str; *p != '\0'; ++p) {
+        switch (*p) {
+            case '"':  strbuf_append_str(sb, "\\\""); break;
+            case '\\': strbuf_append_str(sb, "\\\\"); break;
+            case '\n': strbuf_append_str(sb, "\\n");  break;
+            case '\t': strbuf_append_str(sb, "\\t");  break;
+            default:
+                if (*p < 0x20) {
+                    char esc[8];
+                    snprintf(esc, ARRAY_LEN(esc), "\\u%04x", *p);
+                    strbuf_append_str(sb, esc);
+                } else {
+                    strbuf_append_char(sb, *p);
+                }
+        }
+    }
+
+    strbuf_append_char(sb, '"');
+}
+
+// appends `,"key":` for the next member of an object
+static void json_key(StrBuf *sb, const char *key) {
+    strbuf_append_char(sb, ',');
+    json_string(sb, key);
+    strbuf_append_char(sb, ':');
+}
+
+static void json_uint(StrBuf *sb, unsigned long long value) {
+    char buf[24];
+    snprintf(buf, ARRAY_LEN(buf), "%llu", value);
+    strbuf_append_str(sb, buf);
+}
+
+static void reply_error(Session *s, const char *error) {
+    strbuf_append_str(&s->reply, "{\"ok\":false,\"error\":");
+    json_string(&s->reply, error);
+    strbuf_append_str(&s->reply, "}\n");
+}
+
+// the start of a successful reply, to be ended with end_reply()
+static void begin_reply(Session *s, const FileManager *fm) {
+    strbuf_append_str(&s->reply, "{\"ok\":true");
+    json_key(&s->reply, "cwd");
+    json_string(&s->reply, fm->dir->path);
+}
+
+static void end_reply(Session *s) {
+    strbuf_append_str(&s->reply, "}\n");
+}
+
+static void reply_ok(Session *s, const FileManager *fm) {
+    begin_reply(s, fm);
+    end_reply(s);
+}
+
+static Entry *find_entry(const FileManager *fm, const char *name) {
+    for (size_t i=0; i < fm->dir->size; ++i)
+        if (!strcmp(fm->dir->entries[i].name, name))
+            return &fm->dir->entries[i];
+    return NULL;
+}
+
+static void cmd_cd(Session *s, FileManager *fm, const char *arg) {
+
+    if (!strcmp(arg, "..")) {
+        fm_cd_parent(fm);
+        reply_ok(s, fm);
+        return;
+    }
+
+    // entries of the current directory go through fm_cd(), which also
+    // enters archives and directories inside of them. it only follows links
+    // resolved for display, fm_cd_abs() follows the others itself
+    Entry *e = strchr(arg, '/') == NULL ? find_entry(fm, arg) : NULL;
+    if (e != NULL && !(entry_is_link(e) && fm->dir->archive == NULL)) {
+        char before[PATH_MAX] = { 0 };
+        snprintf(before, ARRAY_LEN(before), "%s", fm->dir->path);
+
+        fm->cursor = e - fm->dir->entries;
+        fm_cd(fm);
+
+        if (!strcmp(before, fm->dir->path))
+            reply_error(s, "Not a directory");
+        else
+            reply_ok(s, fm);
+        return;
+    }
+
+    if (fm->dir->archive != NULL && *arg != '/') {
+        reply_error(s, "No such entry in archive");
+        return;
+    }
+
+    char path[PATH_MAX * 2] = { 0 };
+    if (*arg == '/')
+        snprintf(path, ARRAY_LEN(path), "%s", arg);
+    else
+        snprintf(path, ARRAY_LEN(path), "%s/%s", fm->dir->path, arg);
+
+    if (fm_cd_abs(fm, path) == -1)
+        reply_error(s, strerror(errno));
+    else
+        reply_ok(s, fm);
+}
+
+static void cmd_ls(Session *s, FileManager *fm) {
+
+    // changes on disk, and stats left to worker threads on slow filesystems.
+    // entries whose stats did not come in by then are listed as pending
+    uint64_t deadline = now_ns() + LS_WAIT_NS;
+    while (fm_poll(fm) && now_ns() < deadline)
+        usleep(POLL_US);
+
+    begin_reply(s, fm);
+    json_key(&s->reply, "entries");
+    strbuf_append_char(&s->reply, '[');
+
+    for (size_t i=0; i < fm->dir->size; ++i) {
+        const Entry *e = &fm->dir->entries[i];
+        StrBuf *sb = &s->reply;
+
+        char path[PATH_MAX] = { 0 };
+        fm_get_path(fm, e, path, ARRAY_LEN(path));
+
+        if (i > 0) strbuf_append_char(sb, ',');
+        strbuf_append_str(sb, "{\"name\":");
+        json_string(sb, e->name);
+        json_key(sb, "type");
+        json_string(sb, e->type);
+
+        if (e->stat == STAT_DONE) {
+            json_key(sb, "size");
+            json_uint(sb, e->size);
+            json_key(sb, "mode");
+            json_uint(sb, e->mode);
+            json_key(sb, "mtime");
+            json_uint(sb, e->mtime.tv_sec);
+        } else {
+            // still pending after LS_WAIT_NS, or given up on
+            strbuf_append_str(sb, e->stat == STAT_PENDING ? ",\"pending\":true" : ",\"timeout\":true");
+        }
+
+        if (fm_is_selected(fm, path))
+            strbuf_append_str(sb, ",\"selected\":true");
+
+        strbuf_append_char(sb, '}');
+    }
+
+    strbuf_append_char(&s->reply, ']');
+    end_reply(s);
+}
+
+// (un)selects the entries of the current directory matching `glob`
+static void cmd_select(Session *s, FileManager *fm, const char *glob, bool select) {
+
+    size_t matched = 0;
+
+    for (size_t i=0; i < fm->dir->size; ++i) {
+        const Entry *e = &fm->dir->entries[i];
+        if (fnmatch(glob, e->name, FNM_PERIOD) != 0) continue;
+
+        char path[PATH_MAX] = { 0 };
+        fm_select_path(fm, fm_get_path(fm, e, path, ARRAY_LEN(path)), select);
+        matched++;
+    }
+
+    begin_reply(s, fm);
+    json_key(&s->reply, "matched");
+    json_uint(&s->reply, matched);
+    json_key(&s->reply, "selected");
+    json_uint(&s->reply, fm->sel.size);
+    end_reply(s);
+}
+
+static void cmd_selection(Session *s, FileManager *fm) {
+    begin_reply(s, fm);
+    json_key(&s->reply, "paths");
+    strbuf_append_char(&s->reply, '[');
+
+    for (size_t i=0; i < fm->sel.size; ++i) {
+        if (i > 0) strbuf_append_char(&s->reply, ',');
+        json_string(&s->reply, fm->sel.paths[i]);
+    }
+
+    strbuf_append_char(&s->reply, ']');
+    end_reply(s);
+}
+
+static void cmd_run(Session *s, FileManager *fm, const char *cmd) {
+
+    // commands write to stdout, which must not end up between replies
+    if (flush_replies(s) == -1) return;
+
+    size_t count = fm->sel.size;
+    int failed = fm_run_cmd_selected(fm, cmd);
+
+    if (failed == -1) {
+        reply_error(s, "Invalid command template");
+        return;
+    }
+
+    begin_reply(s, fm);
+    json_key(&s->reply, "paths");
+    json_uint(&s->reply, count);
+    json_key(&s->reply, "failed");
+    json_uint(&s->reply, failed);
+    end_reply(s);
+}
+
+// renames the selected entries of the current directory (or all of them)
+// with a pattern, see renames.h. `-n ` first only plans the renames
+static void cmd_rename(Session *s, FileManager *fm, const char *arg) {
+
+    bool dry_run = !strncmp(arg, "-n ", 3);
+    if (dry_run) arg += 3;
+
+    RenamePattern pat;
+    if (renames_pattern(&pat, arg) == -1) {
+        reply_error(s, "Invalid pattern");
+        return;
+    }
+
+    char **names = NULL;
+    size_t count = fm_rename_names(fm, &names);
+
+    // the new names go into one buffer, which may move while it grows
+    size_t *offsets = malloc((count + 1) * sizeof(size_t));
+    char **to = malloc((count + 1) * sizeof(char *));
+    NON_NULL(offsets);
+    NON_NULL(to);
+    StrBuf buf = { 0 };
+    StrBuf name = { 0 };
+
+    for (size_t i=0; i < count; ++i) {
+        offsets[i] = buf.len;
+        renames_substitute(&pat, names[i], &name);
+        strbuf_append(&buf, name.data, name.len + 1);
+    }
+    for (size_t i=0; i < count; ++i)
+        to[i] = buf.data + offsets[i];
+
+    RenamePlan p;
+    char error[PATH_MAX + 64];
+
+    if (renames_plan(&p, fm->dir->fd, names, to, count) == -1) {
+        snprintf(error, ARRAY_LEN(error), "%s: %s", names[p.failed], strerror(errno));
+        reply_error(s, error);
+
+    } else if (!dry_run && fm_rename(fm, &p) == -1) {
+        snprintf(error, ARRAY_LEN(error), "%s: %s%s", renames_name(&p, p.steps[p.failed].from),
+                 strerror(errno), p.rolled_back ? "" : " (not undone)");
+        reply_error(s, error);
+
+    } else {
+        begin_reply(s, fm);
+        json_key(&s->reply, "renamed");
+        json_uint(&s->reply, p.count);
+        json_key(&s->reply, "cycles");
+        json_uint(&s->reply, p.cycles);
+
+        if (dry_run) {
+            json_key(&s->reply, "plan");
+            strbuf_append_char(&s->reply, '[');
+            for (size_t i=0; i < p.count; ++i) {
+                strbuf_append_str(&s->reply, i > 0 ? ",[" : "[");
+                json_string(&s->reply, renames_name(&p, p.ops[i].from));
+                strbuf_append_char(&s->reply, ',');
+                json_string(&s->reply, renames_name(&p, p.ops[i].to));
+                strbuf_append_char(&s->reply, ']');
+            }
+            strbuf_append_char(&s->reply, ']');
+        }
+        end_reply(s);
+    }
+
+    renames_free(&p);
+    strbuf_free(&name);
+    strbuf_free(&buf);
+    free(to);
+    free(offsets);
+    free(names);
+    renames_pattern_free(&pat);
+}
+
+// chmod, chown and touch, see attrs.h
+static void cmd_attrs(Session *s, FileManager *fm, const char *cmd, const char *arg) {
+
+    char line[256];
+    snprintf(line, ARRAY_LEN(line), "%s %s", cmd, arg);
+
+    AttrChange c;
+    if (attrs_parse(&c, line) == -1) {
+        reply_error(s, errno == ENOENT ? "No such user or group" : "Invalid arguments");
+        return;
+    }
+
+    AttrJob *job = fm_attrs_start(fm, &c);
+    if (job == NULL) {
+        reply_error(s, "Nothing to change");
+        return;
+    }
+
+    attrs_wait(job, -1);
+    fm_attrs_finish(fm, job);
+    AttrProgress p = attrs_progress(job);
+
+    if (p.failed > 0) {
+        char error[PATH_MAX + 64];
+        snprintf(error, ARRAY_LEN(error), "%s: %s (%lu failed, %lu changed)", p.error_path,
+                 strerror(p.error), (unsigned long) p.failed, (unsigned long) p.changed);
+        reply_error(s, error);
+
+    } else {
+        begin_reply(s, fm);
+        json_key(&s->reply, "changed");
+        json_uint(&s->reply, p.changed);
+        end_reply(s);
+    }
+
+    attrs_free(job);
+}
+
+// returns false once the session should end
+static bool run_command(Session *s, FileManager *fm, char *line) {
+
+    char *arg = strchr(line, ' ');
+    if (arg != NULL) *arg++ = '\0';
+    else             arg = "";
+
+    const char *cmd = line;
+
+    if (*cmd == '\0' || *cmd == '#') return true;
+
+    bool needs_arg = !strcmp(cmd, "cd") || !strcmp(cmd, "cursor")
+        || !strcmp(cmd, "select") || !strcmp(cmd, "unselect") || !strcmp(cmd, "run") || !strcmp(cmd, "rename")
+        || !strcmp(cmd, "chmod") || !strcmp(cmd, "chown");
+    if (needs_arg && *arg == '\0') {
+        reply_error(s, "Missing argument");
+        return true;
+    }
+
+    if      (!strcmp(cmd, "quit"))      return false;
+    else if (!strcmp(cmd, "cd"))        cmd_cd(s, fm, arg);
+    else if (!strcmp(cmd, "ls"))        cmd_ls(s, fm);
+    else if (!strcmp(cmd, "select"))    cmd_select(s, fm, arg, true);
+    else if (!strcmp(cmd, "unselect"))  cmd_select(s, fm, arg, false);
+    else if (!strcmp(cmd, "selection")) cmd_selection(s, fm);
+    else if (!strcmp(cmd, "run"))       cmd_run(s, fm, arg);
+    else if (!strcmp(cmd, "rename"))    cmd_rename(s, fm, arg);
+    else if (!strcmp(cmd, "chmod") || !strcmp(cmd, "chown") || !strcmp(cmd, "touch"))
+        cmd_attrs(s, fm, cmd, arg);
+
+    else if (!strcmp(cmd, "pwd")) {
+        reply_ok(s, fm);
+
+    } else if (!strcmp(cmd, "parent")) {
+        fm_cd_parent(fm);
+        reply_ok(s, fm);
+
+    } else if (!strcmp(cmd, "hidden")) {
+        fm_toggle_hidden(fm);
+        begin_reply(s, fm);
+        strbuf_append_str(&s->reply, fm->show_hidden ? ",\"hidden\":true" : ",\"hidden\":false");
+        end_reply(s);
+
+    } else if (!strcmp(cmd, "clear")) {
+        fm_clear_selection(fm);
+        reply_ok(s, fm);
+
+    } else if (!strcmp(cmd, "cursor")) {
+        Entry *e = find_entry(fm, arg);
+        if (e == NULL) {
+            reply_error(s, "No such entry");
+        } else {
+            fm->cursor = e - fm->dir->entries;
+            reply_ok(s, fm);
+        }
+
+    } else {
+        reply_error(s, "Unknown command");
+    }
+
+    if (s->reply.len >= BATCH_FLUSH)
+        flush_replies(s);
+
+    return true;
+}
+
+// runs the commands read from `in` until the end of input or `quit`.
+// returns 1 if the session ended with `quit`, 0 at the end of input,
+// -1 if replies could not be written
+int batch_run(FileManager *fm, int in, int out) {
+
+    Session *s = calloc(1, sizeof(Session));
+    NON_NULL(s);
+    s->in = in;
+    s->out = out;
+
+    int result = 0;
+    char *line = NULL;
+
+    while ((line = read_line(s)) != NULL) {
+        // none of a cut line runs, a part of it could be a command of its own
+        if (s->cut) {
+            s->cut = false;
+            reply_error(s, "Line too long");
+            continue;
+        }
+
+        if (!run_command(s, fm, line)) {
+            result = 1;
+            break;
+        }
+    }
+
+    if (flush_replies(s) == -1)
+        result = -1;
+
+    strbuf_free(&s->reply);
+    free(s);
+    return result;
+}
+
+// serves sessions on the Unix socket `path`, one client at a time, with the
+// state of `fm` carried over between them. returns once a client sends
+// `quit`, or -1 if the socket could not be set up
+int batch_listen(FileManager *fm, const char *path) {
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= ARRAY_LEN(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    snprintf(addr.sun_path, ARRAY_LEN(addr.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+
+    // a client hanging up before reading its replies ends its session with
+    // EPIPE, instead of the process
+    signal(SIGPIPE, SIG_IGN);
+
+    // a stale socket left by an earlier run, but never any other file
+    struct stat statbuf = { 0 };
+    if (lstat(path, &statbuf) == 0 && S_ISSOCK(statbuf.st_mode))
+        unlink(path);
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 || listen(fd, 8) == -1) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    int result = 0;
+    while (result != 1) {
+        int client = accept(fd, NULL, NULL);
+        if (client == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        result = batch_run(fm, client, client);
+        close(client);
+    }
+
+    close(fd);
+    unlink(path);
+    return 0;
+}
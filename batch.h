@@ -0,0 +1,46 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include "fm.h"
+
+// headless mode: commands are read line by line and applied through the
+// fm_*() API, with one line of JSON written back for every command.
+// a command is a word, optionally followed by a space and its argument,
+// which runs to the end of the line (so paths may contain spaces). lines
+// longer than 64 KiB are rejected whole:
+//
+//   cd <path>        enter a directory or archive, relative to the current one
+//   parent           go up a directory
+//   pwd              print the current directory
+//   ls               list the current directory. on slow filesystems, entries
+//                    not stat'ed within seconds are "pending" or "timeout"
+//   hidden           toggle hidden files
+//   cursor <name>    move the cursor onto an entry
+//   select <glob>    select the entries matching a glob
+//   unselect <glob>  unselect them
+//   clear            clear the selection
+//   selection        print the selected paths
+//   run <template>   run a command on the selection, see tmpl.h
+//   rename [-n ]<s/re/repl/>  rename the selected entries of the current
+//                    directory (or all of them), -n only lists the renames
+//   chmod [-R ]<mode>  change the mode of the selection (or of the entry
+//                    under the cursor), see attrs.h
+//   chown [-R ]<user>[:<group>]  change its owner
+//   touch [-R]       set its times to now
+//   quit             end the session
+//
+//   {"ok":true,"cwd":"/tmp"}
+//   {"ok":false,"error":"No such file or directory"}
+//
+// replies are buffered while more input is ready, and written out before
+// waiting for more, so a script may pipe in thousands of commands at once
+// or talk to fm one command at a time
+
+
+
+int batch_run    (FileManager *fm, int in, int out);
+int batch_listen (FileManager *fm, const char *path);
+
+
+
+#endif // _BATCH_H
@@ -0,0 +1,606 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/stat.h>
+
+#include <ncurses.h>
+
+#include "fm.h"
+#include "dir.h"
+#include "ui.h"
+#include "jumpdb.h"
+#include "dircache.h"
+#include "iosched.h"
+#include "util.h"
+#include "timing.h"
+
+// benchmarks the directory loading stages and rendering on synthetic trees,
+// navigation between directories, queries of the jump database, and stats
+// competing with a bulk copy in the background scheduler.
+// results are printed as one JSON object per line:
+//
+//   {"bench":"sort","entries":10000,"iterations":100,"min_us":...,"p50_us":...}
+//
+// usage: fm-bench [-i iterations] [-d tmpdir] [entries...]
+
+
+
+#define MAX_SAMPLES 1000
+// directories navigated between, twice as many as the cache keeps idle
+#define NAV_DIRS 32
+// stats timed per round while copies of IO_COPY_SIZE bytes keep the
+// background scheduler busy, IO_COPIES at a time
+#define IO_STATS     64
+#define IO_COPIES    32
+#define IO_COPY_SIZE (256 * 1024)
+
+typedef struct {
+    uint64_t ns[MAX_SAMPLES];
+    size_t count;
+} Samples;
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile, `samples` must be sorted
+static double percentile_us(const Samples *s, double p) {
+    size_t rank = (size_t) (p * (s->count - 1) + 0.5);
+    return s->ns[rank] / 1000.0;
+}
+
+static void report(const char *bench, size_t entries, Samples *s) {
+
+    if (s->count == 0) return;
+    qsort(s->ns, s->count, sizeof(*s->ns), compare_u64);
+
+    uint64_t total = 0;
+    for (size_t i=0; i < s->count; ++i)
+        total += s->ns[i];
+
+    printf(
+        "{\"bench\":\"%s\",\"entries\":%zu,\"iterations\":%zu,"
+        "\"min_us\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,"
+        "\"max_us\":%.1f,\"mean_us\":%.1f}\n",
+        bench,
+        entries,
+        s->count,
+        percentile_us(s, 0.0),
+        percentile_us(s, 0.5),
+        percentile_us(s, 0.9),
+        percentile_us(s, 0.99),
+        percentile_us(s, 1.0),
+        total / 1000.0 / s->count
+    );
+    fflush(stdout);
+
+    s->count = 0;
+}
+
+static void record(Samples *s, uint64_t start) {
+    if (s->count < MAX_SAMPLES)
+        s->ns[s->count++] = now_ns() - start;
+}
+
+// scrambles `i`, so that creation order does not match sorted order
+static uint32_t scramble(uint32_t i) {
+    i ^= i >> 16;
+    i *= 0x7feb352d;
+    i ^= i >> 15;
+    i *= 0x846ca68b;
+    i ^= i >> 16;
+    return i;
+}
+
+typedef enum {
+    KIND_FILE,
+    KIND_DIR,
+    KIND_LINK,
+} EntryKind;
+
+// a mix of regular files, some hidden, directories and symlinks
+static EntryKind entry_name(size_t i, char *buf, size_t size) {
+    snprintf(
+        buf,
+        size,
+        "%s%08x-entry.%s",
+        i % 20 == 0 ? "." : "",
+        scramble(i),
+        i % 3 == 0 ? "txt" : "c"
+    );
+
+    return i % 50 == 1  ? KIND_DIR
+         : i % 100 == 2 ? KIND_LINK
+         : KIND_FILE;
+}
+
+static void make_tree(const char *root, size_t entries) {
+
+    int err = mkdir(root, 0755);
+    if (err == -1) {
+        perror(root);
+        exit(EXIT_FAILURE);
+    }
+
+    int rootfd = open(root, O_RDONLY | O_DIRECTORY);
+    if (rootfd == -1) {
+        perror(root);
+        exit(EXIT_FAILURE);
+    }
+
+    char prev[NAME_MAX + 1] = "file";
+
+    for (size_t i=0; i < entries; ++i) {
+
+        char name[NAME_MAX + 1] = { 0 };
+        EntryKind kind = entry_name(i, name, ARRAY_LEN(name));
+
+        if (kind == KIND_DIR) {
+            mkdirat(rootfd, name, 0755);
+
+        } else if (kind == KIND_LINK) {
+            symlinkat(prev, rootfd, name);
+
+        } else {
+            int fd = openat(rootfd, name, O_CREAT | O_WRONLY, 0644);
+            if (fd == -1) {
+                perror(name);
+                exit(EXIT_FAILURE);
+            }
+            // sparse, costs no disk space
+            ftruncate(fd, scramble(i) % (1 << 20));
+            close(fd);
+            strncpy(prev, name, ARRAY_LEN(prev));
+        }
+    }
+
+    close(rootfd);
+}
+
+// removes by regenerating the names instead of walking the tree, which keeps
+// cleanup fast when stats are slowed down by bench/slowfs.c
+static void remove_tree(const char *root, size_t entries) {
+
+    int rootfd = open(root, O_RDONLY | O_DIRECTORY);
+    if (rootfd == -1) return;
+
+    for (size_t i=0; i < entries; ++i) {
+        char name[NAME_MAX + 1] = { 0 };
+        EntryKind kind = entry_name(i, name, ARRAY_LEN(name));
+        unlinkat(rootfd, name, kind == KIND_DIR ? AT_REMOVEDIR : 0);
+    }
+
+    close(rootfd);
+    rmdir(root);
+}
+
+static void restore(Directory *dir, const Entry *orig, size_t size) {
+    dir->size = size;
+    memcpy(dir->entries, orig, size * sizeof(Entry));
+}
+
+static SCREEN *offscreen_init(void) {
+
+    FILE *null = fopen("/dev/null", "w+");
+    if (null == NULL) return NULL;
+
+    const char *term = getenv("TERM");
+    SCREEN *screen = newterm(term != NULL ? term : "xterm", null, null);
+    if (screen == NULL) {
+        fclose(null);
+        return NULL;
+    }
+
+    set_term(screen);
+    resize_term(50, 200);
+    curses_init_colors();
+    return screen;
+}
+
+static void bench_size(const char *base, size_t entries, size_t iterations) {
+
+    char root[PATH_MAX] = { 0 };
+    snprintf(root, ARRAY_LEN(root), "%s/%zu", base, entries);
+
+    fprintf(stderr, "generating %zu entries...\n", entries);
+    make_tree(root, entries);
+
+    Samples s = { 0 };
+    Directory dir = DIRECTORY_INIT;
+
+    // reading into the same Directory each time, like navigation does
+    for (size_t i=0; i < iterations; ++i) {
+        uint64_t start = now_ns();
+        dir_read(&dir, root);
+        record(&s, start);
+    }
+    report("enumerate", entries, &s);
+
+    // pristine readdir order, restored before every iteration
+    size_t size = dir.size;
+    Entry *orig = malloc(size * sizeof(Entry));
+    NON_NULL(orig);
+    memcpy(orig, dir.entries, size * sizeof(Entry));
+
+    for (size_t i=0; i < iterations; ++i) {
+        restore(&dir, orig, size);
+        uint64_t start = now_ns();
+        dir_filter_hidden(&dir);
+        record(&s, start);
+    }
+    report("filter", entries, &s);
+
+    for (size_t i=0; i < iterations; ++i) {
+        restore(&dir, orig, size);
+        uint64_t start = now_ns();
+        dir_stat(&dir);
+        record(&s, start);
+    }
+    report("stat", entries, &s);
+
+    memcpy(orig, dir.entries, size * sizeof(Entry));
+
+    for (size_t i=0; i < iterations; ++i) {
+        restore(&dir, orig, size);
+        uint64_t start = now_ns();
+        dir_sort(&dir);
+        record(&s, start);
+    }
+    report("sort", entries, &s);
+
+    // every stage, as done by fm on navigation
+    for (size_t i=0; i < iterations; ++i) {
+        uint64_t start = now_ns();
+        dir_read(&dir, root);
+        dir_filter_hidden(&dir);
+        dir_stat(&dir);
+        dir_sort(&dir);
+        record(&s, start);
+    }
+    report("load", entries, &s);
+
+    // until the listing can be shown, as stats may be left to worker threads
+    // on slow filesystems
+    for (size_t i=0; i < iterations; ++i) {
+        uint64_t start = now_ns();
+        dir_read(&dir, root);
+        dir_filter_hidden(&dir);
+        dir_sort(&dir);
+        dir_stat_adaptive(&dir);
+        record(&s, start);
+    }
+    report("load_adaptive", entries, &s);
+
+    // reload fully, rendering expects every entry to be stat'ed
+    dir_read(&dir, root);
+    dir_filter_hidden(&dir);
+    dir_sort(&dir);
+    dir_stat(&dir);
+
+    SCREEN *screen = offscreen_init();
+    if (screen == NULL) {
+        fprintf(stderr, "could not create an offscreen terminal, skipping render\n");
+
+    } else {
+        FileManager fm = {
+            .cursor      = 0,
+            .dir         = &dir,
+            .wrap_cursor = true,
+        };
+
+        for (size_t i=0; i < iterations; ++i) {
+            uint64_t start = now_ns();
+            erase();
+            draw_entries(&fm, 2, 2, LINES - 2, COLS);
+            record(&s, start);
+        }
+        report("render", entries, &s);
+
+        endwin();
+        delscreen(screen);
+    }
+
+    free(orig);
+    dir_free(&dir);
+    remove_tree(root, entries);
+}
+
+// `entries` files spread over NAV_DIRS directories, visited in turn like
+// navigation does. after a round to warm up, directories are loaded into
+// recycled memory: the heap allocations of the rounds after are reported
+static void bench_navigate(const char *base, size_t entries, size_t iterations) {
+
+    char root[PATH_MAX] = { 0 };
+    snprintf(root, ARRAY_LEN(root), "%s/nav-%zu", base, entries);
+    mkdir(root, 0755);
+
+    size_t per_dir = entries / NAV_DIRS + 1;
+    for (size_t d=0; d < NAV_DIRS; ++d) {
+        char dir[PATH_MAX] = { 0 };
+        snprintf(dir, ARRAY_LEN(dir), "%s/%02zu", root, d);
+        make_tree(dir, per_dir);
+    }
+
+    FileManager fm = { 0 };
+    fm_init(&fm, root);
+
+    Samples s = { 0 };
+    size_t warm = 0;
+
+    for (size_t i=0; i <= iterations; ++i) {
+        if (i == 1) warm = dircache_allocs();
+
+        for (size_t d=0; d < NAV_DIRS; ++d) {
+            char dir[PATH_MAX] = { 0 };
+            snprintf(dir, ARRAY_LEN(dir), "%s/%02zu", root, (d * 7) % NAV_DIRS);
+
+            uint64_t start = now_ns();
+            fm_cd_abs(&fm, dir);
+            if (i > 0) record(&s, start);
+        }
+    }
+
+    printf("{\"bench\":\"navigate_allocs\",\"entries\":%zu,\"warmup\":%zu,\"steady\":%zu}\n",
+           entries, warm, dircache_allocs() - warm);
+    report("navigate", entries, &s);
+
+    fm_destroy(&fm);
+    for (size_t d=0; d < NAV_DIRS; ++d) {
+        char dir[PATH_MAX] = { 0 };
+        snprintf(dir, ARRAY_LEN(dir), "%s/%02zu", root, d);
+        remove_tree(dir, per_dir);
+    }
+    rmdir(root);
+}
+
+// a jump database of `entries` paths, queried as if typed key by key
+static void bench_jumps(const char *base, size_t entries, size_t iterations) {
+
+    char file[PATH_MAX] = { 0 };
+    snprintf(file, ARRAY_LEN(file), "%s/jumps-%zu", base, entries);
+
+    JumpDb db;
+    if (jumpdb_open(&db, file) == -1) {
+        perror(file);
+        return;
+    }
+
+    for (size_t i=0; i < entries; ++i) {
+        char path[PATH_MAX] = { 0 };
+        snprintf(path, ARRAY_LEN(path), "/home/user/src/project-%u/module-%zu", scramble(i) % 1000, i);
+        jumpdb_visit(&db, path);
+    }
+    jumpdb_close(&db);
+
+    Samples s = { 0 };
+    JumpMatch matches[32];
+
+    // what startup pays, and what the first query pays
+    for (size_t i=0; i < iterations; ++i) {
+        uint64_t start = now_ns();
+        jumpdb_open(&db, file);
+        record(&s, start);
+        jumpdb_close(&db);
+    }
+    report("jump_open", entries, &s);
+
+    for (size_t i=0; i < iterations; ++i) {
+        jumpdb_open(&db, file);
+        uint64_t start = now_ns();
+        jumpdb_query(&db, "", matches, ARRAY_LEN(matches));
+        record(&s, start);
+        jumpdb_close(&db);
+    }
+    report("jump_index", entries, &s);
+
+    static const char *typed[] = { "m", "mo", "mod", "mod4", "mod42", "p", "pr", "pro", "proj7" };
+
+    jumpdb_open(&db, file);
+    for (size_t i=0; i < iterations; ++i) {
+        for (size_t q=0; q < ARRAY_LEN(typed); ++q) {
+            uint64_t start = now_ns();
+            jumpdb_query(&db, typed[q], matches, ARRAY_LEN(matches));
+            record(&s, start);
+        }
+    }
+    report("jump_query", entries, &s);
+
+    jumpdb_close(&db);
+    unlink(file);
+}
+
+typedef struct {
+    IoGroup *group;
+    dev_t dev;
+    char src[PATH_MAX];
+    char dst[PATH_MAX];
+    size_t copied; // bytes, only touched by the task of this copy
+} CopyJob;
+
+static int probe_fd = -1;
+static char probe_names[IO_STATS][16];
+
+static void probe_stat(void *arg) {
+    struct stat st;
+    fstatat(probe_fd, arg, &st, AT_SYMLINK_NOFOLLOW);
+}
+
+// copies `src` over `dst` as cp would, stat first, then queues itself again
+// until the group is cancelled
+static void copy_file(void *arg) {
+    CopyJob *job = arg;
+    if (iosched_cancelled(job->group)) return;
+
+    static char buf[IO_COPY_SIZE]; // contents do not matter, races are fine
+    struct stat st;
+    int in = -1, out = -1;
+
+    if (stat(job->src, &st) == 0
+        && (in = open(job->src, O_RDONLY)) != -1
+        && (out = open(job->dst, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1) {
+
+        ssize_t n = 0;
+        while ((n = read(in, buf, sizeof(buf))) > 0)
+            job->copied += write(out, buf, n) == n ? (size_t) n : 0;
+    }
+
+    if (in != -1) close(in);
+    if (out != -1) close(out);
+
+    iosched_submit(job->group, job->dev, copy_file, job);
+}
+
+// the time from queueing IO_STATS stats of one directory at `priority`
+// until the last one ran
+static uint64_t probe(IoPriority priority, dev_t dev) {
+
+    uint64_t start = now_ns();
+
+    IoGroup *g = iosched_group(priority);
+    for (size_t i=0; i < IO_STATS; ++i)
+        iosched_submit(g, dev, probe_stat, probe_names[i]);
+    iosched_wait(g);
+    iosched_release(g);
+
+    return start;
+}
+
+// stats of a listing while a bulk copy runs on the same device: as the
+// foreground, and as bulk work behind the copies, which is where they would
+// queue without priorities. meant to also run with bench/slowfs.c preloaded,
+// which throttles every stat like a slow disk
+static void bench_iosched(const char *base, size_t iterations) {
+
+    char root[PATH_MAX] = { 0 };
+    snprintf(root, ARRAY_LEN(root), "%s/io", base);
+    make_tree(root, IO_STATS);
+
+    probe_fd = open(root, O_RDONLY | O_DIRECTORY);
+    if (probe_fd == -1) {
+        perror(root);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i=0; i < IO_STATS; ++i)
+        entry_name(i, probe_names[i], ARRAY_LEN(probe_names[i]));
+
+    struct stat st;
+    fstat(probe_fd, &st);
+
+    Samples s = { 0 };
+
+    for (size_t i=0; i < iterations; ++i)
+        record(&s, probe(IO_FOREGROUND, st.st_dev));
+    report("io_fg_idle", IO_STATS, &s);
+
+    IoGroup *copies = iosched_group(IO_BULK);
+    CopyJob *jobs = calloc(IO_COPIES, sizeof(CopyJob));
+    NON_NULL(jobs);
+
+    for (size_t i=0; i < IO_COPIES; ++i) {
+        CopyJob *job = &jobs[i];
+        *job = (CopyJob) { .group = copies, .dev = st.st_dev };
+        snprintf(job->src, ARRAY_LEN(job->src), "%s/copy-%zu", base, i);
+        snprintf(job->dst, ARRAY_LEN(job->dst), "%s/copy-%zu.out", base, i);
+
+        int fd = open(job->src, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            perror(job->src);
+            exit(EXIT_FAILURE);
+        }
+        // written rather than sparse, the copies read real data
+        static const char chunk[4096] = { 1 };
+        for (size_t off=0; off < IO_COPY_SIZE; off += sizeof(chunk))
+            write(fd, chunk, sizeof(chunk));
+        close(fd);
+    }
+
+    uint64_t copy_start = now_ns();
+    for (size_t i=0; i < IO_COPIES; ++i)
+        iosched_submit(copies, st.st_dev, copy_file, &jobs[i]);
+
+    for (size_t i=0; i < iterations; ++i)
+        record(&s, probe(IO_FOREGROUND, st.st_dev));
+    report("io_fg_loaded", IO_STATS, &s);
+
+    for (size_t i=0; i < iterations; ++i)
+        record(&s, probe(IO_BULK, st.st_dev));
+    report("io_bulk_loaded", IO_STATS, &s);
+
+    iosched_cancel(copies);
+    iosched_wait(copies);
+    iosched_release(copies);
+
+    double secs = (now_ns() - copy_start) / 1e9;
+    size_t copied = 0;
+    for (size_t i=0; i < IO_COPIES; ++i) {
+        copied += jobs[i].copied;
+        unlink(jobs[i].src);
+        unlink(jobs[i].dst);
+    }
+
+    printf(
+        "{\"bench\":\"io_copy\",\"copies\":%d,\"mib\":%.1f,\"mib_per_s\":%.1f}\n",
+        IO_COPIES,
+        copied / 1048576.0,
+        copied / 1048576.0 / secs
+    );
+    fflush(stdout);
+
+    free(jobs);
+    close(probe_fd);
+    remove_tree(root, IO_STATS);
+}
+
+int main(int argc, char **argv) {
+
+    size_t iterations = 0;
+    const char *tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL) tmpdir = "/tmp";
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "i:d:")) != -1) {
+        switch (opt) {
+            case 'i': iterations = strtoul(optarg, NULL, 10); break;
+            case 'd': tmpdir = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-i iterations] [-d tmpdir] [entries...]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    char base[PATH_MAX] = { 0 };
+    snprintf(base, ARRAY_LEN(base), "%s/fm-bench-XXXXXX", tmpdir);
+    if (mkdtemp(base) == NULL) {
+        perror(base);
+        return EXIT_FAILURE;
+    }
+
+    static const size_t default_sizes[] = { 1000, 10000, 100000 };
+    bool use_defaults = optind == argc;
+    size_t count = use_defaults ? ARRAY_LEN(default_sizes) : (size_t) (argc - optind);
+
+    for (size_t i=0; i < count; ++i) {
+        size_t n = use_defaults
+            ? default_sizes[i]
+            : strtoul(argv[optind + i], NULL, 10);
+        if (n == 0) continue;
+
+        // keep the total work per size roughly constant
+        size_t iters = iterations ? iterations : 100000 / n + 3;
+        bench_size(base, n, iters > MAX_SAMPLES ? MAX_SAMPLES : iters);
+        bench_navigate(base, n, iters > MAX_SAMPLES / NAV_DIRS ? MAX_SAMPLES / NAV_DIRS : iters);
+        bench_jumps(base, n, iters > MAX_SAMPLES / 9 ? MAX_SAMPLES / 9 : iters);
+    }
+
+    bench_iosched(base, iterations ? (iterations > MAX_SAMPLES ? MAX_SAMPLES : iterations) : 20);
+
+    rmdir(base);
+    return EXIT_SUCCESS;
+}
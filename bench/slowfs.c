@@ -0,0 +1,95 @@
+#define _GNU_SOURCE // RTLD_NEXT, statx()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+// LD_PRELOAD shim simulating a slow filesystem: every stat-family call is
+// delayed, optionally only below a path prefix. statx() with
+// AT_STATX_DONT_SYNC is left alone, as it does not wait for the server on
+// network filesystems either.
+//
+//   FM_SLOWFS_DELAY_MS  delay per call, default 100
+//   FM_SLOWFS_PREFIX    only delay paths starting with this
+//
+//   LD_PRELOAD=build/bench/slowfs.so FM_SLOWFS_DELAY_MS=200 ./build/bench/fm-bench 1000
+
+
+
+static void resolve(int dirfd, const char *path, char *buf, size_t size) {
+
+    if (path[0] == '/' || dirfd == AT_FDCWD) {
+        snprintf(buf, size, "%s", path);
+        return;
+    }
+
+    char link[64] = { 0 };
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", dirfd);
+
+    char dir[PATH_MAX] = { 0 };
+    ssize_t len = readlink(link, dir, sizeof(dir) - 1);
+    if (len == -1) len = 0;
+    dir[len] = '\0';
+
+    snprintf(buf, size, "%s/%s", dir, path);
+}
+
+static void delay(int dirfd, const char *path) {
+
+    const char *prefix = getenv("FM_SLOWFS_PREFIX");
+    if (prefix != NULL) {
+        char full[PATH_MAX * 2] = { 0 };
+        resolve(dirfd, path, full, sizeof(full));
+        if (strncmp(full, prefix, strlen(prefix))) return;
+    }
+
+    const char *ms = getenv("FM_SLOWFS_DELAY_MS");
+    long delay_ms = ms != NULL ? strtol(ms, NULL, 10) : 100;
+
+    struct timespec ts = {
+        .tv_sec  = delay_ms / 1000,
+        .tv_nsec = (delay_ms % 1000) * 1000000,
+    };
+    nanosleep(&ts, NULL);
+}
+
+#define NEXT(name) \
+    static __typeof__(name) *next = NULL; \
+    if (next == NULL) next = (__typeof__(name) *) dlsym(RTLD_NEXT, #name)
+
+int stat(const char *path, struct stat *buf) {
+    NEXT(stat);
+    delay(AT_FDCWD, path);
+    return next(path, buf);
+}
+
+int lstat(const char *path, struct stat *buf) {
+    NEXT(lstat);
+    delay(AT_FDCWD, path);
+    return next(path, buf);
+}
+
+int fstatat(int dirfd, const char *path, struct stat *buf, int flags) {
+    NEXT(fstatat);
+    delay(dirfd, path);
+    return next(dirfd, path, buf, flags);
+}
+
+int fstatat64(int dirfd, const char *path, struct stat64 *buf, int flags) {
+    NEXT(fstatat64);
+    delay(dirfd, path);
+    return next(dirfd, path, buf, flags);
+}
+
+int statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *buf) {
+    NEXT(statx);
+    if (!(flags & AT_STATX_DONT_SYNC))
+        delay(dirfd, path);
+    return next(dirfd, path, flags, mask, buf);
+}
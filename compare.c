@@ -0,0 +1,352 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+
+#include "compare.h"
+#include "dir.h"
+#include "fhash.h"
+#include "iosched.h"
+#include "util.h"
+
+
+
+struct CompareScan {
+    pthread_t thread;
+    pthread_mutex_t lock; // guards `items`, `progress` and `cancelled`
+    bool cancelled;
+    CompareProgress progress;
+    bool recursive;
+    IoGroup *group; // bulk, directories and hashes
+    dev_t dev;      // of the left side, where directories are queued
+
+    char left[PATH_MAX];
+    char right[PATH_MAX];
+
+    CompareItem *items;
+    size_t count;
+    size_t cap;
+};
+
+static bool cancelled(CompareScan *scan) {
+    pthread_mutex_lock(&scan->lock);
+    bool c = scan->cancelled;
+    pthread_mutex_unlock(&scan->lock);
+    return c;
+}
+
+// returns the index of the new item
+static size_t add_item(CompareScan *scan, const char *path, CompareState state,
+                       bool is_dir, size_t left_size, size_t right_size) {
+
+    char *copy = strdup(path);
+    NON_NULL(copy);
+
+    pthread_mutex_lock(&scan->lock);
+
+    if (scan->count == scan->cap) {
+        scan->cap = scan->cap ? scan->cap * 2 : 256;
+        scan->items = realloc(scan->items, scan->cap * sizeof(CompareItem));
+        NON_NULL(scan->items);
+    }
+
+    size_t index = scan->count++;
+    scan->items[index] = (CompareItem) {
+        .path       = copy,
+        .state      = state,
+        .is_dir     = is_dir,
+        .left_size  = left_size,
+        .right_size = right_size,
+    };
+
+    scan->progress.items++;
+    if (state == CMP_PENDING)
+        scan->progress.pending++;
+
+    pthread_mutex_unlock(&scan->lock);
+    return index;
+}
+
+static void join(char *buf, size_t size, const char *dir, const char *name) {
+    if (*dir == '\0')
+        snprintf(buf, size, "%s", name);
+    else
+        snprintf(buf, size, "%s/%s", dir, name);
+}
+
+typedef struct {
+    CompareScan *scan;
+    size_t index;
+    char *left;
+    char *right;
+} HashTask;
+
+static void hash_pair(void *arg) {
+    HashTask *task = arg;
+    CompareScan *scan = task->scan;
+
+    uint64_t left = 0;
+    uint64_t right = 0;
+    bool same = !cancelled(scan)
+        && fhash_full(task->left, &left) != -1
+        && fhash_full(task->right, &right) != -1
+        && left == right;
+
+    pthread_mutex_lock(&scan->lock);
+    scan->items[task->index].state = same ? CMP_SAME : CMP_DIFFERENT;
+    scan->progress.pending--;
+    pthread_mutex_unlock(&scan->lock);
+
+    free(task->left);
+    free(task->right);
+    free(task);
+}
+
+static bool same_link(const Directory *l, const Entry *x, const Directory *r, const Entry *y) {
+    char a[PATH_MAX] = { 0 };
+    char b[PATH_MAX] = { 0 };
+
+    ssize_t n = readlinkat(l->fd, x->name, a, ARRAY_LEN(a) - 1);
+    ssize_t m = readlinkat(r->fd, y->name, b, ARRAY_LEN(b) - 1);
+    return n != -1 && n == m && !memcmp(a, b, n);
+}
+
+static void submit_dir(CompareScan *scan, const char *rel);
+
+// compares two entries of the same name
+static void compare_pair(CompareScan *scan, const char *rel,
+                         const Directory *l, const Entry *x,
+                         const Directory *r, const Entry *y) {
+
+    bool dirs = S_ISDIR(x->mode) && S_ISDIR(y->mode);
+
+    if (dirs) {
+        if (scan->recursive)
+            submit_dir(scan, rel);
+        else
+            add_item(scan, rel, CMP_SAME, true, 0, 0);
+        return;
+    }
+
+    CompareState state = CMP_DIFFERENT;
+
+    if ((x->mode & S_IFMT) != (y->mode & S_IFMT) || x->size != y->size)
+        state = CMP_DIFFERENT;
+
+    else if (S_ISLNK(x->mode))
+        state = same_link(l, x, r, y) ? CMP_SAME : CMP_DIFFERENT;
+
+    else if (!S_ISREG(x->mode) || x->size == 0)
+        state = CMP_SAME;
+
+    // same size and mtime is taken as same content, like rsync does
+    else if (x->mtime.tv_sec == y->mtime.tv_sec && x->mtime.tv_nsec == y->mtime.tv_nsec)
+        state = CMP_SAME;
+
+    else
+        state = CMP_PENDING;
+
+    size_t index = add_item(scan, rel, state, S_ISDIR(x->mode) || S_ISDIR(y->mode), x->size, y->size);
+    if (state != CMP_PENDING) return;
+
+    char lpath[PATH_MAX] = { 0 };
+    char rpath[PATH_MAX] = { 0 };
+
+    HashTask *task = malloc(sizeof(HashTask));
+    NON_NULL(task);
+    *task = (HashTask) {
+        .scan  = scan,
+        .index = index,
+        .left  = strdup(dir_entry_path(l, x, lpath, ARRAY_LEN(lpath))),
+        .right = strdup(dir_entry_path(r, y, rpath, ARRAY_LEN(rpath))),
+    };
+    NON_NULL(task->left);
+    NON_NULL(task->right);
+
+    iosched_submit(scan->group, l->dev, hash_pair, task);
+}
+
+static bool is_dot(const Entry *e) {
+    return !strcmp(e->name, ".") || !strcmp(e->name, "..");
+}
+
+// by name alone, unlike dir_sort(): a directory on one side and a file of the
+// same name on the other have to meet in the merge-join
+static int compare_names(const void *a, const void *b) {
+    const Entry *x = a;
+    const Entry *y = b;
+    return strcmp(x->name, y->name);
+}
+
+static int load(Directory *dir, const char *root, const char *rel) {
+    char path[PATH_MAX] = { 0 };
+    join(path, ARRAY_LEN(path), root, rel);
+
+    if (dir_read(dir, path) == -1) return -1;
+
+    dir_stat(dir);
+    qsort(dir->entries, dir->size, sizeof(Entry), compare_names);
+    return 0;
+}
+
+typedef struct {
+    CompareScan *scan;
+    char *rel;
+} DirTask;
+
+// merge-joins the directory `rel` of both sides
+static void compare_dir(void *arg) {
+    DirTask *task = arg;
+    CompareScan *scan = task->scan;
+    const char *rel = task->rel;
+
+    Directory l = DIRECTORY_INIT;
+    Directory r = DIRECTORY_INIT;
+
+    if (cancelled(scan)) goto done;
+
+    // an unreadable side counts as empty
+    load(&l, scan->left, rel);
+    load(&r, scan->right, rel);
+
+    pthread_mutex_lock(&scan->lock);
+    scan->progress.dirs++;
+    pthread_mutex_unlock(&scan->lock);
+
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < l.size || j < r.size) {
+        const Entry *x = i < l.size ? &l.entries[i] : NULL;
+        const Entry *y = j < r.size ? &r.entries[j] : NULL;
+
+        if (x != NULL && is_dot(x)) { i++; continue; }
+        if (y != NULL && is_dot(y)) { j++; continue; }
+
+        int cmp = x == NULL ? 1
+                : y == NULL ? -1
+                : strcmp(x->name, y->name);
+
+        char path[PATH_MAX] = { 0 };
+        join(path, ARRAY_LEN(path), rel, cmp <= 0 ? x->name : y->name);
+
+        if (cmp < 0) {
+            add_item(scan, path, CMP_ONLY_LEFT, x->dtype == DT_DIR, x->size, 0);
+            i++;
+
+        } else if (cmp > 0) {
+            add_item(scan, path, CMP_ONLY_RIGHT, y->dtype == DT_DIR, 0, y->size);
+            j++;
+
+        } else {
+            compare_pair(scan, path, &l, x, &r, y);
+            i++;
+            j++;
+        }
+    }
+
+done:
+    dir_free(&l);
+    dir_free(&r);
+    free(task->rel);
+    free(task);
+}
+
+static void submit_dir(CompareScan *scan, const char *rel) {
+    DirTask *task = malloc(sizeof(DirTask));
+    NON_NULL(task);
+
+    task->scan = scan;
+    task->rel = strdup(rel);
+    NON_NULL(task->rel);
+
+    iosched_submit(scan->group, scan->dev, compare_dir, task);
+}
+
+static int compare_items(const void *a, const void *b) {
+    const CompareItem *x = a;
+    const CompareItem *y = b;
+    return strcmp(x->path, y->path);
+}
+
+static void *scan_thread(void *arg) {
+    CompareScan *scan = arg;
+
+    // directories and hashes share the group, waiting for it waits for both
+    submit_dir(scan, "");
+    iosched_wait(scan->group);
+
+    pthread_mutex_lock(&scan->lock);
+    qsort(scan->items, scan->count, sizeof(CompareItem), compare_items);
+    scan->progress.done = true;
+    pthread_mutex_unlock(&scan->lock);
+
+    return NULL;
+}
+
+// returns NULL if either side can not be resolved
+CompareScan *compare_start(const char *left, const char *right, bool recursive) {
+
+    CompareScan *scan = calloc(1, sizeof(CompareScan));
+    NON_NULL(scan);
+
+    if (realpath(left, scan->left) == NULL || realpath(right, scan->right) == NULL) {
+        free(scan);
+        return NULL;
+    }
+
+    pthread_mutex_init(&scan->lock, NULL);
+    scan->recursive = recursive;
+    scan->group = iosched_group(IO_BULK);
+
+    struct stat st = { 0 };
+    stat(scan->left, &st);
+    scan->dev = st.st_dev;
+
+    MUST_ZERO(pthread_create(&scan->thread, NULL, scan_thread, scan));
+    return scan;
+}
+
+CompareProgress compare_progress(CompareScan *scan) {
+    pthread_mutex_lock(&scan->lock);
+    CompareProgress progress = scan->progress;
+    pthread_mutex_unlock(&scan->lock);
+    return progress;
+}
+
+// returns NULL until the scan is done. items are sorted by path
+const CompareItem *compare_result(CompareScan *scan, size_t *count) {
+    if (!compare_progress(scan).done) return NULL;
+
+    *count = scan->count;
+    return scan->items;
+}
+
+const char *compare_root(const CompareScan *scan, bool right) {
+    return right ? scan->right : scan->left;
+}
+
+// cancels the scan if it is still running
+void compare_free(CompareScan *scan) {
+
+    pthread_mutex_lock(&scan->lock);
+    scan->cancelled = true;
+    pthread_mutex_unlock(&scan->lock);
+
+    iosched_cancel(scan->group);
+    pthread_join(scan->thread, NULL);
+    iosched_release(scan->group);
+
+    for (size_t i=0; i < scan->count; ++i)
+        free(scan->items[i].path);
+
+    free(scan->items);
+    pthread_mutex_destroy(&scan->lock);
+    free(scan);
+}
@@ -0,0 +1,49 @@
+#ifndef _COMPARE_H
+#define _COMPARE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// compares two directory trees, on a background thread. both sides are
+// loaded as Directory snapshots sorted by name and merge-joined. a name of
+// different types on both sides is different, and not descended into. files
+// are the same if their size and mtime match, otherwise equal sizes are
+// confirmed by hashing both contents in parallel
+
+
+
+typedef enum {
+    CMP_SAME,
+    CMP_DIFFERENT,
+    CMP_ONLY_LEFT,
+    CMP_ONLY_RIGHT,
+    CMP_PENDING, // waiting for content hashes
+} CompareState;
+
+typedef struct {
+    char *path; // relative to both roots
+    CompareState state;
+    bool is_dir;
+    size_t left_size;
+    size_t right_size;
+} CompareItem;
+
+typedef struct {
+    bool done;
+    size_t dirs;    // directory pairs compared
+    size_t items;
+    size_t pending; // files waiting for content hashes
+} CompareProgress;
+
+typedef struct CompareScan CompareScan;
+
+
+CompareScan       *compare_start    (const char *left, const char *right, bool recursive);
+CompareProgress    compare_progress (CompareScan *scan);
+const CompareItem *compare_result   (CompareScan *scan, size_t *count);
+const char        *compare_root     (const CompareScan *scan, bool right);
+void               compare_free     (CompareScan *scan);
+
+
+
+#endif // _COMPARE_H
@@ -0,0 +1,566 @@
+#define _GNU_SOURCE // statx(), file type macro constants by dirent
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "dir.h"
+#include "util.h"
+#include "timing.h"
+
+
+
+// a single stat this slow degrades the listing
+#define SLOW_STAT_NS    (50 * 1000000ull)
+// as does an average this slow, over at least SLOW_AVG_MIN stats
+#define SLOW_AVG_NS     (5 * 1000000ull)
+#define SLOW_AVG_MIN    16
+// stats on worker threads are given up on after this
+#define STAT_TIMEOUT_NS (3000 * 1000000ull)
+// the fields every listing needs, whatever columns are shown
+#define STATX_BASE      (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME)
+
+// moving average of the stat latency per device. once a device is slow,
+// listings on it skip stats on the main thread entirely, until the stats
+// done by the workers bring the average down again
+typedef struct {
+    dev_t dev;
+    uint64_t avg_ns;
+} DeviceLatency;
+
+static DeviceLatency devices[16] = { 0 };
+static size_t device_count = 0;
+
+static DeviceLatency *device_latency(dev_t dev) {
+
+    for (size_t i=0; i < device_count; ++i)
+        if (devices[i].dev == dev)
+            return &devices[i];
+
+    // evict the oldest device if the table is full
+    DeviceLatency *d = &devices[device_count % ARRAY_LEN(devices)];
+    if (device_count < ARRAY_LEN(devices))
+        device_count++;
+
+    *d = (DeviceLatency) { .dev = dev, .avg_ns = 0 };
+    return d;
+}
+
+static void device_record(DeviceLatency *d, uint64_t ns) {
+    d->avg_ns = d->avg_ns == 0 ? ns : (d->avg_ns * 7 + ns) / 8;
+}
+
+static bool device_slow(const DeviceLatency *d) {
+    return d->avg_ns > SLOW_AVG_NS;
+}
+
+
+
+static const char *filetype_repr(unsigned char filetype) {
+    switch (filetype) {
+        case DT_UNKNOWN: return "unknown";
+        case DT_FIFO:    return "fifo";
+        case DT_CHR:     return "chr";
+        case DT_DIR:     return "dir";
+        case DT_BLK:     return "blk";
+        case DT_REG:     return "reg";
+        case DT_LNK:     return "lnk";
+        case DT_SOCK:    return "sock";
+        case DT_WHT:     return "wht";
+        default:
+            assert(!"unknown filetype");
+            return "unknown";
+    }
+}
+
+static Entry *push_entry(Directory *dir) {
+
+    if (dir->size == dir->capacity) {
+        dir->capacity = dir->capacity ? dir->capacity * 2 : 64;
+        dir->entries = realloc(dir->entries, dir->capacity * sizeof(Entry));
+        NON_NULL(dir->entries);
+    }
+
+    return &dir->entries[dir->size++];
+}
+
+// enumerates `path` into `dir`, reusing its entry buffer. only names and
+// d_type are filled in, see dir_stat().
+// returns -1 if `path` could not be opened, leaving `dir` untouched
+int dir_read(Directory *dir, const char *path) {
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    // `path` may point into `dir`
+    char resolved[PATH_MAX] = { 0 };
+    char *err = realpath(path, resolved);
+    NON_NULL(err);
+
+    // not syncing with the server avoids blocking on a hung network mount
+    struct statx stx = { 0 };
+    statx(fd, "", AT_EMPTY_PATH | AT_STATX_DONT_SYNC, 0, &stx);
+
+    // readdir() takes ownership of the fd it is given, but ours has to stay
+    // open for dir_stat()
+    DIR *dirp = fdopendir(dup(fd));
+    NON_NULL(dirp);
+
+    if (dir->fd != -1)
+        close(dir->fd);
+
+    if (dir->batch != NULL)
+        astat_cancel(dir->batch);
+
+    if (dir->archive != NULL)
+        archive_close(dir->archive);
+
+    git_release(dir->repo);
+
+    dir->fd = fd;
+    dir->dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    dir->size = 0;
+    dir->degraded = false;
+    dir->batch = NULL;
+    dir->archive = NULL;
+    dir->repo = NULL;
+    dir->repo_checked = false;
+    strncpy(dir->path, resolved, ARRAY_LEN(dir->path));
+
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dirp)) != NULL) {
+
+        const char *name = entry->d_name;
+
+        Entry *e = push_entry(dir);
+        *e = (Entry) {
+            .type  = filetype_repr(entry->d_type),
+            .dtype = entry->d_type,
+            .ino   = entry->d_ino,
+        };
+
+        // d_name cannot be used as its free'd by closedir()
+        strncpy(e->name, name, ARRAY_LEN(e->name));
+    }
+
+    closedir(dirp);
+    return 0;
+}
+
+// lists the directory `member` of the archive `a` into `dir`, like dir_read().
+// takes a reference to `a`. entries are complete, there is no stat stage.
+// returns -1 if `member` is no directory, leaving `dir` untouched
+int dir_read_archive(Directory *dir, Archive *a, size_t member) {
+
+    const ArchiveMember *m = archive_member(a, member);
+    if (m == NULL || !S_ISDIR(m->mode)) return -1;
+
+    // before releasing the old one, which may be `a` itself
+    archive_ref(a);
+
+    if (dir->fd != -1)
+        close(dir->fd);
+
+    if (dir->batch != NULL)
+        astat_cancel(dir->batch);
+
+    if (dir->archive != NULL)
+        archive_close(dir->archive);
+
+    git_release(dir->repo);
+
+    dir->fd = -1;
+    dir->dev = 0;
+    dir->size = 0;
+    dir->degraded = false;
+    dir->batch = NULL;
+    dir->archive = a;
+    dir->member = member;
+    dir->repo = NULL;
+    dir->repo_checked = true; // never in a worktree
+
+    if (*m->path != '\0')
+        snprintf(dir->path, ARRAY_LEN(dir->path), "%s/%s", archive_path(a), m->path);
+    else
+        snprintf(dir->path, ARRAY_LEN(dir->path), "%s", archive_path(a));
+
+    for (size_t i = m->first_child; i != 0; i = archive_member(a, i)->next_sibling) {
+        const ArchiveMember *c = archive_member(a, i);
+
+        Entry *e = push_entry(dir);
+        *e = (Entry) {
+            .dtype  = IFTODT(c->mode),
+            .size   = c->size,
+            .mode   = c->mode,
+            .mtime  = c->mtime,
+            .stat   = STAT_DONE,
+            .ino    = i, // the member, for going back to the archive
+            .fields = STATX_BASE,
+        };
+        e->type = filetype_repr(e->dtype);
+        snprintf(e->name, ARRAY_LEN(e->name), "%s", c->name);
+    }
+
+    return 0;
+}
+
+void dir_filter_hidden(Directory *dir) {
+
+    size_t n = 0;
+    for (size_t i=0; i < dir->size; ++i) {
+        if (dir->entries[i].name[0] == '.') continue;
+
+        if (n != i)
+            dir->entries[n] = dir->entries[i];
+        n++;
+    }
+
+    dir->size = n;
+}
+
+// the statx() mask for the Column flags `columns`. the mtime is always there.
+// the inode is known from readdir already, asking for it costs nothing
+unsigned int dir_statx_mask(unsigned int columns) {
+    unsigned int mask = STATX_BASE;
+
+    if (columns & COLUMN_INODE) mask |= STATX_INO;
+    if (columns & COLUMN_LINKS) mask |= STATX_NLINK;
+    if (columns & COLUMN_OWNER) mask |= STATX_UID;
+    if (columns & COLUMN_GROUP) mask |= STATX_GID;
+    if (columns & COLUMN_BTIME) mask |= STATX_BTIME;
+
+    return mask;
+}
+
+// whether `e` has the data to show in `column`
+bool entry_has_column(const Entry *e, Column column) {
+    unsigned int mask = dir_statx_mask(column);
+    return e->stat == STAT_DONE && (e->fields & mask) == mask;
+}
+
+const char *column_name(Column column) {
+    switch (column) {
+        case COLUMN_LINKS: return "links";
+        case COLUMN_OWNER: return "owner";
+        case COLUMN_GROUP: return "group";
+        case COLUMN_MTIME: return "mtime";
+        case COLUMN_BTIME: return "btime";
+        case COLUMN_INODE: return "inode";
+        default:           return "?";
+    }
+}
+
+static struct timespec statx_time(struct statx_timestamp t) {
+    return (struct timespec) { .tv_sec = t.tv_sec, .tv_nsec = t.tv_nsec };
+}
+
+// `mask` is what was requested, whether the filesystem had it or not
+static void apply_stat(Entry *e, const struct statx *stx, unsigned int mask) {
+    e->size = stx->stx_size;
+    e->mode = stx->stx_mode;
+    e->mtime = statx_time(stx->stx_mtime);
+    e->uid = stx->stx_uid;
+    e->gid = stx->stx_gid;
+    e->nlink = stx->stx_nlink;
+    e->btime = stx->stx_mask & STATX_BTIME
+        ? statx_time(stx->stx_btime)
+        : (struct timespec) { 0 };
+    e->fields = mask | stx->stx_mask;
+    e->stat = STAT_DONE;
+
+    // some filesystems don't fill in d_type
+    if (e->dtype == DT_UNKNOWN && e->mode != 0) {
+        e->dtype = IFTODT(e->mode);
+        e->type = filetype_repr(e->dtype);
+    }
+}
+
+// returns true if the type of `e` was only known after the stat
+static bool stat_entry(const Directory *dir, Entry *e, unsigned int mask) {
+    struct statx stx = { 0 };
+    statx(dir->fd, e->name, AT_SYMLINK_NOFOLLOW, mask, &stx);
+
+    bool unknown = e->dtype == DT_UNKNOWN;
+    apply_stat(e, &stx, mask);
+    return unknown;
+}
+
+// stats every entry. sorts again if that revealed types missing from d_type
+void dir_stat(Directory *dir) {
+    if (dir->archive != NULL) return;
+
+    bool resort = false;
+    unsigned int mask = dir_statx_mask(dir->columns);
+
+    for (size_t i=0; i < dir->size; ++i)
+        resort |= stat_entry(dir, &dir->entries[i], mask);
+
+    if (resort)
+        dir_sort(dir);
+}
+
+// like dir_stat(), but once stats turn out to be slow, the remaining entries
+// are stat'ed by worker threads. must run after dir_sort(), as results refer
+// to entries by index. on devices known to be slow, no stats are done here at
+// all, leaving a d_type-only listing
+void dir_stat_adaptive(Directory *dir) {
+    if (dir->archive != NULL) return;
+
+    DeviceLatency *dev = device_latency(dir->dev);
+    unsigned int mask = dir_statx_mask(dir->columns);
+    size_t i = 0;
+
+    if (!device_slow(dev)) {
+        uint64_t total = 0;
+        bool resort = false;
+
+        while (i < dir->size) {
+            uint64_t start = now_ns();
+            resort |= stat_entry(dir, &dir->entries[i++], mask);
+            uint64_t ns = now_ns() - start;
+
+            device_record(dev, ns);
+            total += ns;
+
+            if (ns > SLOW_STAT_NS) break;
+            if (i >= SLOW_AVG_MIN && total / i > SLOW_AVG_NS) break;
+        }
+
+        if (i == dir->size) {
+            if (resort) dir_sort(dir);
+            return;
+        }
+    }
+
+    dir->degraded = true;
+    dir->batch = astat_start(dir->fd, mask);
+
+    for (; i < dir->size; ++i) {
+        Entry *e = &dir->entries[i];
+        e->stat = STAT_PENDING;
+        astat_submit(dir->batch, i, e->name);
+    }
+}
+
+// applies the results of stats done by worker threads.
+// returns true while some are still outstanding
+bool dir_poll(Directory *dir) {
+    if (dir->batch == NULL) return false;
+
+    DeviceLatency *dev = device_latency(dir->dev);
+    AstatResult results[64];
+    size_t n = 0;
+
+    while ((n = astat_poll(dir->batch, results, ARRAY_LEN(results), STAT_TIMEOUT_NS)) > 0) {
+        for (size_t i=0; i < n; ++i) {
+            const AstatResult *r = &results[i];
+            Entry *e = &dir->entries[r->index];
+
+            device_record(dev, r->latency_ns);
+
+            if (r->err == ETIMEDOUT) {
+                e->stat = STAT_TIMEOUT;
+                continue;
+            }
+
+            // no sorting here, results refer to entries by index. extra
+            // fields the batch asked for are told by their stx_mask
+            apply_stat(e, &r->stx, STATX_BASE);
+        }
+    }
+
+    if (astat_pending(dir->batch))
+        return true;
+
+    astat_cancel(dir->batch);
+    dir->batch = NULL;
+    return false;
+}
+
+// stats the entries in [first, last) again if they lack fields of columns
+// enabled after they were stat'ed
+void dir_fetch_columns(Directory *dir, size_t first, size_t last) {
+
+    // extra columns are not worth blocking on a slow filesystem. archive
+    // members have no more metadata than they were listed with
+    if (dir->degraded || dir->archive != NULL) return;
+
+    unsigned int mask = dir_statx_mask(dir->columns);
+
+    if (last > dir->size)
+        last = dir->size;
+
+    for (size_t i=first; i < last; ++i) {
+        Entry *e = &dir->entries[i];
+        if (e->stat != STAT_DONE || (e->fields & mask) == mask) continue;
+
+        stat_entry(dir, e, mask);
+    }
+}
+
+bool entry_is_link(const Entry *e) {
+    return e->dtype == DT_LNK || (e->stat == STAT_DONE && S_ISLNK(e->mode));
+}
+
+// the target of `e`, or NULL if it is not a resolved symlink
+const char *entry_link(const Entry *e) {
+    return e->link_gen == links_generation() ? e->link : NULL;
+}
+
+// resolves the targets of symlinks in the entries [first, last). targets come
+// from the per-inode cache, broken or looping links are detected by the
+// kernel, with a single stat following the link
+void dir_resolve_links(Directory *dir, size_t first, size_t last) {
+
+    // never block on a slow filesystem for a cosmetic column
+    if (dir->degraded || dir->archive != NULL) return;
+
+    if (last > dir->size)
+        last = dir->size;
+
+    for (size_t i=first; i < last; ++i) {
+        Entry *e = &dir->entries[i];
+        if (!entry_is_link(e)) continue;
+
+        bool resolved = e->link_status != LINK_UNRESOLVED
+            && e->link_gen == links_generation();
+        if (resolved) continue;
+
+        e->link = links_target(dir->dev, e->ino, dir->fd, e->name);
+        e->link_gen = links_generation();
+        e->link_dir = false;
+
+        if (e->link == NULL) {
+            e->link_status = LINK_ERROR;
+            continue;
+        }
+
+        struct stat statbuf = { 0 };
+        int err = fstatat(dir->fd, e->name, &statbuf, 0);
+
+        if (err == 0) {
+            e->link_status = LINK_OK;
+            e->link_dir = S_ISDIR(statbuf.st_mode);
+        } else {
+            e->link_status = errno == ELOOP                      ? LINK_LOOP
+                           : errno == ENOENT || errno == ENOTDIR ? LINK_BROKEN
+                           : LINK_ERROR;
+        }
+    }
+}
+
+// requests the content types of the regular files in [first, last). types
+// not known yet are filled in by later calls, once classified
+void dir_classify(Directory *dir, size_t first, size_t last) {
+
+    // opening files on a slow filesystem could block. members of archives
+    // would have to be streamed
+    if (dir->degraded || dir->archive != NULL) return;
+
+    if (last > dir->size)
+        last = dir->size;
+
+    for (size_t i=first; i < last; ++i) {
+        Entry *e = &dir->entries[i];
+        if (e->magic != 0 || e->stat != STAT_DONE || !S_ISREG(e->mode)) continue;
+
+        char path[PATH_MAX] = { 0 };
+        dir_entry_path(dir, e, path, ARRAY_LEN(path));
+        e->magic = magic_request(dir->dev, e->ino, e->mtime, e->size, path);
+    }
+}
+
+// fills in the git status of the entries in [first, last), if the directory
+// is in a git worktree. the index is reread once per call if it changed, and
+// files hashed meanwhile are filled in
+void dir_git_status(Directory *dir, size_t first, size_t last) {
+
+    // files may have to be hashed
+    if (dir->degraded || dir->archive != NULL) return;
+
+    if (!dir->repo_checked) {
+        dir->repo = git_find(dir->path);
+        dir->repo_checked = true;
+    }
+    if (dir->repo == NULL) return;
+
+    git_refresh(dir->repo);
+    unsigned gen = git_generation(dir->repo);
+
+    if (last > dir->size)
+        last = dir->size;
+
+    for (size_t i=first; i < last; ++i) {
+        Entry *e = &dir->entries[i];
+        if (e->git_gen == gen || e->stat != STAT_DONE) continue;
+
+        e->git_gen = gen;
+        if (!strcmp(e->name, ".") || !strcmp(e->name, "..")) continue;
+
+        char path[PATH_MAX] = { 0 };
+        dir_entry_path(dir, e, path, ARRAY_LEN(path));
+
+        e->git = git_status(dir->repo, path, S_ISDIR(e->mode), e->size, e->mode, e->mtime, dir->dev, e->ino);
+    }
+}
+
+int dir_compare_entries(const void *a, const void *b) {
+    const Entry *x = a;
+    const Entry *y = b;
+
+    int dircmp = (y->dtype == DT_DIR) - (x->dtype == DT_DIR);
+
+    return dircmp == 0
+    ? strcmp(x->name, y->name)
+    : dircmp;
+}
+
+void dir_sort(Directory *dir) {
+    qsort(dir->entries, dir->size, sizeof(Entry), dir_compare_entries);
+}
+
+// releases everything but the entry buffer, which is kept for the next
+// dir_read() into `dir`
+void dir_close(Directory *dir) {
+    if (dir->fd != -1)
+        close(dir->fd);
+
+    if (dir->batch != NULL)
+        astat_cancel(dir->batch);
+
+    if (dir->archive != NULL)
+        archive_close(dir->archive);
+
+    git_release(dir->repo);
+
+    Entry *entries = dir->entries;
+    size_t capacity = dir->capacity;
+
+    *dir = (Directory) DIRECTORY_INIT;
+    dir->entries = entries;
+    dir->capacity = capacity;
+}
+
+void dir_free(Directory *dir) {
+    dir_close(dir);
+    free(dir->entries);
+    *dir = (Directory) DIRECTORY_INIT;
+}
+
+// writes the absolute path of `e` into `buf`. a path too long for it is left
+// empty rather than cut, as a cut one could name another file
+char *dir_entry_path(const Directory *dir, const Entry *e, char *buf, size_t size) {
+
+    // avoid a double slash at the root
+    const char *sep = strcmp(dir->path, "/") ? "/" : "";
+    int len = snprintf(buf, size, "%s%s%s", dir->path, sep, e->name);
+    if (len < 0 || (size_t) len >= size) *buf = '\0';
+    return buf;
+}
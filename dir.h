@@ -0,0 +1,121 @@
+#ifndef _DIR_H
+#define _DIR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <dirent.h>
+#include <limits.h>
+
+#include <sys/types.h>
+
+#include "astat.h"
+#include "links.h"
+#include "magic.h"
+#include "archive.h"
+#include "gitstatus.h"
+
+// loading a directory is split into stages, so each of them can be measured
+// on its own: dir_read() -> dir_filter_hidden() -> dir_sort() -> dir_stat()
+//
+// dir_stat_adaptive() measures the latency of every stat. on a slow or hung
+// filesystem it stops and leaves the remaining entries to worker threads,
+// marking the directory as degraded. dir_poll() picks up their results
+//
+// entries describe symlinks themselves, not their targets. targets are
+// resolved separately with dir_resolve_links(), only for the rows on screen.
+// the same goes for content types, see dir_classify(), and the git status,
+// see dir_git_status()
+//
+// stats are statx() calls, requesting only the fields the enabled columns
+// need (`Directory.columns`). entries stat'ed before a column was enabled get
+// its fields from dir_fetch_columns(), again only for the rows on screen
+//
+// dir_read_archive() lists a directory inside of an archive instead. such
+// entries come complete with their metadata, and have no fd to stat through
+
+
+
+typedef enum {
+    STAT_DONE,
+    STAT_PENDING,
+    STAT_TIMEOUT,
+} StatState;
+
+// optional columns, in the order they are drawn
+typedef enum {
+    COLUMN_LINKS = 1 << 0,
+    COLUMN_OWNER = 1 << 1,
+    COLUMN_GROUP = 1 << 2,
+    COLUMN_MTIME = 1 << 3,
+    COLUMN_BTIME = 1 << 4,
+    COLUMN_INODE = 1 << 5,
+} Column;
+
+#define COLUMN_COUNT 6
+
+typedef struct {
+    char name[NAME_MAX + 1];
+    const char *type;
+    unsigned int dtype;
+    size_t size;
+    unsigned int mode;
+    struct timespec mtime;
+    StatState stat;
+    ino_t ino;
+    unsigned int fields;    // STATX_* fields requested so far
+    uid_t uid;
+    gid_t gid;
+    nlink_t nlink;
+    struct timespec btime;  // zero if the filesystem has none
+    MagicId magic;          // 0 until classified
+    const char *link;       // symlink target, only valid for `link_gen`
+    unsigned link_gen;
+    LinkStatus link_status;
+    bool link_dir;          // the target is a directory
+    GitState git;           // only valid for `git_gen`
+    unsigned git_gen;
+} Entry;
+
+typedef struct {
+    char path[PATH_MAX];
+    int fd; // kept open for *at() calls, -1 if nothing is loaded
+    dev_t dev;
+    size_t size;
+    size_t capacity;
+    Entry *entries;
+    bool degraded; // entries were left to worker threads
+    AstatBatch *batch;
+    Archive *archive; // `path` is inside of this archive, if not NULL
+    size_t member;    // the listed directory in `archive`
+    unsigned int columns; // Column flags, kept across dir_read()
+    GitRepo *repo;    // looked up on the first dir_git_status()
+    bool repo_checked;
+} Directory;
+
+#define DIRECTORY_INIT { .fd = -1 }
+
+
+int   dir_read            (Directory *dir, const char *path);
+int   dir_read_archive    (Directory *dir, Archive *a, size_t member);
+void  dir_filter_hidden   (Directory *dir);
+void  dir_stat            (Directory *dir);
+void  dir_stat_adaptive   (Directory *dir);
+void  dir_fetch_columns   (Directory *dir, size_t first, size_t last);
+bool  dir_poll            (Directory *dir);
+void  dir_resolve_links   (Directory *dir, size_t first, size_t last);
+void  dir_classify        (Directory *dir, size_t first, size_t last);
+void  dir_git_status      (Directory *dir, size_t first, size_t last);
+bool  entry_is_link       (const Entry *e);
+const char *entry_link    (const Entry *e);
+void  dir_sort            (Directory *dir);
+void  dir_close           (Directory *dir);
+void  dir_free            (Directory *dir);
+int   dir_compare_entries (const void *a, const void *b);
+char *dir_entry_path      (const Directory *dir, const Entry *e, char *buf, size_t size);
+unsigned int dir_statx_mask (unsigned int columns);
+bool  entry_has_column    (const Entry *e, Column column);
+const char *column_name     (Column column);
+
+
+
+#endif // _DIR_H
@@ -0,0 +1,381 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+
+#include "dircache.h"
+#include "prof.h"
+#include "iosched.h"
+#include "arena.h"
+#include "util.h"
+
+
+
+// directories no view holds anymore, kept for going back
+#define DIRCACHE_IDLE 16
+// entry buffers of evicted directories are kept up to this capacity
+#define RECYCLE_ENTRIES (16 * 1024)
+
+// changes to entries, and to the directory itself
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB \
+                    | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct {
+    Directory dir; // first, a Directory handed out is a CachedDir
+    size_t refs;
+    bool hidden;
+    bool stale;
+    int wd;        // inotify watch, -1 if not watched
+    unsigned generation;
+    unsigned long used; // when last released, for evicting idle ones
+} CachedDir;
+
+static CachedDir **cache = NULL;
+static size_t count = 0;
+static size_t capacity = 0;
+// evicted directories, with their entry buffers, for the next ones loaded
+static Pool recycled = POOL_INIT(CachedDir);
+static size_t allocs = 0; // besides the ones of `recycled`
+static unsigned long ticks = 0;
+static int inotify_fd = -2; // -2 until initialized, -1 if unavailable
+
+static CachedDir *cached(const Directory *dir) {
+    return (CachedDir*) dir;
+}
+
+static int watcher(void) {
+    if (inotify_fd == -2)
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return inotify_fd;
+}
+
+// heap allocations made so far. once the directories visited fit into the
+// recycled ones, navigating allocates nothing
+size_t dircache_allocs(void) {
+    return allocs + recycled.allocs;
+}
+
+// the fd to wait on for changes, or -1 if directories are not watched
+int dircache_fd(void) {
+    return watcher();
+}
+
+static void unwatch(CachedDir *c) {
+    if (c->wd == -1) return;
+
+    // watches are per inode, another listing of the directory shares it
+    for (size_t i=0; i < count; ++i)
+        if (cache[i] != c && cache[i]->wd == c->wd) {
+            c->wd = -1;
+            return;
+        }
+
+    inotify_rm_watch(inotify_fd, c->wd);
+    c->wd = -1;
+}
+
+static void evict(size_t i) {
+    CachedDir *c = cache[i];
+    unwatch(c);
+
+    dir_close(&c->dir);
+    if (c->dir.capacity > RECYCLE_ENTRIES)
+        dir_free(&c->dir);
+    pool_put(&recycled, c);
+
+    cache[i] = cache[--count];
+}
+
+// drops the least recently used idle directories beyond DIRCACHE_IDLE, and
+// every idle one that changed since, or can't be watched
+static void trim(void) {
+
+    size_t idle = 0;
+    for (size_t i=0; i < count; ) {
+        CachedDir *c = cache[i];
+        bool untrusted = c->stale || (c->wd == -1 && c->dir.archive == NULL);
+
+        if (c->refs == 0 && untrusted) {
+            evict(i);
+            continue;
+        }
+
+        idle += c->refs == 0;
+        i++;
+    }
+
+    while (idle > DIRCACHE_IDLE) {
+        size_t lru = count;
+        for (size_t i=0; i < count; ++i)
+            if (cache[i]->refs == 0 && (lru == count || cache[i]->used < cache[lru]->used))
+                lru = i;
+
+        evict(lru);
+        idle--;
+    }
+}
+
+static CachedDir *lookup(const char *path, bool hidden) {
+    for (size_t i=0; i < count; ++i)
+        if (cache[i]->hidden == hidden && !strcmp(cache[i]->dir.path, path))
+            return cache[i];
+    return NULL;
+}
+
+static CachedDir *insert(void) {
+    if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 16;
+        cache = realloc(cache, capacity * sizeof(CachedDir*));
+        NON_NULL(cache);
+        allocs++;
+    }
+
+    // a recycled one comes with an entry buffer
+    CachedDir *c = pool_get(&recycled);
+    Directory dir = c->dir;
+
+    *c = (CachedDir) { .dir = DIRECTORY_INIT, .wd = -1 };
+    c->dir.entries = dir.entries;
+    c->dir.capacity = dir.capacity;
+
+    cache[count++] = c;
+    return c;
+}
+
+// every stage, as navigation always did them. background work waits while
+// it runs, see iosched_hold().
+// returns -1 if `path` could not be opened, leaving `c` untouched
+static int load(CachedDir *c, const char *path) {
+
+    Directory *dir = &c->dir;
+    uint64_t load_start = prof_begin();
+    iosched_hold(true);
+
+    uint64_t start = prof_begin();
+    size_t reserved = dir->capacity;
+    int err = dir_read(dir, path);
+    if (err == -1) {
+        iosched_hold(false);
+        return -1;
+    }
+    allocs += dir->capacity != reserved;
+
+    if (!c->hidden)
+        dir_filter_hidden(dir);
+    prof_end(PROF_READDIR, start, dir->size);
+
+    start = prof_begin();
+    dir_sort(dir);
+    prof_end(PROF_SORT, start, dir->size);
+
+    start = prof_begin();
+    dir_stat_adaptive(dir);
+    prof_end(PROF_STAT, start, dir->size);
+
+    iosched_hold(false);
+    prof_end(PROF_LOAD_DIR, load_start, dir->size);
+
+    c->stale = false;
+    c->generation++;
+    return 0;
+}
+
+static int load_archive(CachedDir *c, Archive *a, size_t member) {
+
+    Directory *dir = &c->dir;
+
+    uint64_t start = prof_begin();
+    size_t reserved = dir->capacity;
+    if (dir_read_archive(dir, a, member) == -1) return -1;
+    allocs += dir->capacity != reserved;
+
+    if (!c->hidden)
+        dir_filter_hidden(dir);
+    dir_sort(dir);
+    prof_end(PROF_LOAD_DIR, start, dir->size);
+
+    c->stale = false;
+    c->generation++;
+    return 0;
+}
+
+// a listing of `path`, shared with other views on it. `columns` are the
+// columns the caller shows, fetched along with the listing if it is loaded.
+// returns NULL if `path` could not be opened
+Directory *dircache_open(const char *path, bool hidden, unsigned int columns) {
+
+    char resolved[PATH_MAX] = { 0 };
+    if (realpath(path, resolved) == NULL) return NULL;
+
+    // never hand out a listing that changed, even to views that don't poll
+    dircache_poll();
+
+    CachedDir *c = lookup(resolved, hidden);
+    if (c != NULL) {
+        c->dir.columns |= columns;
+        if (c->stale && load(c, resolved) == -1) return NULL;
+
+        c->refs++;
+        return &c->dir;
+    }
+
+    c = insert();
+    c->hidden = hidden;
+    c->dir.columns = columns;
+
+    if (load(c, resolved) == -1) {
+        int err = errno;
+        evict(count - 1);
+        errno = err;
+        return NULL;
+    }
+
+    if (watcher() != -1)
+        c->wd = inotify_add_watch(inotify_fd, c->dir.path, WATCH_MASK);
+
+    c->refs = 1;
+    trim();
+    return &c->dir;
+}
+
+// the directory `member` of the archive `a`, like dircache_open().
+// returns NULL if it is no directory
+Directory *dircache_open_archive(Archive *a, size_t member, bool hidden) {
+
+    const ArchiveMember *m = archive_member(a, member);
+    if (m == NULL) return NULL;
+
+    char path[PATH_MAX] = { 0 };
+    if (*m->path != '\0')
+        snprintf(path, ARRAY_LEN(path), "%s/%s", archive_path(a), m->path);
+    else
+        snprintf(path, ARRAY_LEN(path), "%s", archive_path(a));
+
+    // archives reopened after a change are different ones
+    CachedDir *c = lookup(path, hidden);
+    if (c != NULL && c->dir.archive == a && c->dir.member == member) {
+        c->refs++;
+        return &c->dir;
+    }
+
+    c = insert();
+    c->hidden = hidden;
+
+    if (load_archive(c, a, member) == -1) {
+        evict(count - 1);
+        return NULL;
+    }
+
+    c->refs = 1;
+    trim();
+    return &c->dir;
+}
+
+// another reference to `dir`, eg: for a new view on it
+Directory *dircache_ref(Directory *dir) {
+    cached(dir)->refs++;
+    return dir;
+}
+
+void dircache_release(Directory *dir) {
+    if (dir == NULL) return;
+
+    CachedDir *c = cached(dir);
+    c->refs--;
+    c->used = ++ticks;
+    trim();
+}
+
+// reads `dir` again, for every view on it. a directory that went away stays
+// as it was
+void dircache_reload(Directory *dir) {
+    CachedDir *c = cached(dir);
+    c->stale = false;
+
+    if (dir->archive != NULL)
+        load_archive(c, dir->archive, dir->member);
+    else
+        load(c, dir->path);
+}
+
+bool dircache_stale(const Directory *dir) {
+    return cached(dir)->stale;
+}
+
+// bumped by every reload, views check it to keep their cursor in bounds
+unsigned dircache_generation(const Directory *dir) {
+    return cached(dir)->generation;
+}
+
+bool dircache_hidden(const Directory *dir) {
+    return cached(dir)->hidden;
+}
+
+// reads pending events, marking the directories they are about as stale.
+// attribute changes of entries of `settled` are skipped
+static bool read_events(const CachedDir *settled) {
+    if (inotify_fd < 0) return false;
+
+    bool changed = false;
+    // aligned for the events read into it
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } u;
+    char *buf = u.buf;
+
+    ssize_t len = 0;
+    while ((len = read(inotify_fd, buf, sizeof(u))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ev = (const struct inotify_event*) p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            // events were lost, any directory may have changed
+            if (ev->mask & IN_Q_OVERFLOW) {
+                for (size_t i=0; i < count; ++i)
+                    if (cache[i]->dir.archive == NULL) cache[i]->stale = true;
+                changed = true;
+                continue;
+            }
+
+            // unwatched directories have no events of their own
+            if (ev->wd == -1) continue;
+
+            bool attrib = (ev->mask & ~IN_ISDIR) == IN_ATTRIB && ev->len > 0;
+
+            for (size_t i=0; i < count; ++i) {
+                if (cache[i]->wd != ev->wd) continue;
+                if (attrib && cache[i] == settled) continue;
+
+                cache[i]->stale = true;
+                changed = true;
+
+                // the watch went away with the directory
+                if (ev->mask & IN_IGNORED)
+                    cache[i]->wd = -1;
+            }
+        }
+    }
+
+    if (changed) trim();
+    return changed;
+}
+
+// marks the directories changed since the last call as stale.
+// returns true if there were any
+bool dircache_poll(void) {
+    return read_events(NULL);
+}
+
+// for after changing the attributes of entries of `dir`, and updating them
+// in place: takes in the changes so far, without the ones to those entries,
+// so `dir` is not read again for them. (attributes someone else changed at
+// the same time go unnoticed)
+void dircache_settle(const Directory *dir) {
+    read_events(cached(dir));
+}
@@ -0,0 +1,35 @@
+#ifndef _DIRCACHE_H
+#define _DIRCACHE_H
+
+#include <stdbool.h>
+
+#include "dir.h"
+
+// loaded directories, shared by every view onto them (tabs and panes).
+// listings are reference counted and keyed by their path and whether hidden
+// files are shown, so two panes on the same directory read and stat it once.
+//
+// directories are watched with inotify. dircache_poll() marks changed ones as
+// stale, their views reload them with dircache_reload(), in place, which
+// bumps the generation. a few directories no view holds anymore are kept
+// around (while watched), making going back to them free. evicted ones are
+// recycled with their entry buffers
+
+
+
+Directory *dircache_open         (const char *path, bool hidden, unsigned int columns);
+Directory *dircache_open_archive (Archive *a, size_t member, bool hidden);
+Directory *dircache_ref          (Directory *dir);
+void       dircache_release      (Directory *dir);
+void       dircache_reload       (Directory *dir);
+bool       dircache_stale        (const Directory *dir);
+unsigned   dircache_generation   (const Directory *dir);
+bool       dircache_hidden       (const Directory *dir);
+bool       dircache_poll         (void);
+void       dircache_settle       (const Directory *dir);
+int        dircache_fd           (void);
+size_t     dircache_allocs       (void);
+
+
+
+#endif // _DIRCACHE_H
@@ -0,0 +1,439 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+
+#include "dupes.h"
+#include "fhash.h"
+#include "iosched.h"
+#include "util.h"
+
+
+
+#define HASH_CHUNK    64 // candidates hashed per task
+
+typedef struct {
+    char *path;
+    size_t size;
+    dev_t dev;
+    ino_t ino;
+    uint64_t hash;
+    bool failed;
+} Candidate;
+
+typedef struct {
+    char *path;
+    bool is_dir;
+    size_t size;
+    dev_t dev;
+    ino_t ino;
+} Seed;
+
+struct DupeScan {
+    pthread_t thread;
+    pthread_mutex_t lock; // guards everything up to `result`
+    bool cancelled;
+    DupeProgress progress;
+
+    Candidate *files;
+    size_t count;
+    size_t cap;
+    IoGroup *group; // bulk, walks and hashes
+
+    Seed *seeds;
+    size_t seed_count;
+
+    DupeFile *result; // only touched by the scan thread, until it is done
+    size_t result_count;
+    size_t groups;
+};
+
+static bool cancelled(DupeScan *scan) {
+    pthread_mutex_lock(&scan->lock);
+    bool c = scan->cancelled;
+    pthread_mutex_unlock(&scan->lock);
+    return c;
+}
+
+// takes ownership of `path`
+static void add_candidate(DupeScan *scan, char *path, size_t size, dev_t dev, ino_t ino) {
+
+    pthread_mutex_lock(&scan->lock);
+
+    if (scan->count == scan->cap) {
+        scan->cap = scan->cap ? scan->cap * 2 : 256;
+        scan->files = realloc(scan->files, scan->cap * sizeof(Candidate));
+        NON_NULL(scan->files);
+    }
+
+    scan->files[scan->count++] = (Candidate) {
+        .path = path,
+        .size = size,
+        .dev  = dev,
+        .ino  = ino,
+    };
+    scan->progress.files++;
+
+    pthread_mutex_unlock(&scan->lock);
+}
+
+typedef struct {
+    DupeScan *scan;
+    char *path;
+    dev_t dev;
+} WalkTask;
+
+static void submit_walk(DupeScan *scan, const char *path, dev_t dev);
+
+static void walk(void *arg) {
+    WalkTask *task = arg;
+    DupeScan *scan = task->scan;
+
+    Directory dir = DIRECTORY_INIT;
+
+    if (!cancelled(scan) && dir_read(&dir, task->path) != -1) {
+        dir_stat(&dir);
+
+        for (size_t i=0; i < dir.size; ++i) {
+            const Entry *e = &dir.entries[i];
+            if (!strcmp(e->name, ".") || !strcmp(e->name, "..")) continue;
+
+            char path[PATH_MAX] = { 0 };
+            dir_entry_path(&dir, e, path, ARRAY_LEN(path));
+
+            if (S_ISDIR(e->mode)) {
+                submit_walk(scan, path, dir.dev);
+
+            } else if (S_ISREG(e->mode) && e->size > 0) {
+                char *copy = strdup(path);
+                NON_NULL(copy);
+                add_candidate(scan, copy, e->size, dir.dev, e->ino);
+            }
+        }
+    }
+
+    dir_free(&dir);
+    free(task->path);
+    free(task);
+}
+
+static void submit_walk(DupeScan *scan, const char *path, dev_t dev) {
+    WalkTask *task = malloc(sizeof(WalkTask));
+    NON_NULL(task);
+
+    task->scan = scan;
+    task->path = strdup(path);
+    task->dev = dev;
+    NON_NULL(task->path);
+
+    iosched_submit(scan->group, dev, walk, task);
+}
+
+typedef struct {
+    DupeScan *scan;
+    Candidate *files;
+    size_t count;
+    bool full;
+} HashTask;
+
+static void hash_chunk(void *arg) {
+    HashTask *task = arg;
+    DupeScan *scan = task->scan;
+
+    for (size_t i=0; i < task->count && !cancelled(scan); ++i) {
+        Candidate *c = &task->files[i];
+
+        int err = task->full
+            ? fhash_full(c->path, &c->hash)
+            : fhash_edges(c->path, c->size, &c->hash);
+        c->failed = err == -1;
+
+        size_t hashed = task->full || c->size <= 2 * FHASH_EDGE
+            ? c->size
+            : 2 * FHASH_EDGE;
+
+        pthread_mutex_lock(&scan->lock);
+        scan->progress.hashed += hashed;
+        pthread_mutex_unlock(&scan->lock);
+    }
+
+    free(task);
+}
+
+// hashes all candidates with `full` hashes, or only their edges, in parallel
+static void hash_all(DupeScan *scan, bool full) {
+
+    for (size_t i=0; i < scan->count; i += HASH_CHUNK) {
+        HashTask *task = malloc(sizeof(HashTask));
+        NON_NULL(task);
+
+        *task = (HashTask) {
+            .scan  = scan,
+            .files = scan->files + i,
+            .count = scan->count - i < HASH_CHUNK ? scan->count - i : HASH_CHUNK,
+            .full  = full,
+        };
+        iosched_submit(scan->group, task->files[0].dev, hash_chunk, task);
+    }
+
+    iosched_wait(scan->group);
+}
+
+static int compare_size_inode(const void *a, const void *b) {
+    const Candidate *x = a;
+    const Candidate *y = b;
+
+    if (x->size != y->size) return x->size < y->size ? 1 : -1;
+    if (x->dev  != y->dev)  return x->dev  < y->dev  ? -1 : 1;
+    if (x->ino  != y->ino)  return x->ino  < y->ino  ? -1 : 1;
+    return 0;
+}
+
+static int compare_size_hash(const void *a, const void *b) {
+    const Candidate *x = a;
+    const Candidate *y = b;
+
+    if (x->size != y->size) return x->size < y->size ? 1 : -1;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+static bool same_size(const Candidate *x, const Candidate *y) {
+    return x->size == y->size;
+}
+
+static bool same_hash(const Candidate *x, const Candidate *y) {
+    return x->size == y->size && x->hash == y->hash;
+}
+
+// keeps only runs of at least two candidates which are `equal`, in place.
+// failed candidates are dropped
+static void keep_groups(DupeScan *scan, bool (*equal)(const Candidate*, const Candidate*)) {
+
+    size_t n = 0;
+    size_t i = 0;
+
+    while (i < scan->count) {
+        size_t j = i + 1;
+        while (j < scan->count && equal(&scan->files[i], &scan->files[j]))
+            j++;
+
+        for (size_t k=i; k < j; ++k) {
+            Candidate *c = &scan->files[k];
+
+            if (j - i >= 2 && !c->failed)
+                scan->files[n++] = *c;
+            else
+                free(c->path);
+        }
+
+        i = j;
+    }
+
+    pthread_mutex_lock(&scan->lock);
+    scan->count = n;
+    scan->progress.candidates = n;
+    pthread_mutex_unlock(&scan->lock);
+}
+
+// hardlinks share their content, but are no duplicates
+static void drop_hardlinks(DupeScan *scan) {
+
+    size_t n = 0;
+    for (size_t i=0; i < scan->count; ++i) {
+        Candidate *c = &scan->files[i];
+
+        if (n > 0 && compare_size_inode(&scan->files[n - 1], c) == 0)
+            free(c->path);
+        else
+            scan->files[n++] = *c;
+    }
+
+    scan->count = n;
+}
+
+static void set_phase(DupeScan *scan, DupePhase phase) {
+    pthread_mutex_lock(&scan->lock);
+    scan->progress.phase = phase;
+    scan->progress.candidates = scan->count;
+    pthread_mutex_unlock(&scan->lock);
+}
+
+static void *scan_thread(void *arg) {
+    DupeScan *scan = arg;
+
+    // 1. sizes
+    for (size_t i=0; i < scan->seed_count; ++i) {
+        Seed *seed = &scan->seeds[i];
+
+        if (seed->is_dir) {
+            submit_walk(scan, seed->path, seed->dev);
+            free(seed->path);
+
+        } else {
+            add_candidate(scan, seed->path, seed->size, seed->dev, seed->ino);
+        }
+    }
+
+    iosched_wait(scan->group);
+
+    qsort(scan->files, scan->count, sizeof(Candidate), compare_size_inode);
+    drop_hardlinks(scan);
+    keep_groups(scan, same_size);
+
+    // 2. edges. for small files, these already cover the whole content
+    set_phase(scan, DUPES_EDGES);
+    if (!cancelled(scan)) hash_all(scan, false);
+
+    qsort(scan->files, scan->count, sizeof(Candidate), compare_size_hash);
+    keep_groups(scan, same_hash);
+
+    // 3. full content
+    size_t small = 0;
+    while (small < scan->count && scan->files[small].size > 2 * FHASH_EDGE)
+        small++;
+
+    set_phase(scan, DUPES_FULL);
+    if (!cancelled(scan)) {
+        // sorted by size, descending: only the large files at the front
+        size_t count = scan->count;
+        scan->count = small;
+        hash_all(scan, true);
+        scan->count = count;
+    }
+
+    qsort(scan->files, scan->count, sizeof(Candidate), compare_size_hash);
+    keep_groups(scan, same_hash);
+
+    // largest groups first, which is where most space is wasted
+    scan->result = malloc((scan->count + 1) * sizeof(DupeFile));
+    NON_NULL(scan->result);
+
+    for (size_t i=0; i < scan->count; ++i) {
+        const Candidate *c = &scan->files[i];
+
+        if (i == 0 || !same_hash(&scan->files[i - 1], c))
+            scan->groups++;
+
+        scan->result[i] = (DupeFile) {
+            .path  = c->path,
+            .size  = c->size,
+            .group = scan->groups - 1,
+        };
+    }
+    scan->result_count = scan->count;
+
+    set_phase(scan, DUPES_DONE);
+    return NULL;
+}
+
+static Seed seed_from_entry(const Directory *dir, const Entry *e) {
+    char path[PATH_MAX] = { 0 };
+    dir_entry_path(dir, e, path, ARRAY_LEN(path));
+
+    Seed seed = {
+        .path   = strdup(path),
+        .is_dir = e->dtype == DT_DIR,
+        .size   = e->size,
+        .dev    = dir->dev,
+        .ino    = e->ino,
+    };
+    NON_NULL(seed.path);
+    return seed;
+}
+
+static bool seed_from_path(const char *path, Seed *seed) {
+    struct stat statbuf = { 0 };
+    if (lstat(path, &statbuf) == -1) return false;
+
+    bool is_dir = S_ISDIR(statbuf.st_mode);
+    if (!is_dir && (!S_ISREG(statbuf.st_mode) || statbuf.st_size == 0))
+        return false;
+
+    *seed = (Seed) {
+        .path   = strdup(path),
+        .is_dir = is_dir,
+        .size   = statbuf.st_size,
+        .dev    = statbuf.st_dev,
+        .ino    = statbuf.st_ino,
+    };
+    NON_NULL(seed->path);
+    return true;
+}
+
+// scans `paths` if `count` is non-zero, otherwise the entries of `dir`,
+// reusing their sizes. directories are scanned recursively
+DupeScan *dupes_start(const Directory *dir, const char *const *paths, size_t count) {
+
+    DupeScan *scan = calloc(1, sizeof(DupeScan));
+    NON_NULL(scan);
+    pthread_mutex_init(&scan->lock, NULL);
+    scan->group = iosched_group(IO_BULK);
+
+    size_t max = count ? count : dir->size;
+    scan->seeds = malloc((max + 1) * sizeof(Seed));
+    NON_NULL(scan->seeds);
+
+    if (count > 0) {
+        for (size_t i=0; i < count; ++i)
+            if (seed_from_path(paths[i], &scan->seeds[scan->seed_count]))
+                scan->seed_count++;
+
+    } else {
+        for (size_t i=0; i < dir->size; ++i) {
+            const Entry *e = &dir->entries[i];
+            if (!strcmp(e->name, ".") || !strcmp(e->name, "..")) continue;
+
+            // entries on worker threads may not have a size yet
+            bool file = e->stat == STAT_DONE && S_ISREG(e->mode) && e->size > 0;
+            if (e->dtype == DT_DIR || file)
+                scan->seeds[scan->seed_count++] = seed_from_entry(dir, e);
+        }
+    }
+
+    MUST_ZERO(pthread_create(&scan->thread, NULL, scan_thread, scan));
+    return scan;
+}
+
+DupeProgress dupes_progress(DupeScan *scan) {
+    pthread_mutex_lock(&scan->lock);
+    DupeProgress progress = scan->progress;
+    pthread_mutex_unlock(&scan->lock);
+    return progress;
+}
+
+// returns NULL until the scan is done
+const DupeFile *dupes_result(DupeScan *scan, size_t *count, size_t *groups) {
+    if (dupes_progress(scan).phase != DUPES_DONE) return NULL;
+
+    *count = scan->result_count;
+    *groups = scan->groups;
+    return scan->result;
+}
+
+// cancels the scan if it is still running
+void dupes_free(DupeScan *scan) {
+
+    pthread_mutex_lock(&scan->lock);
+    scan->cancelled = true;
+    pthread_mutex_unlock(&scan->lock);
+
+    iosched_cancel(scan->group);
+    pthread_join(scan->thread, NULL);
+    iosched_release(scan->group);
+
+    for (size_t i=0; i < scan->result_count; ++i)
+        free(scan->result[i].path);
+
+    free(scan->result);
+    free(scan->files);
+    free(scan->seeds);
+    pthread_mutex_destroy(&scan->lock);
+    free(scan);
+}
@@ -0,0 +1,50 @@
+#ifndef _DUPES_H
+#define _DUPES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dir.h"
+
+// finds files with identical content, on a background thread. candidates are
+// narrowed down in stages, each only looking at the survivors of the last:
+//
+//   1. equal size, distinct inodes (sizes of the current directory come from
+//      the already loaded Directory, subdirectories are walked in parallel)
+//   2. equal hash of the first and last block, see fhash_edges()
+//   3. equal hash of the whole content, see fhash_full()
+
+
+
+typedef struct {
+    char *path;
+    size_t size;
+    size_t group; // files of one group have the same content
+} DupeFile;
+
+typedef enum {
+    DUPES_WALK,
+    DUPES_EDGES,
+    DUPES_FULL,
+    DUPES_DONE,
+} DupePhase;
+
+typedef struct {
+    DupePhase phase;
+    size_t files;      // regular files found
+    size_t candidates; // files left in the current phase
+    uint64_t hashed;   // bytes hashed
+} DupeProgress;
+
+typedef struct DupeScan DupeScan;
+
+
+DupeScan       *dupes_start    (const Directory *dir, const char *const *paths, size_t count);
+DupeProgress    dupes_progress (DupeScan *scan);
+const DupeFile *dupes_result   (DupeScan *scan, size_t *count, size_t *groups);
+void            dupes_free     (DupeScan *scan);
+
+
+
+#endif // _DUPES_H
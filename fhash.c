@@ -0,0 +1,65 @@
+#define _DEFAULT_SOURCE // posix_fadvise()
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fhash.h"
+#include "hash.h"
+#include "util.h"
+
+
+
+#define FHASH_BLOCK (128 * 1024)
+
+// hashes the whole file, block by block. every block is hashed with the hash
+// of the previous one as seed. returns -1 on failure
+int fhash_full(const char *path, uint64_t *hash) {
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    unsigned char *buf = malloc(FHASH_BLOCK);
+    NON_NULL(buf);
+
+    uint64_t h = 0;
+    ssize_t len = 0;
+    while ((len = read(fd, buf, FHASH_BLOCK)) > 0)
+        h = xxh64(buf, len, h);
+
+    free(buf);
+    close(fd);
+
+    if (len == -1) return -1;
+    *hash = h;
+    return 0;
+}
+
+// hashes only the first and last FHASH_EDGE bytes, which is enough to tell
+// apart most files of the same size. returns -1 on failure
+int fhash_edges(const char *path, size_t size, uint64_t *hash) {
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    unsigned char buf[FHASH_EDGE];
+    uint64_t h = 0;
+
+    ssize_t len = pread(fd, buf, FHASH_EDGE, 0);
+    if (len > 0)
+        h = xxh64(buf, len, h);
+
+    if (len >= 0 && size > FHASH_EDGE) {
+        off_t tail = size > 2 * FHASH_EDGE ? (off_t) (size - FHASH_EDGE) : FHASH_EDGE;
+        len = pread(fd, buf, FHASH_EDGE, tail);
+        if (len > 0)
+            h = xxh64(buf, len, h);
+    }
+
+    close(fd);
+
+    if (len == -1) return -1;
+    *hash = h;
+    return 0;
+}
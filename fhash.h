@@ -0,0 +1,20 @@
+#ifndef _FHASH_H
+#define _FHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// content hashes of files, for telling apart files of the same size.
+// neither is cryptographic, equal hashes are only very likely equal content
+
+
+
+#define FHASH_EDGE 4096
+
+
+int fhash_full  (const char *path, uint64_t *hash);
+int fhash_edges (const char *path, size_t size, uint64_t *hash);
+
+
+
+#endif // _FHASH_H
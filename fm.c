@@ -7,44 +7,23 @@
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
 
 #include <sys/stat.h>
 #include <sys/wait.h>
 
 #include "fm.h"
 #include "util.h"
-#include "strio.h"
-
-
-
-static const char *filetype_repr(unsigned char filetype) {
-    switch (filetype) {
-        case DT_UNKNOWN: return "unknown";
-        case DT_FIFO:    return "fifo";
-        case DT_CHR:     return "chr";
-        case DT_DIR:     return "dir";
-        case DT_BLK:     return "blk";
-        case DT_REG:     return "reg";
-        case DT_LNK:     return "lnk";
-        case DT_SOCK:    return "sock";
-        case DT_WHT:     return "wht";
-        default:
-            assert(!"unknown filetype");
-    }
-}
-
-static size_t dir_get_filecount(DIR *dir) {
+#include "strbuf.h"
+#include "tmpl.h"
+#include "prof.h"
+#include "dircache.h"
 
-    size_t filecount = 0;
-    while (readdir(dir))
-        filecount++;
 
-    rewinddir(dir);
-    return filecount;
-}
 
 static void check_cursor_bounds(FileManager *fm) {
-    size_t filecount = fm->dir.size;
+    size_t filecount = fm->dir->size;
 
     if (fm->cursor == -1) // last dir was empty
         fm->cursor = 0;
@@ -53,94 +32,150 @@ static void check_cursor_bounds(FileManager *fm) {
         fm->cursor = filecount - 1; // -1 if dir is empty
 }
 
-static int compare_entries(const void *a, const void *b) {
-    const Entry *x = a;
-    const Entry *y = b;
+// makes `dir`, a listing from the cache, the current directory
+static void set_dir(FileManager *fm, Directory *dir) {
+    if (dir != fm->dir) {
+        dircache_release(fm->dir);
+        fm->dir = dir;
+    } else {
+        // already held
+        dircache_release(dir);
+    }
+
+    fm->dir_gen = dircache_generation(dir);
+
+    // after loading dir with less entries than last one, move the cursor back
+    // if its out of bounds
+    check_cursor_bounds(fm);
+}
+
+// lists the directory `member` of an archive, which is entered like any other.
+// returns -1 if it is no directory
+static int load_archive(FileManager *fm, Archive *a, size_t member) {
 
-    int dircmp = (y->dtype == DT_DIR) - (x->dtype == DT_DIR);
+    Directory *dir = dircache_open_archive(a, member, fm->show_hidden);
+    if (dir == NULL) return -1;
 
-    return dircmp == 0
-    ? strcmp(x->name, y->name)
-    : dircmp;
+    set_dir(fm, dir);
+    return 0;
 }
 
 // returns -1 if `dir` could not be opened
 // reload cwd if `dir` is NULL
 static int load_dir(FileManager *fm, const char *dir) {
 
-    if (dir == NULL) dir = fm->cwd;
+    // reloading rereads the listing for every view on it, unless hidden
+    // files were toggled, which makes it a different listing
+    bool reload = dir == NULL;
+    if (reload && dircache_hidden(fm->dir) == fm->show_hidden) {
+        dircache_reload(fm->dir);
+        if (fm->index != NULL)
+            pathindex_changed(fm->index, fm->dir->path);
+        fm->dir_gen = dircache_generation(fm->dir);
+        check_cursor_bounds(fm);
+        return 0;
+    }
 
-    DIR *dirp = opendir(dir);
-    if (dirp == NULL) return -1;
+    if (reload && fm->dir->archive != NULL)
+        return load_archive(fm, fm->dir->archive, fm->dir->member);
 
-    char *err = realpath(dir, fm->cwd);
-    NON_NULL(err);
+    if (reload) dir = fm->dir->path;
 
-    // some space may be wasted, because of ignoring hidden files
-    size_t filecount = dir_get_filecount(dirp);
-    Entry *entries = malloc(sizeof(Entry) * filecount);
-    NON_NULL(entries);
-    size_t i = 0;
+    Directory *loaded = dircache_open(dir, fm->show_hidden, fm->columns);
+    if (loaded == NULL) return -1;
 
-    struct dirent *entry = NULL;
-    while ((entry = readdir(dirp)) != NULL) {
+    set_dir(fm, loaded);
 
-        if (!fm->show_hidden && entry->d_name[0] == '.') continue;
+    if (fm->jumps != NULL && !reload)
+        jumpdb_visit(fm->jumps, fm->dir->path);
 
-        const char *type = filetype_repr(entry->d_type);
+    return 0;
+}
 
-        Entry e = {
-            .name    = { 0 },
-            .abspath = { 0 },
-            .type    = type,
-            .dtype   = entry->d_type,
-        };
+static size_t hash_path(const char *path) {
+    // FNV-1a
+    size_t hash = 14695981039346656037u;
+    for (; *path; ++path)
+        hash = (hash ^ (unsigned char) *path) * 1099511628211u;
+    return hash;
+}
 
-        snprintf(
-            e.abspath,
-            ARRAY_LEN(e.abspath),
-            "%s/%s",
-            fm->cwd,
-            entry->d_name
-        );
+// returns the slot holding `path`, or the empty slot it belongs into
+static size_t sel_probe(const Selections *sel, const char *path) {
+    size_t mask = sel->slot_count - 1;
+    size_t i = hash_path(path) & mask;
 
-        struct stat statbuf = { 0 };
-        stat(e.abspath, &statbuf);
+    while (sel->slots[i] != 0 && strcmp(sel->paths[sel->slots[i] - 1], path))
+        i = (i + 1) & mask;
 
-        e.size = statbuf.st_size;
-        e.mode = statbuf.st_mode;
+    return i;
+}
 
-        // d_name cannot be used as its free'd by closedir()
-        strncpy(e.name, entry->d_name, ARRAY_LEN(e.name));
+static void sel_rehash(Selections *sel, size_t slot_count) {
+    free(sel->slots);
+    sel->slots = calloc(slot_count, sizeof(*sel->slots));
+    NON_NULL(sel->slots);
+    sel->slot_count = slot_count;
 
-        entries[i++] = e;
+    for (size_t i=0; i < sel->size; ++i)
+        sel->slots[sel_probe(sel, sel->paths[i])] = i + 1;
+}
 
-    }
+static void sel_insert(Selections *sel, const char *path) {
 
-    qsort(entries, i, sizeof(Entry), compare_entries);
-    closedir(dirp);
+    // keep the load factor at or below 1/2
+    if ((sel->size + 1) * 2 > sel->slot_count)
+        sel_rehash(sel, sel->slot_count ? sel->slot_count * 2 : 64);
 
-    // deallocate old dir, will do nothing when initializing as entries is NULL
-    free(fm->dir.entries);
+    if (sel->size == sel->capacity) {
+        sel->capacity = sel->capacity ? sel->capacity * 2 : 16;
+        sel->paths = realloc(sel->paths, sel->capacity * sizeof(*sel->paths));
+        NON_NULL(sel->paths);
+    }
 
-    fm->dir = (Directory) {
-        .size    = i,
-        .entries = entries,
-    };
+    sel->paths[sel->size] = strdup(path);
+    NON_NULL(sel->paths[sel->size]);
+    sel->slots[sel_probe(sel, path)] = ++sel->size;
+}
 
+static void sel_remove(Selections *sel, size_t slot) {
+    size_t mask = sel->slot_count - 1;
+    size_t index = sel->slots[slot] - 1;
+    free(sel->paths[index]);
+
+    // backward shift deletion: pull later members of the probe sequence
+    // into the gap, if their home slot allows it
+    size_t gap = slot;
+    for (size_t i = (slot + 1) & mask; sel->slots[i] != 0; i = (i + 1) & mask) {
+        size_t home = hash_path(sel->paths[sel->slots[i] - 1]) & mask;
+        if (((i - home) & mask) >= ((i - gap) & mask)) {
+            sel->slots[gap] = sel->slots[i];
+            gap = i;
+        }
+    }
+    sel->slots[gap] = 0;
 
-    // after loading dir with less entries than last one, move the cursor back
-    // if its out of bounds
-    check_cursor_bounds(fm);
-    return 0;
+    // fill the hole in `paths` with the last path
+    size_t last = --sel->size;
+    if (index != last) {
+        sel->paths[index] = sel->paths[last];
+        sel->slots[sel_probe(sel, sel->paths[index])] = index + 1;
+    }
+}
+
+static void sel_destroy(Selections *sel) {
+    for (size_t i=0; i < sel->size; ++i)
+        free(sel->paths[i]);
+    free(sel->paths);
+    free(sel->slots);
+    *sel = (Selections) { 0 };
 }
 
 void fm_init(FileManager *fm, const char *dir) {
 
     *fm = (FileManager) {
         .cursor        = 0,
-        .cwd           = { 0 },
-        .dir           = { .entries = NULL, .size = 0 },
+        .dir           = NULL,
         .show_hidden   = false,
         .wrap_cursor   = true,
     };
@@ -158,34 +193,197 @@ void fm_init(FileManager *fm, const char *dir) {
 
 }
 
+// a view on the directory of `from`, sharing its listing, with the same
+// settings and cursor but nothing selected
+void fm_clone(FileManager *fm, const FileManager *from) {
+
+    *fm = (FileManager) {
+        .cursor      = from->cursor,
+        .scroll      = from->scroll,
+        .height      = from->height,
+        .dir         = dircache_ref(from->dir),
+        .dir_gen     = from->dir_gen,
+        .columns     = from->columns,
+        .show_hidden = from->show_hidden,
+        .wrap_cursor = from->wrap_cursor,
+        .jumps       = from->jumps,
+        .index       = from->index,
+    };
+}
+
 void fm_destroy(FileManager *fm) {
-    free(fm->dir.entries);
+    dircache_release(fm->dir);
+    sel_destroy(&fm->sel);
 }
 
 static void append_cwd(FileManager *fm, const char *dir) {
 
-    char buf[PATH_MAX + NAME_MAX] = { 0 };
-    snprintf(buf, ARRAY_LEN(buf), "%s/%s", fm->cwd, dir);
+    // the directory, a slash, a name and the terminator
+    char buf[PATH_MAX + NAME_MAX + 2] = { 0 };
+    snprintf(buf, ARRAY_LEN(buf), "%s/%s", fm->dir->path, dir);
 
     load_dir(fm, buf);
 }
 
 void fm_cd_parent(FileManager *fm) {
-    append_cwd(fm, "..");
+    Archive *a = fm->dir->archive;
+    if (a == NULL) {
+        append_cwd(fm, "..");
+        return;
+    }
+
+    // leaving the archive lands on the archive itself
+    if (fm->dir->member == 0)
+        fm_reveal(fm, archive_path(a));
+    else
+        load_archive(fm, a, archive_member(a, fm->dir->member)->parent);
 }
 
+// enters the directory, or archive, under the cursor
 void fm_cd(FileManager *fm) {
     if (fm->cursor == -1) return;
-    const Entry *entry = &fm->dir.entries[fm->cursor];
+    const Entry *entry = &fm->dir->entries[fm->cursor];
+
+    if (fm->dir->archive != NULL) {
+        load_archive(fm, fm->dir->archive, entry->ino);
+        return;
+    }
 
-    if (entry->dtype != DT_DIR) return;
+    ArchiveJob *job = fm_archive_start(fm);
+    if (job != NULL) {
+        fm_archive_finish(fm, job);
+        return;
+    }
+
+    bool link_dir = entry->link_status == LINK_OK && entry->link_dir;
+    if (entry->dtype != DT_DIR && !link_dir) return;
 
     const char *subdir = entry->name;
     append_cwd(fm, subdir);
 }
 
-void fm_cd_abs(FileManager *fm, const char *path) {
-    load_dir(fm, path);
+// starts indexing the archive under the cursor, NULL if there is none. see
+// archive_start(), fm_archive_finish() enters it
+ArchiveJob *fm_archive_start(const FileManager *fm) {
+    const Entry *entry = fm_get_current(fm);
+    if (entry == NULL || fm->dir->archive != NULL) return NULL;
+    if (entry->dtype != DT_REG || !archive_detect(entry->name)) return NULL;
+
+    char path[PATH_MAX] = { 0 };
+    return archive_start(fm_get_path(fm, entry, path, ARRAY_LEN(path)));
+}
+
+// waits for `job` and enters the archive. returns -1 if it could not be indexed
+int fm_archive_finish(FileManager *fm, ArchiveJob *job) {
+    Archive *a = archive_finish(job);
+    if (a == NULL) return -1;
+
+    load_archive(fm, a, 0);
+    archive_close(a); // the directory holds its own reference
+    return 0;
+}
+
+// extracts the archive member under the cursor next to the archive.
+// returns -1 if there is none, or it could not be extracted
+int fm_extract(FileManager *fm) {
+    const Entry *e = fm_get_current(fm);
+    Archive *a = fm->dir->archive;
+    if (e == NULL || a == NULL) return -1;
+
+    char dir[PATH_MAX] = { 0 };
+    snprintf(dir, ARRAY_LEN(dir), "%s", archive_path(a));
+    *strrchr(dir, '/') = '\0';
+
+    int fd = open(*dir != '\0' ? dir : "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    int err = archive_extract(a, e->ino, fd);
+    close(fd);
+    return err;
+}
+
+// reads up to `size` bytes from the start of `e`, also if it is a member of an
+// archive. returns the amount read, -1 on errors
+ssize_t fm_read_head(const FileManager *fm, const Entry *e, char *buf, size_t size) {
+    if (fm->dir->archive != NULL)
+        return archive_read(fm->dir->archive, e->ino, buf, size);
+
+    int fd = openat(fm->dir->fd, e->name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    ssize_t n = read(fd, buf, size);
+    close(fd);
+    return n;
+}
+
+// returns -1 if `path` could not be opened, staying in the current directory
+int fm_cd_abs(FileManager *fm, const char *path) {
+    return load_dir(fm, path);
+}
+
+// applies background results to the current directory.
+// returns true while some are outstanding, so the caller keeps polling
+bool fm_poll(FileManager *fm) {
+
+    // changes on disk, and reloads by other views on the same directory
+    dircache_poll();
+    if (dircache_stale(fm->dir)) {
+        dircache_reload(fm->dir);
+        if (fm->index != NULL)
+            pathindex_changed(fm->index, fm->dir->path);
+    }
+
+    if (fm->dir_gen != dircache_generation(fm->dir)) {
+        fm->dir_gen = dircache_generation(fm->dir);
+        check_cursor_bounds(fm);
+    }
+
+    bool stats = dir_poll(fm->dir);
+    bool hashing = fm->dir->repo != NULL && git_busy(fm->dir->repo);
+    return magic_busy() || stats || hashing;
+}
+
+// scrolls, so that the cursor stays within the `height` rows on screen
+void fm_set_viewport(FileManager *fm, size_t height) {
+    fm->height = height;
+    size_t size = fm->dir->size;
+
+    if (fm->cursor == -1) {
+        fm->scroll = 0;
+        return;
+    }
+
+    size_t cursor = fm->cursor;
+    if (cursor < fm->scroll)
+        fm->scroll = cursor;
+    else if (cursor >= fm->scroll + height)
+        fm->scroll = cursor - height + 1;
+
+    // don't leave empty rows at the bottom after the directory shrunk
+    if (fm->scroll + height > size)
+        fm->scroll = size > height ? size - height : 0;
+}
+
+// resolves what is only needed for display, for the rows on screen
+void fm_resolve_visible(FileManager *fm) {
+    // columns enabled since the listing was loaded
+    dir_fetch_columns(fm->dir, fm->scroll, fm->scroll + fm->height);
+
+    uint64_t start = prof_begin();
+    dir_resolve_links(fm->dir, fm->scroll, fm->scroll + fm->height);
+    prof_end(PROF_LINKS, start, fm->height);
+
+    // sniffs of rows that scrolled off are dropped by magic_sweep_requests()
+    dir_classify(fm->dir, fm->scroll, fm->scroll + fm->height);
+    dir_git_status(fm->dir, fm->scroll, fm->scroll + fm->height);
+}
+
+// enables the Column flags `columns`. listings loaded from now on only stat
+// for what they need, the current one is completed row by row. listings
+// shared with other views fetch the columns of every view
+void fm_set_columns(FileManager *fm, unsigned int columns) {
+    fm->columns = columns;
+    fm->dir->columns |= columns;
 }
 
 void fm_go_up(FileManager *fm) {
@@ -195,13 +393,13 @@ void fm_go_up(FileManager *fm) {
         fm->cursor--;
 
     else if (fm->wrap_cursor)
-        fm->cursor = fm->dir.size-1;
+        fm->cursor = fm->dir->size-1;
 }
 
 void fm_go_down(FileManager *fm) {
     if (fm->cursor == -1) return;
 
-    if ((size_t) fm->cursor != fm->dir.size - 1)
+    if ((size_t) fm->cursor != fm->dir->size - 1)
         fm->cursor++;
 
     else if (fm->wrap_cursor)
@@ -211,7 +409,7 @@ void fm_go_down(FileManager *fm) {
 Entry *fm_get_current(const FileManager *fm) {
     return fm->cursor == -1
     ? NULL
-    : &fm->dir.entries[fm->cursor];
+    : &fm->dir->entries[fm->cursor];
 }
 
 void fm_toggle_hidden(FileManager *fm) {
@@ -223,40 +421,71 @@ void fm_toggle_cursor_wrapping(FileManager *fm) {
     fm->wrap_cursor = !fm->wrap_cursor;
 }
 
-static ssize_t fm_search_selection(const FileManager *fm, const char *path) {
+void fm_toggle_select(FileManager *fm) {
+    Selections *sel = &fm->sel;
+    const Entry *e = fm_get_current(fm);
+    if (e == NULL) return;
+
+    char path[PATH_MAX] = { 0 };
+    fm_get_path(fm, e, path, ARRAY_LEN(path));
+
+    if (sel->size == 0 || sel->slots[sel_probe(sel, path)] == 0)
+        sel_insert(sel, path);
+    else
+        sel_remove(sel, sel_probe(sel, path));
+}
+
+bool fm_is_selected(const FileManager *fm, const char *path) {
     const Selections *sel = &fm->sel;
+    return sel->size != 0 && sel->slots[sel_probe(sel, path)] != 0;
+}
 
-    for (size_t i=0; i < sel->size; ++i)
-        if (!strcmp(sel->paths[i], path))
-            return i;
+void fm_select_path(FileManager *fm, const char *path, bool select) {
+    Selections *sel = &fm->sel;
 
-    return -1;
+    if (select && !fm_is_selected(fm, path))
+        sel_insert(sel, path);
+
+    else if (!select && fm_is_selected(fm, path))
+        sel_remove(sel, sel_probe(sel, path));
 }
 
-void fm_toggle_select(FileManager *fm) {
+void fm_clear_selection(FileManager *fm) {
     Selections *sel = &fm->sel;
-    const char *path = fm_get_current(fm)->abspath;
+    while (sel->size > 0)
+        sel_remove(sel, sel_probe(sel, sel->paths[sel->size - 1]));
+}
 
-    ssize_t i = fm_search_selection(fm, path);
-    if (i == -1) {
-        // Insert
-        if (sel->size == MAX_SELECTION) return;
-        strncpy(sel->paths[sel->size++], path, ARRAY_LEN(*sel->paths));
+// changes into the directory of `path`, and moves the cursor onto it.
+// returns -1 if the directory could not be opened
+int fm_reveal(FileManager *fm, const char *path) {
 
-    } else {
-        // Delete
-        sel->size--;
-        memmove(
-            sel->paths + i,
-            sel->paths + i + 1,
-            (sel->size - i) * sizeof(*sel->paths)
-        );
+    char dir[PATH_MAX] = { 0 };
+    snprintf(dir, ARRAY_LEN(dir), "%s", path);
+
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL) return -1;
 
+    // `path` may go away with the directory being left
+    char name[NAME_MAX + 1] = { 0 };
+    snprintf(name, ARRAY_LEN(name), "%s", slash + 1);
+    slash[slash == dir] = '\0'; // keep the root
+
+    if (load_dir(fm, dir) == -1) return -1;
+
+    for (size_t i=0; i < fm->dir->size; ++i) {
+        if (!strcmp(fm->dir->entries[i].name, name)) {
+            fm->cursor = i;
+            break;
+        }
     }
+
+    return 0;
 }
 
-bool fm_is_selected(const FileManager *fm, const char *path) {
-    return fm_search_selection(fm, path) != -1;
+// writes the absolute path of `e`, an entry of the current directory, into `buf`
+char *fm_get_path(const FileManager *fm, const Entry *e, char *buf, size_t size) {
+    return dir_entry_path(fm->dir, e, buf, size);
 }
 
 
@@ -265,8 +494,11 @@ void fm_exec(const FileManager *fm, const char *bin, void (*exit_routine)(void))
     if (e == NULL)
         return;
 
+    char path[PATH_MAX] = { 0 };
+    fm_get_path(fm, e, path, ARRAY_LEN(path));
+
     exit_routine();
-    int err = execlp(bin, bin, e->abspath, NULL);
+    int err = execlp(bin, bin, path, NULL);
     if (err == -1) {
         fprintf(stderr, "Failed to execute `%s`: %s\n", bin, strerror(errno));
         exit(EXIT_FAILURE);
@@ -274,9 +506,16 @@ void fm_exec(const FileManager *fm, const char *bin, void (*exit_routine)(void))
 
 }
 
-static void run_cmd(const char *cmd) {
+// returns true if `cmd` exited successfully
+static bool run_cmd(const char *cmd) {
+
+    uint64_t start = prof_begin();
 
-    if (fork() == 0) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        // ignored by socket sessions, see batch_listen(), but not for pipes
+        // of the command
+        signal(SIGPIPE, SIG_DFL);
         int err = execlp("/bin/sh", "sh", "-c", cmd, NULL);
         if (err == -1) {
             fprintf(stderr, "Failed to execute `%s`: %s\n", cmd, strerror(errno));
@@ -284,22 +523,204 @@ static void run_cmd(const char *cmd) {
         }
     }
 
-    wait(NULL);
+    int status = 0;
+    bool ok = pid != -1 && waitpid(pid, &status, 0) == pid
+        && WIFEXITED(status) && WEXITSTATUS(status) == 0;
 
+    prof_end(PROF_CMD, start, 1);
+    return ok;
 }
 
-void fm_run_cmd_selected(FileManager *fm, const char *cmd) {
-    Selections *sel = &fm->sel;
+// `cmd` is a template (see tmpl.h), compiled once and expanded either once
+// per selected path, or once for all of them if it uses batch placeholders.
+// returns how many commands failed, -1 if `cmd` is no valid template, or uses
+// `{other}` without a second pane
+int fm_run_cmd_selected(FileManager *fm, const char *cmd) {
+    const Selections *sel = &fm->sel;
+    const char *const *paths = (const char *const *) sel->paths;
+    if (sel->size == 0) return 0;
 
-    for (size_t i=0; i < sel->size; ++i) {
-        const char *path = sel->paths[i];
-        char *full_cmd = string_expand_query(cmd, "{}", path);
+    Template t = { 0 };
+    if (tmpl_compile(&t, cmd) == -1) return -1;
 
-        run_cmd(full_cmd);
+    // without a second pane, there is nowhere for `{other}` to point
+    if (t.uses_other && fm->other == NULL) {
+        tmpl_destroy(&t);
+        return -1;
+    }
+    t.other = fm->other != NULL ? fm->other->dir->path : NULL;
 
-        free(full_cmd);
+    StrBuf buf = { 0 };
+    int failed = 0;
+
+    if (t.batch) {
+        failed += !run_cmd(tmpl_expand(&t, &buf, paths, sel->size));
+
+    } else {
+        for (size_t i=0; i < sel->size; ++i)
+            failed += !run_cmd(tmpl_expand(&t, &buf, paths + i, 1));
     }
 
+    strbuf_free(&buf);
+    tmpl_destroy(&t);
+
     load_dir(fm, NULL);
+    return failed;
+}
+
+// writes the absolute path of `name`, in the current directory, into `buf`.
+// left empty if too long, like dir_entry_path()
+static char *child_path(const FileManager *fm, const char *name, char *buf, size_t size) {
+    const char *sep = strcmp(fm->dir->path, "/") ? "/" : "";
+    int len = snprintf(buf, size, "%s%s%s", fm->dir->path, sep, name);
+    if (len < 0 || (size_t) len >= size) *buf = '\0';
+    return buf;
+}
+
+// the name of `path` if it is in the current directory, NULL otherwise
+static char *cwd_name(const FileManager *fm, const char *path) {
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) return NULL;
+
+    size_t dir_len = strlen(fm->dir->path);
+    bool inside = !strcmp(fm->dir->path, "/")
+        ? slash == path
+        : (size_t) (slash - path) == dir_len && !strncmp(path, fm->dir->path, dir_len);
+
+    return inside ? (char*) slash + 1 : NULL;
+}
+
+// the names to bulk rename: the selected entries of the current directory, or
+// all of its entries if none of them is selected. returns their count, and
+// `*names` (to be freed) pointing at names owned by `fm`
+size_t fm_rename_names(const FileManager *fm, char ***names) {
+
+    *names = NULL;
+    if (fm->dir->archive != NULL || fm->dir->size == 0) return 0;
+
+    // no more than the entries shown, and every path of the selection
+    size_t max = fm->dir->size > fm->sel.size ? fm->dir->size : fm->sel.size;
+    char **out = malloc(max * sizeof(char *));
+    NON_NULL(out);
+
+    size_t count = 0;
+
+    for (size_t i=0; i < fm->sel.size; ++i) {
+        char *name = cwd_name(fm, fm->sel.paths[i]);
+        if (name != NULL)
+            out[count++] = name;
+    }
+
+    if (count == 0) {
+        for (size_t i=0; i < fm->dir->size; ++i) {
+            char *name = fm->dir->entries[i].name;
+            if (strcmp(name, ".") && strcmp(name, ".."))
+                out[count++] = name;
+        }
+    }
+
+    *names = out;
+    return count;
+}
+
+// applies `p`, planned on the current directory (see renames.h), and carries
+// the selection over to the new names. returns -1 if it failed, see
+// renames_apply()
+int fm_rename(FileManager *fm, RenamePlan *p) {
+
+    int err = renames_apply(p);
+    int saved = errno;
+
+    if (err == 0 && fm->sel.size > 0) {
+        char path[PATH_MAX] = { 0 };
+
+        // unselect every old name first, the new ones may be among them
+        bool *selected = calloc(p->count + 1, sizeof(bool));
+        NON_NULL(selected);
+
+        for (size_t i=0; i < p->count; ++i) {
+            child_path(fm, renames_name(p, p->ops[i].from), path, ARRAY_LEN(path));
+            selected[i] = fm_is_selected(fm, path);
+            fm_select_path(fm, path, false);
+        }
+
+        for (size_t i=0; i < p->count; ++i) {
+            if (!selected[i]) continue;
+            child_path(fm, renames_name(p, p->ops[i].to), path, ARRAY_LEN(path));
+            fm_select_path(fm, path, true);
+        }
+
+        free(selected);
+    }
+
+    load_dir(fm, NULL);
+    errno = saved;
+    return err;
+}
+
+// starts changing the attributes of the selection, or of the entry under the
+// cursor, see attrs.h. returns NULL if there is nothing to change
+AttrJob *fm_attrs_start(const FileManager *fm, const AttrChange *c) {
+
+    if (fm->sel.size > 0)
+        return attrs_start(c, (const char *const *) fm->sel.paths, fm->sel.size);
+
+    const Entry *e = fm_get_current(fm);
+    if (e == NULL || fm->dir->archive != NULL) return NULL;
+    if (!strcmp(e->name, ".") || !strcmp(e->name, "..")) return NULL;
+
+    char path[PATH_MAX] = { 0 };
+    const char *paths[] = { fm_get_path(fm, e, path, ARRAY_LEN(path)) };
+    return attrs_start(c, paths, 1);
+}
+
+static const char *result_name(const AttrResult *r) {
+    return strrchr(r->path, '/') + 1;
+}
+
+static int compare_result_names(const void *a, const void *b) {
+    return strcmp(result_name(*(const AttrResult *const *) a), result_name(*(const AttrResult *const *) b));
+}
+
+static int find_result_name(const void *name, const void *r) {
+    return strcmp(name, result_name(*(const AttrResult *const *) r));
+}
+
+// puts the new attributes from the finished `job` into the entries of the
+// current directory, instead of reading it again
+void fm_attrs_finish(FileManager *fm, AttrJob *job) {
+
+    size_t count = 0;
+    const AttrResult *results = attrs_result(job, &count);
+    if (results == NULL || fm->dir->archive != NULL) return;
+
+    uint64_t start = prof_begin();
+
+    // sorted by name, looked up for every entry
+    const AttrResult **found = malloc((count + 1) * sizeof(AttrResult*));
+    NON_NULL(found);
+
+    size_t n = 0;
+    for (size_t i=0; i < count; ++i)
+        if (results[i].changed && cwd_name(fm, results[i].path) != NULL)
+            found[n++] = &results[i];
+
+    qsort(found, n, sizeof(AttrResult*), compare_result_names);
+
+    for (size_t i=0; i < fm->dir->size && n > 0; ++i) {
+        Entry *e = &fm->dir->entries[i];
+
+        const AttrResult **r = bsearch(e->name, found, n, sizeof(AttrResult*), find_result_name);
+        if (r == NULL) continue;
+
+        e->mode  = (*r)->mode;
+        e->uid   = (*r)->uid;
+        e->gid   = (*r)->gid;
+        e->mtime = (*r)->mtime;
+    }
+
+    free(found);
+    dircache_settle(fm->dir);
 
+    prof_end(PROF_ATTRS, start, n);
 }
@@ -7,54 +7,74 @@
 #include <dirent.h>
 #include <limits.h>
 
+#include "dir.h"
+#include "jumpdb.h"
+#include "renames.h"
+#include "attrs.h"
+#include "pathindex.h"
 
 
+// selected paths in insertion order (up to removals, which swap the last
+// path into the gap). `slots` is an open-addressing hash index into `paths`,
+// storing `index + 1`, so that 0 marks an empty slot
 typedef struct {
-    char name[NAME_MAX];
-    char abspath[PATH_MAX];
-    // char abspath[PATH_MAX + NAME_MAX + 1];
-    const char *type;
-    unsigned int dtype;
-    size_t size;
-    unsigned int mode;
-} Entry;
-
-typedef struct {
-    size_t size;
-    Entry *entries;
-} Directory;
-
-#define MAX_SELECTION 5
-
-typedef struct {
-    char paths[MAX_SELECTION][PATH_MAX];
+    char **paths;
     size_t size;
+    size_t capacity;
+    size_t *slots;
+    size_t slot_count;
 } Selections;
 
-typedef struct {
+// a view onto the file system: a tab, or a pane of a split one. views share
+// their listings through the directory cache (see dircache.h), everything
+// else is their own
+typedef struct FileManager {
     int cursor; // -1 represents no file being selected (empty dir)
-    char cwd[PATH_MAX];
-    Directory dir;
+    size_t scroll; // first row on screen
+    size_t height; // amount of rows on screen
+    Directory *dir; // `dir->path` is the current working directory
+    unsigned dir_gen; // of `dir`, when the cursor was last kept in bounds
+    unsigned int columns; // Column flags shown
     bool show_hidden;
     bool wrap_cursor;
     Selections sel;
+    JumpDb *jumps; // visited directories are recorded here, if not NULL
+    PathIndex *index; // told about changed directories, if not NULL
+    const struct FileManager *other; // the other pane, for `{other}`
 } FileManager;
 
 
 void fm_init                   (FileManager *fm, const char *dir);
+void fm_clone                  (FileManager *fm, const FileManager *from);
 void fm_destroy                (FileManager *fm);
 void fm_cd                     (FileManager *fm);
 void fm_cd_parent              (FileManager *fm);
 void fm_go_down                (FileManager *fm);
 void fm_go_up                  (FileManager *fm);
-void fm_cd_abs                 (FileManager *fm, const char *path);
+int  fm_cd_abs                 (FileManager *fm, const char *path);
+int  fm_extract                (FileManager *fm);
+ArchiveJob *fm_archive_start   (const FileManager *fm);
+int  fm_archive_finish         (FileManager *fm, ArchiveJob *job);
+ssize_t fm_read_head           (const FileManager *fm, const Entry *e, char *buf, size_t size);
 void fm_exec                   (const FileManager *fm, const char *bin, void (*exit_routine)(void));
 void fm_toggle_hidden          (FileManager *fm);
 void fm_toggle_cursor_wrapping (FileManager *fm);
 void fm_toggle_select          (FileManager *fm);
 Entry *fm_get_current          (const FileManager *fm);
 bool fm_is_selected            (const FileManager *fm, const char *path);
-void fm_run_cmd_selected       (FileManager *fm, const char *cmd);
+void fm_select_path            (FileManager *fm, const char *path, bool select);
+void fm_clear_selection        (FileManager *fm);
+int  fm_reveal                 (FileManager *fm, const char *path);
+char *fm_get_path              (const FileManager *fm, const Entry *e, char *buf, size_t size);
+int  fm_run_cmd_selected       (FileManager *fm, const char *cmd);
+bool fm_poll                   (FileManager *fm);
+void fm_set_viewport           (FileManager *fm, size_t height);
+void fm_resolve_visible        (FileManager *fm);
+void fm_set_columns            (FileManager *fm, unsigned int columns);
+size_t fm_rename_names         (const FileManager *fm, char ***names);
+int  fm_rename                 (FileManager *fm, RenamePlan *p);
+AttrJob *fm_attrs_start        (const FileManager *fm, const AttrChange *c);
+void fm_attrs_finish           (FileManager *fm, AttrJob *job);
 
 
 
@@ -0,0 +1,738 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gitstatus.h"
+#include "strbuf.h"
+#include "arena.h"
+#include "sha1.h"
+#include "iosched.h"
+#include "util.h"
+
+
+
+#define REPO_CACHE   8
+#define HASH_CHUNK   (64 * 1024)
+#define HASH_QUEUE   64 // hashes queued or running per repository at most
+// entries are 62 bytes before their path
+#define INDEX_ENTRY  62
+// the mode of submodules in the index
+#define GITLINK      0160000
+
+typedef struct {
+    uint32_t path; // offset into `names`
+    uint32_t mtime_s;
+    uint32_t mtime_ns;
+    uint32_t ino;
+    uint32_t mode;
+    uint32_t size; // truncated to 32 bits, like git does
+    unsigned char sha1[20];
+    unsigned stage;
+} IndexEntry;
+
+typedef struct {
+    char *pattern;
+    bool negate;
+    bool dir_only;
+    bool anchored; // matched against the whole path, not just the name
+} IgnoreRule;
+
+// the rules of one ignore file, relative to `dir`
+typedef struct {
+    char *dir;
+    IgnoreRule *rules;
+    size_t count;
+} IgnoreFile;
+
+// a file that had to be hashed
+typedef struct {
+    char *path;
+    struct timespec mtime;
+    size_t size;
+    bool clean;
+} Verified;
+
+// a file being hashed on a worker thread. `done`, `clean` and `orphaned`
+// are guarded by `lock`, the rest is only read by the worker
+typedef struct HashJob {
+    IoGroup *group;
+    char path[PATH_MAX];
+    const char *rel; // into `path`
+    size_t size;
+    struct timespec mtime;
+    unsigned char sha1[20]; // in the index
+    bool done;
+    bool clean;
+    bool orphaned;  // its result is not wanted anymore, the task frees it
+    struct HashJob *next; // in `GitRepo.hashing`, unless orphaned
+} HashJob;
+
+struct GitRepo {
+    char root[PATH_MAX];
+    char gitdir[PATH_MAX];
+    struct timespec index_mtime;
+    off_t index_size;
+    unsigned generation;
+
+    IndexEntry *entries; // sorted by path, like in the index
+    size_t count;
+    StrBuf names;
+
+    IgnoreFile *ignores;
+    size_t ignore_count;
+
+    Verified *verified;
+    size_t verified_count;
+
+    HashJob *hashing; // not collected yet, only touched by the main thread
+    size_t hashing_count;
+
+    Arena strings; // of the ignore rules and verified files, reset with them
+    size_t refs;   // of the cache and of every git_find() not yet released
+};
+
+static GitRepo *repos[REPO_CACHE] = { 0 };
+static size_t repo_next = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static uint32_t be32(const unsigned char *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static uint16_t be16(const unsigned char *p) {
+    return p[0] << 8 | p[1];
+}
+
+// git's offset varint, as used for path prefixes in v4
+static size_t varint(const unsigned char **p, const unsigned char *end) {
+    if (*p >= end) return 0;
+
+    unsigned char c = *(*p)++;
+    size_t value = c & 127;
+
+    while (c & 128 && *p < end) {
+        value += 1;
+        c = *(*p)++;
+        value = (value << 7) + (c & 127);
+    }
+
+    return value;
+}
+
+static const char *entry_path(const GitRepo *repo, const IndexEntry *e) {
+    return repo->names.data + e->path;
+}
+
+// returns -1 if the index can't be read, which leaves the repo empty
+static int parse_index(GitRepo *repo, const unsigned char *map, size_t size) {
+
+    repo->count = 0;
+    strbuf_clear(&repo->names);
+
+    if (size < 12 || memcmp(map, "DIRC", 4)) return -1;
+
+    uint32_t version = be32(map + 4);
+    uint32_t count = be32(map + 8);
+    if (version < 2 || version > 4) return -1;
+    if (count > size / INDEX_ENTRY) return -1;
+
+    free(repo->entries);
+    repo->entries = malloc((count + 1) * sizeof(IndexEntry));
+    NON_NULL(repo->entries);
+
+    const unsigned char *p = map + 12;
+    const unsigned char *end = map + size;
+    char path[PATH_MAX] = { 0 };
+    size_t path_len = 0;
+
+    for (uint32_t i=0; i < count; ++i) {
+        if (p + INDEX_ENTRY > end) return -1;
+
+        const unsigned char *start = p;
+        uint16_t flags = be16(p + 60);
+        p += INDEX_ENTRY;
+
+        // extended flags, v3 and later
+        if (flags & 0x4000) p += 2;
+
+        if (version == 4) {
+            size_t strip = varint(&p, end);
+            if (strip > path_len) return -1;
+            path_len -= strip;
+        } else {
+            path_len = 0;
+        }
+
+        const unsigned char *nul = memchr(p, '\0', end - p);
+        if (nul == NULL || path_len + (nul - p) >= PATH_MAX) return -1;
+
+        memcpy(path + path_len, p, nul - p);
+        path_len += nul - p;
+        path[path_len] = '\0';
+        p = nul + 1;
+
+        // v2 and v3 pad entries to a multiple of 8 bytes
+        if (version != 4)
+            p = start + ((nul - start + 8) & ~7);
+
+        IndexEntry *e = &repo->entries[repo->count++];
+        *e = (IndexEntry) {
+            .path     = repo->names.len,
+            .mtime_s  = be32(start + 8),
+            .mtime_ns = be32(start + 12),
+            .ino      = be32(start + 20),
+            .mode     = be32(start + 24),
+            .size     = be32(start + 36),
+            .stage    = (flags >> 12) & 3,
+        };
+        memcpy(e->sha1, start + 40, 20);
+
+        strbuf_append(&repo->names, path, path_len);
+        strbuf_append_char(&repo->names, '\0');
+    }
+
+    return 0;
+}
+
+static void free_verified(GitRepo *repo) {
+    free(repo->verified);
+    repo->verified = NULL;
+    repo->verified_count = 0;
+}
+
+// drops the hashes in flight, running ones free their job when they return
+static void orphan_hashes(GitRepo *repo) {
+    HashJob *job = repo->hashing;
+    while (job != NULL) {
+        HashJob *next = job->next;
+
+        iosched_cancel(job->group);
+        iosched_release(job->group);
+
+        pthread_mutex_lock(&lock);
+        job->orphaned = true;
+        bool done = job->done;
+        pthread_mutex_unlock(&lock);
+        if (done) free(job);
+
+        job = next;
+    }
+
+    repo->hashing = NULL;
+    repo->hashing_count = 0;
+}
+
+static void add_verified(GitRepo *repo, const char *rel, size_t size, struct timespec mtime, bool clean) {
+    repo->verified = realloc(repo->verified, (repo->verified_count + 1) * sizeof(Verified));
+    NON_NULL(repo->verified);
+    repo->verified[repo->verified_count++] = (Verified) {
+        .path  = arena_strdup(&repo->strings, rel),
+        .mtime = mtime,
+        .size  = size,
+        .clean = clean,
+    };
+}
+
+// moves the hashes that are done into `verified`. returns true if there were
+static bool collect_hashes(GitRepo *repo) {
+    bool landed = false;
+
+    HashJob **link = &repo->hashing;
+    while (*link != NULL) {
+        HashJob *job = *link;
+
+        pthread_mutex_lock(&lock);
+        bool done = job->done;
+        pthread_mutex_unlock(&lock);
+
+        if (!done) {
+            link = &job->next;
+            continue;
+        }
+
+        *link = job->next;
+        repo->hashing_count--;
+        add_verified(repo, job->rel, job->size, job->mtime, job->clean);
+        iosched_release(job->group);
+        free(job);
+        landed = true;
+    }
+
+    return landed;
+}
+
+static void free_ignores(GitRepo *repo) {
+    for (size_t i=0; i < repo->ignore_count; ++i) {
+        free(repo->ignores[i].rules);
+    }
+    free(repo->ignores);
+    repo->ignores = NULL;
+    repo->ignore_count = 0;
+}
+
+// rereads the index if it changed since the last call, and takes the files
+// hashed meanwhile. returns true if either happened, which makes earlier
+// results stale
+bool git_refresh(GitRepo *repo) {
+
+    char path[PATH_MAX + 8] = { 0 };
+    snprintf(path, ARRAY_LEN(path), "%s/index", repo->gitdir);
+
+    struct stat statbuf = { 0 };
+    if (stat(path, &statbuf) == -1) {
+        // a fresh repository has no index yet
+        statbuf.st_size = 0;
+        statbuf.st_mtim = (struct timespec) { 0 };
+    }
+
+    bool same = statbuf.st_size == repo->index_size
+        && statbuf.st_mtim.tv_sec == repo->index_mtime.tv_sec
+        && statbuf.st_mtim.tv_nsec == repo->index_mtime.tv_nsec;
+
+    if (same && repo->generation != 0) {
+        if (!collect_hashes(repo)) return false;
+        repo->generation++;
+        return true;
+    }
+
+    repo->index_size = statbuf.st_size;
+    repo->index_mtime = statbuf.st_mtim;
+    repo->generation++;
+    repo->count = 0;
+
+    // .gitignore files may have changed along with the index
+    orphan_hashes(repo);
+    free_verified(repo);
+    free_ignores(repo);
+    arena_reset(&repo->strings);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || statbuf.st_size == 0) {
+        if (fd != -1) close(fd);
+        return true;
+    }
+
+    void *map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return true;
+
+    if (parse_index(repo, map, statbuf.st_size) == -1)
+        repo->count = 0;
+
+    munmap(map, statbuf.st_size);
+    return true;
+}
+
+unsigned git_generation(const GitRepo *repo) {
+    return repo->generation;
+}
+
+// whether files are being hashed, for git_refresh() to take later
+bool git_busy(const GitRepo *repo) {
+    return repo->hashing != NULL;
+}
+
+// the directory of the repository containing the worktree at `root`, which
+// is either `.git` itself, or named in a `.git` file
+static bool find_gitdir(const char *root, char *gitdir, size_t size) {
+
+    char dotgit[PATH_MAX + 8] = { 0 };
+    snprintf(dotgit, ARRAY_LEN(dotgit), "%s/.git", strcmp(root, "/") ? root : "");
+
+    struct stat statbuf = { 0 };
+    if (stat(dotgit, &statbuf) == -1) return false;
+
+    if (S_ISDIR(statbuf.st_mode)) {
+        snprintf(gitdir, size, "%s", dotgit);
+        return true;
+    }
+
+    // worktrees and submodules: "gitdir: <path>"
+    FILE *f = fopen(dotgit, "r");
+    if (f == NULL) return false;
+
+    char line[PATH_MAX] = { 0 };
+    bool ok = fgets(line, ARRAY_LEN(line), f) != NULL && !strncmp(line, "gitdir: ", 8);
+    fclose(f);
+    if (!ok) return false;
+
+    line[strcspn(line, "\n")] = '\0';
+    const char *dir = line + 8;
+
+    if (*dir == '/')
+        snprintf(gitdir, size, "%s", dir);
+    else
+        snprintf(gitdir, size, "%s/%s", root, dir);
+    return true;
+}
+
+// the repository whose worktree contains the absolute path `path`, or NULL.
+// the reference returned is dropped with git_release()
+GitRepo *git_find(const char *path) {
+
+    // nothing inside of .git itself is tracked
+    size_t len = strlen(path);
+    size_t suffix = strlen("/.git");
+    if (strstr(path, "/.git/") != NULL || (len >= suffix && !strcmp(path + len - suffix, "/.git")))
+        return NULL;
+
+    char root[PATH_MAX] = { 0 };
+    char gitdir[PATH_MAX] = { 0 };
+    snprintf(root, ARRAY_LEN(root), "%s", path);
+
+    while (!find_gitdir(root, gitdir, ARRAY_LEN(gitdir))) {
+        char *slash = strrchr(root, '/');
+        if (slash == NULL || !strcmp(root, "/")) return NULL;
+        slash[slash == root] = '\0'; // keep the root
+    }
+
+    for (size_t i=0; i < REPO_CACHE; ++i) {
+        if (repos[i] != NULL && !strcmp(repos[i]->root, root)) {
+            repos[i]->refs++;
+            return repos[i];
+        }
+    }
+
+    // listings still holding the evicted one keep it alive
+    if (repos[repo_next] != NULL)
+        git_release(repos[repo_next]);
+
+    GitRepo *repo = calloc(1, sizeof(GitRepo));
+    NON_NULL(repo);
+    repo->refs = 2; // the cache and the caller
+    snprintf(repo->root, ARRAY_LEN(repo->root), "%s", root);
+    snprintf(repo->gitdir, ARRAY_LEN(repo->gitdir), "%s", gitdir);
+
+    repos[repo_next] = repo;
+    repo_next = (repo_next + 1) % REPO_CACHE;
+
+    git_refresh(repo);
+    return repo;
+}
+
+void git_release(GitRepo *repo) {
+    if (repo == NULL || --repo->refs > 0) return;
+
+    orphan_hashes(repo);
+    free_verified(repo);
+    free_ignores(repo);
+    arena_free(&repo->strings);
+    free(repo->entries);
+    strbuf_free(&repo->names);
+    free(repo);
+}
+
+
+
+// first index entry not before `path`
+static size_t lower_bound(const GitRepo *repo, const char *path) {
+    size_t lo = 0;
+    size_t hi = repo->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(entry_path(repo, &repo->entries[mid]), path) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static const IndexEntry *lookup(const GitRepo *repo, const char *path) {
+    size_t i = lower_bound(repo, path);
+    if (i < repo->count && !strcmp(entry_path(repo, &repo->entries[i]), path))
+        return &repo->entries[i];
+    return NULL;
+}
+
+// whether any file below the directory `path` is tracked
+static bool has_tracked(const GitRepo *repo, const char *path) {
+    char prefix[PATH_MAX + 1] = { 0 };
+    size_t len = snprintf(prefix, ARRAY_LEN(prefix), "%s/", path);
+
+    size_t i = lower_bound(repo, prefix);
+    return i < repo->count && !strncmp(entry_path(repo, &repo->entries[i]), prefix, len);
+}
+
+static void load_ignore_file(IgnoreFile *f, Arena *strings, const char *file) {
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL) return;
+
+    char line[PATH_MAX] = { 0 };
+    while (fgets(line, ARRAY_LEN(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        // trailing spaces are ignored, unless escaped
+        size_t len = strlen(line);
+        while (len > 0 && line[len - 1] == ' ' && (len < 2 || line[len - 2] != '\\'))
+            line[--len] = '\0';
+
+        if (len == 0 || line[0] == '#') continue;
+
+        IgnoreRule rule = { 0 };
+        char *p = line;
+
+        if (*p == '!') { rule.negate = true; p++; }
+        if (*p == '\\') p++;
+
+        len = strlen(p);
+        if (len > 0 && p[len - 1] == '/') {
+            rule.dir_only = true;
+            p[--len] = '\0';
+        }
+
+        // "**/x" matches x at any depth, like a pattern without slashes
+        while (!strncmp(p, "**/", 3)) p += 3;
+
+        rule.anchored = strchr(p, '/') != NULL;
+        if (*p == '/') p++;
+        if (*p == '\0') continue;
+
+        rule.pattern = arena_strdup(strings, p);
+
+        f->rules = realloc(f->rules, (f->count + 1) * sizeof(IgnoreRule));
+        NON_NULL(f->rules);
+        f->rules[f->count++] = rule;
+    }
+
+    fclose(fp);
+}
+
+// the rules of the .gitignore in `dir`, relative to the root. info/exclude
+// counts as part of the root's
+static const IgnoreFile *ignore_file(GitRepo *repo, const char *dir) {
+
+    for (size_t i=0; i < repo->ignore_count; ++i)
+        if (!strcmp(repo->ignores[i].dir, dir))
+            return &repo->ignores[i];
+
+    repo->ignores = realloc(repo->ignores, (repo->ignore_count + 1) * sizeof(IgnoreFile));
+    NON_NULL(repo->ignores);
+
+    IgnoreFile *f = &repo->ignores[repo->ignore_count++];
+    *f = (IgnoreFile) { .dir = arena_strdup(&repo->strings, dir) };
+
+    char file[PATH_MAX * 2] = { 0 };
+    if (*dir == '\0') {
+        snprintf(file, ARRAY_LEN(file), "%s/info/exclude", repo->gitdir);
+        load_ignore_file(f, &repo->strings, file);
+        snprintf(file, ARRAY_LEN(file), "%s/.gitignore", repo->root);
+    } else {
+        snprintf(file, ARRAY_LEN(file), "%s/%s/.gitignore", repo->root, dir);
+    }
+    load_ignore_file(f, &repo->strings, file);
+
+    return f;
+}
+
+// whether `rel` is ignored by the rules of its own directory and those above.
+// -1 if no rule matches
+static int match_rules(GitRepo *repo, const char *rel, bool is_dir) {
+    int result = -1;
+
+    char dir[PATH_MAX] = { 0 };
+    size_t dir_len = 0;
+
+    // from the root down, deeper rules take precedence
+    for (;;) {
+        snprintf(dir, ARRAY_LEN(dir), "%.*s", (int) dir_len, rel);
+
+        const IgnoreFile *f = ignore_file(repo, dir);
+        const char *sub = dir_len == 0 ? rel : rel + dir_len + 1;
+        const char *name = strrchr(sub, '/');
+        name = name != NULL ? name + 1 : sub;
+
+        for (size_t i=0; i < f->count; ++i) {
+            const IgnoreRule *r = &f->rules[i];
+            if (r->dir_only && !is_dir) continue;
+
+            bool match = r->anchored
+                ? fnmatch(r->pattern, sub, FNM_PATHNAME) == 0
+                : fnmatch(r->pattern, name, 0) == 0;
+
+            if (match) result = !r->negate;
+        }
+
+        const char *slash = strchr(sub, '/');
+        if (slash == NULL) break;
+        dir_len = slash - rel;
+    }
+
+    return result;
+}
+
+static bool ignored(GitRepo *repo, const char *rel, bool is_dir) {
+
+    // everything below an ignored directory is ignored
+    char parent[PATH_MAX] = { 0 };
+    for (const char *s = strchr(rel, '/'); s != NULL; s = strchr(s + 1, '/')) {
+        snprintf(parent, ARRAY_LEN(parent), "%.*s", (int) (s - rel), rel);
+        if (match_rules(repo, parent, true) == 1) return true;
+    }
+
+    return match_rules(repo, rel, is_dir) == 1;
+}
+
+
+
+// the object name of `path` as a blob, "blob <size>\0<content>". returns -1
+// if it could not be read, or the group of the task was cancelled
+static int hash_blob(IoGroup *group, const char *path, size_t size, unsigned char digest[20]) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    Sha1 sha = { 0 };
+    sha1_init(&sha);
+
+    char header[32] = { 0 };
+    int n = snprintf(header, ARRAY_LEN(header), "blob %zu", size);
+    sha1_update(&sha, header, n + 1);
+
+    char *buf = malloc(HASH_CHUNK);
+    NON_NULL(buf);
+
+    ssize_t len = 0;
+    size_t total = 0;
+    while (!iosched_cancelled(group) && (len = read(fd, buf, HASH_CHUNK)) > 0) {
+        sha1_update(&sha, buf, len);
+        total += len;
+    }
+
+    free(buf);
+    close(fd);
+
+    if (len == -1 || total != size) return -1;
+    sha1_final(&sha, digest);
+    return 0;
+}
+
+static void run_hash(void *arg) {
+    HashJob *job = arg;
+
+    unsigned char digest[20];
+    bool clean = hash_blob(job->group, job->path, job->size, digest) == 0
+        && !memcmp(digest, job->sha1, 20);
+
+    pthread_mutex_lock(&lock);
+    job->done = true;
+    job->clean = clean;
+    bool orphaned = job->orphaned;
+    pthread_mutex_unlock(&lock);
+
+    if (orphaned) free(job);
+}
+
+// whether the content of `path` matches the index. files are hashed as
+// preview tasks, and are GIT_UNKNOWN until git_refresh() took the result
+static GitState verify(GitRepo *repo, const IndexEntry *e, const char *path, size_t size, struct timespec mtime, dev_t dev) {
+
+    const char *rel = entry_path(repo, e);
+
+    for (size_t i=0; i < repo->verified_count; ++i) {
+        const Verified *v = &repo->verified[i];
+        bool same = !strcmp(v->path, rel)
+            && v->size == size
+            && v->mtime.tv_sec == mtime.tv_sec
+            && v->mtime.tv_nsec == mtime.tv_nsec;
+
+        if (same) return v->clean ? GIT_CLEAN : GIT_MODIFIED;
+    }
+
+    for (const HashJob *job = repo->hashing; job != NULL; job = job->next) {
+        bool same = !strcmp(job->rel, rel)
+            && job->size == size
+            && job->mtime.tv_sec == mtime.tv_sec
+            && job->mtime.tv_nsec == mtime.tv_nsec;
+
+        if (same) return GIT_UNKNOWN;
+    }
+
+    // tried again once one of them is done
+    if (repo->hashing_count == HASH_QUEUE) return GIT_UNKNOWN;
+
+    HashJob *job = malloc(sizeof(HashJob));
+    NON_NULL(job);
+
+    *job = (HashJob) {
+        .group = iosched_group(IO_PREVIEW),
+        .size  = size,
+        .mtime = mtime,
+        .next  = repo->hashing,
+    };
+    snprintf(job->path, ARRAY_LEN(job->path), "%s", path);
+    job->rel = job->path + strlen(job->path) - strlen(rel);
+    memcpy(job->sha1, e->sha1, 20);
+
+    repo->hashing = job;
+    repo->hashing_count++;
+    iosched_submit(job->group, dev, run_hash, job);
+
+    return GIT_UNKNOWN;
+}
+
+// the status of the file or directory at the absolute `path`, described by
+// the metadata of its listing
+GitState git_status(
+    GitRepo *repo,
+    const char *path,
+    bool is_dir,
+    size_t size,
+    unsigned int mode,
+    struct timespec mtime,
+    dev_t dev,
+    ino_t ino
+) {
+    size_t root_len = strlen(repo->root);
+    if (strncmp(path, repo->root, root_len) || path[root_len] != '/')
+        return GIT_UNKNOWN;
+
+    const char *rel = path + root_len + 1;
+    if (!strcmp(rel, ".git")) return GIT_IGNORED;
+
+    if (is_dir) {
+        // submodules are tracked as gitlinks, their content is not ours
+        const IndexEntry *e = lookup(repo, rel);
+        if (e != NULL && (e->mode & S_IFMT) == GITLINK) return GIT_CLEAN;
+
+        if (has_tracked(repo, rel)) return GIT_CLEAN;
+        return ignored(repo, rel, true) ? GIT_IGNORED : GIT_UNTRACKED;
+    }
+
+    const IndexEntry *e = lookup(repo, rel);
+    if (e == NULL)
+        return ignored(repo, rel, false) ? GIT_IGNORED : GIT_UNTRACKED;
+
+    if (e->stage != 0) return GIT_MODIFIED; // a conflict
+
+    // a different type or executable bit is a change by itself
+    bool same_mode = (e->mode & S_IFMT) == (mode & S_IFMT)
+        && (!S_ISREG(mode) || (e->mode & 0100) == (mode & 0100));
+    if (!same_mode || e->size != (uint32_t) size) return GIT_MODIFIED;
+
+    bool same_stat = e->mtime_s == (uint32_t) mtime.tv_sec
+        && e->mtime_ns == (uint32_t) mtime.tv_nsec
+        && (e->ino == 0 || e->ino == (uint32_t) ino);
+
+    // files changed in the same second as the index may have changed again
+    // after it was written, without their stat data telling (racy git)
+    bool racy = mtime.tv_sec >= repo->index_mtime.tv_sec;
+
+    if (same_stat && !racy) return GIT_CLEAN;
+    if (!S_ISREG(mode)) return GIT_MODIFIED;
+
+    return verify(repo, e, path, size, mtime, dev);
+}
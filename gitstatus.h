@@ -0,0 +1,43 @@
+#ifndef _GITSTATUS_H
+#define _GITSTATUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+// status of files in git worktrees, without running git. the index
+// (.git/index, versions 2 to 4) is parsed directly, and its cached stat data
+// compared with the metadata of the listing. files are only hashed if that
+// does not match (or can't be trusted, as they changed in the same second as
+// the index), on worker threads, and those results are remembered.
+// repositories are cached, their index is reread once its mtime changes.
+//
+// only the worktree is compared with the index, staged changes don't show.
+// .gitignore files and info/exclude are supported with plain globs
+
+
+
+typedef enum {
+    GIT_UNKNOWN, // not in a repository, or still being hashed
+    GIT_CLEAN,
+    GIT_MODIFIED,
+    GIT_UNTRACKED,
+    GIT_IGNORED,
+} GitState;
+
+typedef struct GitRepo GitRepo;
+
+
+GitRepo *git_find       (const char *path);
+void     git_release    (GitRepo *repo);
+bool     git_refresh    (GitRepo *repo);
+unsigned git_generation (const GitRepo *repo);
+bool     git_busy       (const GitRepo *repo);
+GitState git_status     (GitRepo *repo, const char *path, bool is_dir, size_t size,
+                         unsigned int mode, struct timespec mtime, dev_t dev, ino_t ino);
+
+
+
+#endif // _GITSTATUS_H
@@ -0,0 +1,297 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "iosched.h"
+#include "arena.h"
+#include "util.h"
+
+
+
+typedef struct Task {
+    TaskFn fn;
+    void *arg;
+    IoGroup *group;
+    struct Task *next;
+} Task;
+
+typedef struct {
+    Task *head;
+    Task *tail;
+} Queue;
+
+typedef struct {
+    dev_t dev;
+    size_t limit;
+    size_t running;
+    Queue queues[IO_PRIORITIES];
+} Device;
+
+struct IoGroup {
+    IoPriority priority;
+    size_t pending;  // queued or running
+    bool cancelled;
+    bool released;
+};
+
+// everything below is guarded by `lock`
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;     // for the workers
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER; // a group is done
+static pthread_once_t workers_once = PTHREAD_ONCE_INIT;
+
+static Device *devices = NULL;
+static size_t device_count = 0;
+static size_t device_cap = 0;
+static size_t next_device = 0; // where the search for a task starts, in turns
+
+static Queue cancelled_tasks;  // of cancelled groups, run before anything
+static size_t busy = 0;        // workers running a task
+static size_t holds = 0;
+static IoStats stats = { 0 };
+static Pool tasks = POOL_INIT(Task);
+
+static void push(Queue *q, Task *t) {
+    t->next = NULL;
+    if (q->tail != NULL) q->tail->next = t;
+    else                 q->head = t;
+    q->tail = t;
+}
+
+static Task *pop(Queue *q) {
+    Task *t = q->head;
+    if (t == NULL) return NULL;
+
+    q->head = t->next;
+    if (q->head == NULL) q->tail = NULL;
+    return t;
+}
+
+static Device *find_device(dev_t dev) {
+
+    for (size_t i=0; i < device_count; ++i)
+        if (devices[i].dev == dev) return &devices[i];
+
+    if (device_count == device_cap) {
+        device_cap = device_cap ? device_cap * 2 : 8;
+        devices = realloc(devices, device_cap * sizeof(Device));
+        NON_NULL(devices);
+    }
+
+    Device *d = &devices[device_count++];
+    *d = (Device) { .dev = dev, .limit = IOSCHED_DEVICE_LIMIT };
+    stats.devices = device_count;
+    return d;
+}
+
+static bool is_background(IoPriority priority) {
+    return priority >= IO_PREFETCH;
+}
+
+// whether `d` may start a task of `priority` now. workers stuck on a hung
+// device count as busy: the last reserved ones are left to devices with
+// nothing running, and background tasks leave as many again to the others
+static bool has_room(const Device *d, IoPriority priority) {
+    size_t idle = IOSCHED_THREADS - busy;
+
+    if (!is_background(priority))
+        return d->running < d->limit && (d->running == 0 || idle > IOSCHED_RESERVED);
+
+    // a device limited to a single task still gets to run it
+    size_t limit = d->limit > IOSCHED_RESERVED ? d->limit - IOSCHED_RESERVED : 1;
+    return holds == 0
+        && d->running < limit
+        && idle > 2 * IOSCHED_RESERVED;
+}
+
+// the next task to run, NULL if none may start. `*device` is where it runs
+static Task *next_task(Device **device) {
+
+    Task *t = pop(&cancelled_tasks);
+    if (t != NULL) {
+        *device = NULL;
+        return t;
+    }
+
+    for (int p=0; p < IO_PRIORITIES; ++p) {
+        for (size_t n=0; n < device_count; ++n) {
+            size_t i = (next_device + n) % device_count;
+            Device *d = &devices[i];
+
+            if (d->queues[p].head == NULL || !has_room(d, p)) continue;
+
+            // the next search starts at the device after this one
+            next_device = i + 1;
+            *device = d;
+            return pop(&d->queues[p]);
+        }
+    }
+
+    return NULL;
+}
+
+// once a group is released and done with, nothing refers to it
+static void finish_task(IoGroup *g) {
+    if (--g->pending > 0) return;
+
+    pthread_cond_broadcast(&finished);
+    if (g->released) free(g);
+}
+
+static void *worker(void *arg) {
+    DISCARD(arg);
+
+    pthread_mutex_lock(&lock);
+
+    while (true) {
+        Device *d = NULL;
+        Task *t = NULL;
+
+        while ((t = next_task(&d)) == NULL)
+            pthread_cond_wait(&work, &lock);
+
+        // devices move while the table grows, find it again afterwards
+        IoPriority priority = t->group->priority;
+        dev_t dev = d != NULL ? d->dev : 0;
+
+        stats.queued[priority]--;
+        stats.running[priority]++;
+        if (d != NULL) d->running++;
+        busy++;
+
+        pthread_mutex_unlock(&lock);
+        t->fn(t->arg);
+        pthread_mutex_lock(&lock);
+
+        if (d != NULL) find_device(dev)->running--;
+        busy--;
+        stats.running[priority]--;
+
+        finish_task(t->group);
+        pool_put(&tasks, t);
+
+        // a slot became free
+        pthread_cond_signal(&work);
+    }
+
+    return NULL;
+}
+
+static void start_workers(void) {
+    for (size_t i=0; i < IOSCHED_THREADS; ++i) {
+        pthread_t thread;
+        MUST_ZERO(pthread_create(&thread, NULL, worker, NULL));
+        pthread_detach(thread);
+    }
+}
+
+IoGroup *iosched_group(IoPriority priority) {
+    pthread_once(&workers_once, start_workers);
+
+    IoGroup *g = calloc(1, sizeof(IoGroup));
+    NON_NULL(g);
+    g->priority = priority;
+    return g;
+}
+
+// queues `fn(arg)` to run on `dev`. tasks may submit more tasks
+void iosched_submit(IoGroup *g, dev_t dev, TaskFn fn, void *arg) {
+
+    pthread_mutex_lock(&lock);
+
+    Task *t = pool_get(&tasks);
+    *t = (Task) { .fn = fn, .arg = arg, .group = g };
+    g->pending++;
+    stats.queued[g->priority]++;
+
+    if (g->cancelled) push(&cancelled_tasks, t);
+    else              push(&find_device(dev)->queues[g->priority], t);
+
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+}
+
+// blocks until every task of `g` ran, including the ones they submitted
+void iosched_wait(IoGroup *g) {
+    pthread_mutex_lock(&lock);
+    while (g->pending > 0)
+        pthread_cond_wait(&finished, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+// moves the queued tasks of `g` ahead of everything else, for them to see
+// iosched_cancelled() and clean up. running ones are left to check it
+void iosched_cancel(IoGroup *g) {
+
+    pthread_mutex_lock(&lock);
+
+    if (!g->cancelled) {
+        g->cancelled = true;
+
+        for (size_t i=0; i < device_count; ++i) {
+            Queue *q = &devices[i].queues[g->priority];
+            Queue keep = { 0 };
+
+            Task *t = NULL;
+            while ((t = pop(q)) != NULL)
+                push(t->group == g ? &cancelled_tasks : &keep, t);
+            *q = keep;
+        }
+
+        pthread_cond_broadcast(&work);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+bool iosched_cancelled(IoGroup *g) {
+    pthread_mutex_lock(&lock);
+    bool c = g->cancelled;
+    pthread_mutex_unlock(&lock);
+    return c;
+}
+
+// frees `g` once its last task ran, without waiting for it
+void iosched_release(IoGroup *g) {
+    pthread_mutex_lock(&lock);
+    g->released = true;
+    if (g->pending == 0) free(g);
+    pthread_mutex_unlock(&lock);
+}
+
+// at most `limit` tasks run on `dev` at once, eg: 1 for a spinning disk
+void iosched_set_limit(dev_t dev, size_t limit) {
+    pthread_mutex_lock(&lock);
+    find_device(dev)->limit = limit > 0 ? limit : 1;
+    pthread_cond_broadcast(&work);
+    pthread_mutex_unlock(&lock);
+}
+
+// the main thread is about to do (or is done with) filesystem work the user
+// waits for. no prefetch or bulk task starts in between, on any device: what
+// the main thread reads is not known to be on another one
+void iosched_hold(bool hold) {
+    pthread_mutex_lock(&lock);
+    if (hold) holds++;
+    else      holds--;
+    if (holds == 0) pthread_cond_broadcast(&work);
+    pthread_mutex_unlock(&lock);
+}
+
+IoStats iosched_stats(void) {
+    pthread_mutex_lock(&lock);
+    IoStats s = stats;
+    pthread_mutex_unlock(&lock);
+    return s;
+}
+
+const char *iosched_priority_name(IoPriority priority) {
+    static const char *names[IO_PRIORITIES] = {
+        [IO_FOREGROUND] = "fg",
+        [IO_PREVIEW]    = "view",
+        [IO_PREFETCH]   = "pre",
+        [IO_BULK]       = "bulk",
+    };
+    return names[priority];
+}
@@ -0,0 +1,66 @@
+#ifndef _IOSCHED_H
+#define _IOSCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+// one set of worker threads for all background filesystem work, queued per
+// device (`st_dev`) so that a slow disk can not take the workers away from a
+// fast one. every device runs at most its limit of tasks at once, taken in
+// order of priority, and first come first served within one.
+//
+// tasks of the lower priorities (prefetch and bulk) never take the last
+// IOSCHED_RESERVED slots of a device, or of the workers, so there is always
+// room for a listing or a preview. they also wait while the main thread
+// lists a directory itself, see iosched_hold(). the last IOSCHED_RESERVED
+// workers go to devices with nothing running, so that a few hung devices
+// can not take them all.
+//
+// tasks are submitted into a group, which is waited for or cancelled as a
+// whole. cancelling a group runs its queued tasks right away, ahead of
+// everything else: tasks check iosched_cancelled() and only clean up.
+// the workers are never stopped, as they may be stuck in the kernel on a
+// hung filesystem
+
+
+
+#define IOSCHED_THREADS      8
+#define IOSCHED_DEVICE_LIMIT 4
+#define IOSCHED_RESERVED     1
+
+typedef enum {
+    IO_FOREGROUND, // the listing on screen
+    IO_PREVIEW,    // content of files on screen
+    IO_PREFETCH,   // what may be needed later, eg: the path index
+    IO_BULK,       // walks and hashes of whole trees, attribute changes
+} IoPriority;
+
+#define IO_PRIORITIES 4
+
+typedef void (*TaskFn)(void *arg);
+
+typedef struct IoGroup IoGroup;
+
+typedef struct {
+    size_t queued[IO_PRIORITIES];
+    size_t running[IO_PRIORITIES];
+    size_t devices;
+} IoStats;
+
+
+IoGroup *iosched_group     (IoPriority priority);
+void     iosched_submit    (IoGroup *g, dev_t dev, TaskFn fn, void *arg);
+void     iosched_wait      (IoGroup *g);
+void     iosched_cancel    (IoGroup *g);
+bool     iosched_cancelled (IoGroup *g);
+void     iosched_release   (IoGroup *g);
+void     iosched_set_limit (dev_t dev, size_t limit);
+void     iosched_hold      (bool hold);
+IoStats  iosched_stats     (void);
+const char *iosched_priority_name (IoPriority priority);
+
+
+
+#endif // _IOSCHED_H
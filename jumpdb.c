@@ -0,0 +1,472 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jumpdb.h"
+#include "util.h"
+
+
+
+#define JUMPDB_MAGIC       "FMJ1"
+#define JUMPDB_HEADER      4
+#define JUMPDB_RECORD      12 // time, count, len
+// files smaller than this are never compacted
+#define JUMPDB_COMPACT_MIN (64 * 1024)
+
+static size_t record_size(size_t len) {
+    return (JUMPDB_RECORD + len + 1 + 3) & ~(size_t) 3;
+}
+
+// case folding, and the bit of every character in masks. a path can only
+// match a query if it has all of the bits of the query
+static unsigned char fold[256];
+static unsigned char mask_bit[256];
+
+static void init_tables(void) {
+    for (int c=0; c < 256; ++c) {
+        fold[c] = tolower(c);
+
+        // digits, letters, and everything else folded into the rest
+        mask_bit[c] = isdigit(fold[c]) ? fold[c] - '0'
+                    : islower(fold[c]) ? 10 + fold[c] - 'a'
+                    : 36 + fold[c] % 28;
+    }
+}
+
+static uint64_t char_mask(const char *s, size_t len) {
+    uint64_t mask = 0;
+    for (size_t i=0; i < len; ++i)
+        mask |= (uint64_t) 1 << mask_bit[(unsigned char) s[i]];
+    return mask;
+}
+
+static size_t hash_path(const char *path, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i=0; i < len; ++i) {
+        h ^= (unsigned char) path[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static const char *entry_path(const JumpDb *db, const JumpEntry *e) {
+    return db->map + e->offset;
+}
+
+static size_t probe(const JumpDb *db, const char *path, size_t len) {
+    size_t mask = db->slot_count - 1;
+    size_t slot = hash_path(path, len) & mask;
+
+    while (db->slots[slot] != 0) {
+        const JumpEntry *e = &db->entries[db->slots[slot] - 1];
+        if (e->len == len && !memcmp(entry_path(db, e), path, len))
+            break;
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+static void rehash(JumpDb *db, size_t slot_count) {
+    free(db->slots);
+    db->slots = calloc(slot_count, sizeof(uint32_t));
+    NON_NULL(db->slots);
+    db->slot_count = slot_count;
+
+    for (size_t i=0; i < db->size; ++i) {
+        const JumpEntry *e = &db->entries[i];
+        db->slots[probe(db, entry_path(db, e), e->len)] = i + 1;
+    }
+}
+
+static void index_record(JumpDb *db, uint32_t offset, uint32_t len, uint32_t count, uint32_t time) {
+
+    // keep the load factor below 1/2
+    if ((db->size + 1) * 2 > db->slot_count)
+        rehash(db, db->slot_count ? db->slot_count * 2 : 1024);
+
+    const char *path = db->map + offset;
+    size_t slot = probe(db, path, len);
+
+    if (db->slots[slot] != 0) {
+        JumpEntry *e = &db->entries[db->slots[slot] - 1];
+        e->count += count;
+        if (time > e->last) e->last = time;
+        return;
+    }
+
+    if (db->size == db->capacity) {
+        db->capacity = db->capacity ? db->capacity * 2 : 1024;
+        db->entries = realloc(db->entries, db->capacity * sizeof(JumpEntry));
+        NON_NULL(db->entries);
+    }
+
+    // the last component, ignoring a trailing slash
+    uint32_t base = len;
+    while (base > 0 && path[base - 1] != '/') base--;
+    if (base == len) base = 0;
+
+    db->entries[db->size] = (JumpEntry) {
+        .offset = offset,
+        .len    = len,
+        .base   = base,
+        .count  = count,
+        .last   = time,
+        .mask   = char_mask(path, len),
+    };
+    db->slots[slot] = ++db->size;
+}
+
+// indexes the records appended since the last call. stops at a record that
+// is not complete yet
+static void parse(JumpDb *db) {
+
+    while (db->parsed + JUMPDB_RECORD <= db->map_size) {
+        uint32_t header[3] = { 0 };
+        memcpy(header, db->map + db->parsed, sizeof(header));
+
+        uint32_t len = header[2];
+        size_t size = record_size(len);
+
+        if (len == 0 || len >= PATH_MAX || db->parsed + size > db->map_size)
+            break;
+
+        uint32_t offset = db->parsed + JUMPDB_RECORD;
+        if (db->map[offset + len] != '\0')
+            break;
+
+        index_record(db, offset, len, header[1], header[0]);
+        db->parsed += size;
+        db->records++;
+    }
+}
+
+static void unmap(JumpDb *db) {
+    if (db->map != NULL)
+        munmap((void*) db->map, db->map_size);
+    db->map = NULL;
+    db->map_size = 0;
+}
+
+static void reset_index(JumpDb *db) {
+    db->size = 0;
+    db->records = 0;
+    db->parsed = JUMPDB_HEADER;
+    db->indexed = SIZE_MAX; // the candidates refer to the old entries
+    if (db->slots != NULL)
+        memset(db->slots, 0, db->slot_count * sizeof(uint32_t));
+}
+
+// maps the whole file behind `db->fd`. offsets stay valid if it only grew,
+// the index is reset if it was replaced by a compaction
+static int remap(JumpDb *db) {
+    struct stat statbuf = { 0 };
+    if (fstat(db->fd, &statbuf) == -1) return -1;
+
+    if (statbuf.st_ino == db->ino && (size_t) statbuf.st_size == db->map_size)
+        return 0;
+
+    if (statbuf.st_ino != db->ino)
+        reset_index(db);
+
+    unmap(db);
+    db->ino = statbuf.st_ino;
+
+    if (statbuf.st_size < JUMPDB_HEADER) return -1;
+
+    void *map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, db->fd, 0);
+    if (map == MAP_FAILED) return -1;
+
+    db->map = map;
+    db->map_size = statbuf.st_size;
+
+    if (memcmp(db->map, JUMPDB_MAGIC, JUMPDB_HEADER)) {
+        unmap(db);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+// opens the file at `db->file`, writing the header if it is new
+static int open_file(JumpDb *db) {
+    int fd = open(db->file, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd == -1) return -1;
+
+    flock(fd, LOCK_EX);
+
+    struct stat statbuf = { 0 };
+    if (fstat(fd, &statbuf) == 0 && statbuf.st_size == 0)
+        DISCARD(write(fd, JUMPDB_MAGIC, JUMPDB_HEADER));
+
+    flock(fd, LOCK_UN);
+
+    if (db->fd != -1)
+        close(db->fd);
+    db->fd = fd;
+    return 0;
+}
+
+// the file may have been replaced by a compaction since it was opened
+static bool is_current(const JumpDb *db) {
+    struct stat a = { 0 };
+    struct stat b = { 0 };
+    return fstat(db->fd, &a) == 0 && stat(db->file, &b) == 0 && a.st_ino == b.st_ino;
+}
+
+static void mkdirs(char *path) {
+    for (char *p = path + 1; *p != '\0'; ++p) {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(path, 0700);
+        *p = '/';
+    }
+}
+
+// opens the database at `file`, or at $XDG_DATA_HOME/fm/jumps if it is NULL.
+// only maps the file, so its size does not matter.
+// returns -1 if it could not be opened or is no jump database
+int jumpdb_open(JumpDb *db, const char *file) {
+    *db = (JumpDb) { .fd = -1, .parsed = JUMPDB_HEADER };
+    init_tables();
+
+    if (file != NULL) {
+        snprintf(db->file, ARRAY_LEN(db->file), "%s", file);
+
+    } else {
+        const char *data = getenv("XDG_DATA_HOME");
+        const char *home = getenv("HOME");
+
+        if (data != NULL && *data != '\0')
+            snprintf(db->file, ARRAY_LEN(db->file), "%s/fm/jumps", data);
+        else if (home != NULL)
+            snprintf(db->file, ARRAY_LEN(db->file), "%s/.local/share/fm/jumps", home);
+        else
+            return -1;
+
+        mkdirs(db->file);
+    }
+
+    if (open_file(db) == -1 || remap(db) == -1) {
+        jumpdb_close(db);
+        return -1;
+    }
+
+    return 0;
+}
+
+void jumpdb_close(JumpDb *db) {
+    unmap(db);
+    if (db->fd != -1)
+        close(db->fd);
+
+    free(db->entries);
+    free(db->slots);
+    free(db->candidates);
+    *db = (JumpDb) { .fd = -1 };
+}
+
+// records a visit of `dir`, which should be an absolute path
+int jumpdb_visit(JumpDb *db, const char *dir) {
+    size_t len = strlen(dir);
+    if (len == 0 || len >= PATH_MAX) return -1;
+
+    char buf[JUMPDB_RECORD + PATH_MAX + 4] = { 0 };
+    uint32_t header[3] = { time(NULL), 1, len };
+    memcpy(buf, header, sizeof(header));
+    memcpy(buf + JUMPDB_RECORD, dir, len);
+
+    // appending to a file that was compacted away would lose the visit
+    while (1) {
+        flock(db->fd, LOCK_SH);
+        if (is_current(db)) break;
+
+        flock(db->fd, LOCK_UN);
+        if (open_file(db) == -1) return -1;
+    }
+
+    ssize_t n = write(db->fd, buf, record_size(len));
+    flock(db->fd, LOCK_UN);
+
+    return n == (ssize_t) record_size(len) ? 0 : -1;
+}
+
+// rewrites the file with one record per path
+static void compact(JumpDb *db) {
+
+    flock(db->fd, LOCK_EX);
+
+    // someone else was faster
+    if (!is_current(db) || remap(db) == -1) {
+        flock(db->fd, LOCK_UN);
+        return;
+    }
+    parse(db);
+
+    char tmp[PATH_MAX + 32] = { 0 };
+    snprintf(tmp, ARRAY_LEN(tmp), "%s.%d", db->file, (int) getpid());
+
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) {
+        flock(db->fd, LOCK_UN);
+        return;
+    }
+
+    fwrite(JUMPDB_MAGIC, 1, JUMPDB_HEADER, f);
+
+    for (size_t i=0; i < db->size; ++i) {
+        const JumpEntry *e = &db->entries[i];
+
+        char buf[JUMPDB_RECORD + PATH_MAX + 4] = { 0 };
+        uint32_t header[3] = { e->last, e->count, e->len };
+        memcpy(buf, header, sizeof(header));
+        memcpy(buf + JUMPDB_RECORD, entry_path(db, e), e->len);
+
+        fwrite(buf, 1, record_size(e->len), f);
+    }
+
+    bool ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+
+    if (!ok || rename(tmp, db->file) == -1)
+        unlink(tmp);
+
+    flock(db->fd, LOCK_UN);
+}
+
+// fresh paths weigh more than old ones
+static double frecency(const JumpEntry *e, uint32_t now) {
+    uint32_t age = now > e->last ? now - e->last : 0;
+
+    double weight = age < 60 * 60           ? 4.0
+                  : age < 24 * 60 * 60      ? 2.0
+                  : age < 7 * 24 * 60 * 60  ? 0.5
+                  : 0.25;
+    return e->count * weight;
+}
+
+// case-insensitive
+static bool is_subsequence(const char *s, const char *query) {
+    for (; *s != '\0' && *query != '\0'; ++s)
+        if (fold[(unsigned char) *s] == fold[(unsigned char) *query])
+            query++;
+    return *query == '\0';
+}
+
+static bool is_substring(const char *s, const char *query) {
+    for (; *s != '\0'; ++s) {
+        size_t i = 0;
+        while (query[i] != '\0' && fold[(unsigned char) s[i]] == fold[(unsigned char) query[i]])
+            i++;
+        if (query[i] == '\0') return true;
+    }
+    return false;
+}
+
+#define MAX_QUALITY 8.0
+#define UNDECIDED   -1.0
+
+// exact matches are worth more than fuzzy ones, matches in the last component
+// more than others. 0 if `path` does not match at all. only qualities above
+// `floor` are looked for, UNDECIDED if it has none of them
+static double match_quality(const char *path, size_t base, const char *query, double floor) {
+    if (*query == '\0') return 1.0;
+    if (floor >= MAX_QUALITY) return UNDECIDED;
+
+    const char *name = path + base;
+
+    if (floor >= 4.0)
+        return is_substring(name, query) ? MAX_QUALITY : UNDECIDED;
+
+    if (floor >= 2.0) {
+        if (is_substring(name, query)) return MAX_QUALITY;
+        return is_substring(path, query) ? 4.0 : UNDECIDED;
+    }
+
+    // cheapest checks first, most paths fail the first or the third
+    if (is_subsequence(name, query))
+        return is_substring(name, query) ? MAX_QUALITY : 2.0;
+
+    if (!is_subsequence(path, query)) return 0.0;
+    return is_substring(path, query) ? 4.0 : 1.0;
+}
+
+// writes the up to `max` best matches for `query` into `out`, best first.
+// picks up visits of other instances, returns the amount of matches
+size_t jumpdb_query(JumpDb *db, const char *query, JumpMatch *out, size_t max) {
+
+    if (!is_current(db))
+        open_file(db);
+
+    if (remap(db) == -1) return 0;
+    parse(db);
+
+    if (db->map_size > JUMPDB_COMPACT_MIN && db->records > db->size * 2) {
+        compact(db);
+        open_file(db);
+        if (remap(db) == -1) return 0;
+        parse(db);
+    }
+
+    // narrow down the last candidates if possible, start over otherwise
+    size_t qlen = strlen(query);
+    size_t last = strlen(db->last_query);
+    bool narrow = db->indexed == db->size && last <= qlen && !strncmp(db->last_query, query, last);
+
+    if (!narrow || db->candidates == NULL) {
+        db->candidates = realloc(db->candidates, (db->size + 1) * sizeof(uint32_t));
+        NON_NULL(db->candidates);
+        for (size_t i=0; i < db->size; ++i)
+            db->candidates[i] = i;
+        db->candidate_count = db->size;
+        db->indexed = db->size;
+    }
+    snprintf(db->last_query, ARRAY_LEN(db->last_query), "%s", query);
+
+    uint64_t qmask = char_mask(query, qlen);
+    uint32_t now = time(NULL);
+    size_t n = 0;
+    size_t kept = 0;
+
+    for (size_t c=0; c < db->candidate_count; ++c) {
+        const JumpEntry *e = &db->entries[db->candidates[c]];
+        if ((e->mask & qmask) != qmask) continue;
+
+        // matching is the expensive part, only look for matches good enough
+        // to make it into the results. undecided entries stay candidates
+        double weight = frecency(e, now);
+        double floor = n == max ? (max == 0 ? MAX_QUALITY : out[n - 1].score / weight) : 0.0;
+
+        const char *path = entry_path(db, e);
+        double quality = match_quality(path, e->base, query, floor);
+        if (quality == 0.0) continue;
+
+        db->candidates[kept++] = db->candidates[c];
+        if (quality == UNDECIDED) continue;
+
+        double score = weight * quality;
+        if (n == max && score <= out[n - 1].score) continue;
+
+        // insertion into the sorted top `max`
+        size_t j = n < max ? n++ : n - 1;
+        while (j > 0 && out[j - 1].score < score) {
+            out[j] = out[j - 1];
+            j--;
+        }
+        out[j] = (JumpMatch) { .path = path, .score = score };
+    }
+
+    db->candidate_count = kept;
+    return n;
+}
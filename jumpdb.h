@@ -0,0 +1,70 @@
+#ifndef _JUMPDB_H
+#define _JUMPDB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include <sys/types.h>
+
+// frecency database of visited directories, for jumping to them by a fuzzy
+// query. the file is a header followed by append-only records:
+//
+//   "FMJ1" | { u32 time, u32 count, u32 len, path, '\0', padding to 4 } ...
+//
+// every visit appends a record with a single O_APPEND write, so concurrent
+// fm instances can't interleave. records of the same path are summed up when
+// indexing. opening only maps the file; the index is built on the first
+// query and extended by whatever was appended since, on every later one.
+// once most records are redundant, the file is compacted into a new one,
+// under an exclusive flock, that appenders check for
+
+
+
+typedef struct {
+    uint32_t offset; // of the path in the map
+    uint32_t len;
+    uint32_t base;   // offset of the last component in the path
+    uint32_t count;
+    uint32_t last;   // time of the last visit
+    uint64_t mask;   // characters in the path, see char_mask()
+} JumpEntry;
+
+typedef struct {
+    const char *path; // valid until the next query
+    double score;
+} JumpMatch;
+
+typedef struct {
+    char file[PATH_MAX];
+    int fd;
+    ino_t ino;
+    const char *map;
+    size_t map_size;
+    size_t parsed; // bytes of the map which are indexed
+    size_t records;
+
+    JumpEntry *entries;
+    size_t size;
+    size_t capacity;
+    uint32_t *slots; // open-addressing index into `entries`, storing `index + 1`
+    size_t slot_count;
+
+    // entries that may match `last_query`. a query extending it can only
+    // match a subset of them, so typing narrows down instead of rescanning
+    uint32_t *candidates;
+    size_t candidate_count;
+    size_t indexed; // `size` when the candidates were collected
+    char last_query[NAME_MAX + 1];
+} JumpDb;
+
+
+int    jumpdb_open  (JumpDb *db, const char *file);
+void   jumpdb_close (JumpDb *db);
+int    jumpdb_visit (JumpDb *db, const char *dir);
+size_t jumpdb_query (JumpDb *db, const char *query, JumpMatch *out, size_t max);
+
+
+
+#endif // _JUMPDB_H
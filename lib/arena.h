@@ -0,0 +1,157 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+// memory for things that go away together.
+//
+// an Arena hands out memory by bumping a pointer, and takes it all back at
+// once with arena_reset(). the blocks are kept, and an arena that needed more
+// than one block is merged into a single one on reset, so after a few rounds
+// it settles at zero allocations.
+//
+// a Pool recycles objects of one size. objects come back from pool_get()
+// exactly as they were put, so they may keep buffers of their own.
+//
+// both count the heap allocations they make in `allocs`
+
+
+
+// every allocation is aligned for any type
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK (64 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *prev;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+// the header is padded, so that data starts aligned
+#define ARENA_HEADER ((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+typedef struct {
+    ArenaBlock *block; // the current block, earlier ones are chained to it
+    size_t allocs;
+} Arena;
+
+static inline
+ArenaBlock *arena_new_block(Arena *a, size_t size, ArenaBlock *prev) {
+    ArenaBlock *b = malloc(ARENA_HEADER + size);
+    NON_NULL(b);
+    *b = (ArenaBlock) { .prev = prev, .size = size };
+    a->allocs++;
+    return b;
+}
+
+static inline
+void *arena_alloc(Arena *a, size_t size) {
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    ArenaBlock *b = a->block;
+    if (b == NULL || b->used + size > b->size) {
+        size_t block = b != NULL ? b->size * 2 : ARENA_BLOCK;
+        a->block = b = arena_new_block(a, size > block ? size : block, b);
+    }
+
+    void *ptr = (char*) b + ARENA_HEADER + b->used;
+    b->used += size;
+    return ptr;
+}
+
+static inline
+char *arena_strdup(Arena *a, const char *str) {
+    size_t len = strlen(str);
+    char *copy = arena_alloc(a, len + 1);
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+// takes back everything allocated from `a`
+static inline
+void arena_reset(Arena *a) {
+    ArenaBlock *b = a->block;
+    if (b == NULL) return;
+
+    if (b->prev == NULL) {
+        b->used = 0;
+        return;
+    }
+
+    // one block large enough for all of them, next time
+    size_t total = 0;
+    while (b != NULL) {
+        ArenaBlock *prev = b->prev;
+        total += b->size;
+        free(b);
+        b = prev;
+    }
+
+    a->block = arena_new_block(a, total, NULL);
+}
+
+static inline
+void arena_free(Arena *a) {
+    ArenaBlock *b = a->block;
+    while (b != NULL) {
+        ArenaBlock *prev = b->prev;
+        free(b);
+        b = prev;
+    }
+    a->block = NULL;
+}
+
+typedef struct PoolItem {
+    struct PoolItem *next;
+} PoolItem;
+
+#define POOL_HEADER ((sizeof(PoolItem) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+typedef struct {
+    size_t size;    // of the objects
+    PoolItem *free; // objects put back
+    size_t allocs;
+} Pool;
+
+#define POOL_INIT(type) { .size = sizeof(type) }
+
+// a recycled object if there is one, otherwise a new one, zeroed
+static inline
+void *pool_get(Pool *p) {
+    PoolItem *item = p->free;
+
+    if (item != NULL) {
+        p->free = item->next;
+    } else {
+        item = calloc(1, POOL_HEADER + p->size);
+        NON_NULL(item);
+        p->allocs++;
+    }
+
+    return (char*) item + POOL_HEADER;
+}
+
+static inline
+void pool_put(Pool *p, void *obj) {
+    PoolItem *item = (PoolItem*) ((char*) obj - POOL_HEADER);
+    item->next = p->free;
+    p->free = item;
+}
+
+// frees the objects put back, the ones still out are the caller's
+static inline
+void pool_free(Pool *p) {
+    while (p->free != NULL) {
+        PoolItem *next = p->free->next;
+        free(p->free);
+        p->free = next;
+    }
+}
+
+
+
+#endif // _ARENA_H
@@ -0,0 +1,109 @@
+#ifndef _SHA1_H
+#define _SHA1_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// SHA-1, as used by git for object names. streaming:
+// sha1_init() -> sha1_update()... -> sha1_final()
+
+
+
+typedef struct {
+    uint32_t state[5];
+    uint64_t len;
+    unsigned char block[64];
+    size_t used;
+} Sha1;
+
+static inline
+uint32_t sha1_rotl(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline
+void sha1_compress(Sha1 *s, const unsigned char *p) {
+    uint32_t w[80];
+
+    for (int i=0; i < 16; ++i)
+        w[i] = (uint32_t) p[i*4] << 24 | (uint32_t) p[i*4 + 1] << 16
+             | (uint32_t) p[i*4 + 2] << 8 | (uint32_t) p[i*4 + 3];
+
+    for (int i=16; i < 80; ++i)
+        w[i] = sha1_rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+    uint32_t a = s->state[0], b = s->state[1], c = s->state[2];
+    uint32_t d = s->state[3], e = s->state[4];
+
+    for (int i=0; i < 80; ++i) {
+        uint32_t f, k;
+        if      (i < 20) { f = (b & c) | (~b & d);          k = 0x5a827999; }
+        else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ed9eba1; }
+        else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+        else             { f = b ^ c ^ d;                   k = 0xca62c1d6; }
+
+        uint32_t t = sha1_rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = sha1_rotl(b, 30);
+        b = a;
+        a = t;
+    }
+
+    s->state[0] += a;
+    s->state[1] += b;
+    s->state[2] += c;
+    s->state[3] += d;
+    s->state[4] += e;
+}
+
+static inline
+void sha1_init(Sha1 *s) {
+    *s = (Sha1) {
+        .state = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 },
+    };
+}
+
+static inline
+void sha1_update(Sha1 *s, const void *data, size_t len) {
+    const unsigned char *p = data;
+    s->len += len;
+
+    while (len > 0) {
+        size_t n = 64 - s->used < len ? 64 - s->used : len;
+        memcpy(s->block + s->used, p, n);
+        s->used += n;
+        p += n;
+        len -= n;
+
+        if (s->used == 64) {
+            sha1_compress(s, s->block);
+            s->used = 0;
+        }
+    }
+}
+
+static inline
+void sha1_final(Sha1 *s, unsigned char digest[20]) {
+    uint64_t bits = s->len * 8;
+
+    unsigned char pad = 0x80;
+    sha1_update(s, &pad, 1);
+
+    pad = 0;
+    while (s->used != 56)
+        sha1_update(s, &pad, 1);
+
+    unsigned char len[8];
+    for (int i=0; i < 8; ++i)
+        len[i] = bits >> (56 - i*8);
+    sha1_update(s, len, 8);
+
+    for (int i=0; i < 20; ++i)
+        digest[i] = s->state[i / 4] >> (24 - (i % 4) * 8);
+}
+
+
+
+#endif // _SHA1_H
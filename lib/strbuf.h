@@ -0,0 +1,69 @@
+#ifndef _STRBUF_H
+#define _STRBUF_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+// growable, nul-terminated string buffer. meant to be reused: clearing keeps
+// the allocation around, so repeated use settles at zero reallocations
+
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+static inline
+void strbuf_reserve(StrBuf *sb, size_t extra) {
+
+    NON_NULL(sb);
+
+    size_t needed = sb->len + extra + 1;
+    if (needed <= sb->cap) return;
+
+    size_t cap = sb->cap ? sb->cap : 64;
+    while (cap < needed)
+        cap *= 2;
+
+    sb->data = realloc(sb->data, cap);
+    NON_NULL(sb->data);
+    sb->cap = cap;
+}
+
+static inline
+void strbuf_clear(StrBuf *sb) {
+    sb->len = 0;
+    if (sb->data != NULL)
+        sb->data[0] = '\0';
+}
+
+static inline
+void strbuf_append(StrBuf *sb, const char *str, size_t len) {
+    strbuf_reserve(sb, len);
+    memcpy(sb->data + sb->len, str, len);
+    sb->len += len;
+    sb->data[sb->len] = '\0';
+}
+
+static inline
+void strbuf_append_str(StrBuf *sb, const char *str) {
+    strbuf_append(sb, str, strlen(str));
+}
+
+static inline
+void strbuf_append_char(StrBuf *sb, char c) {
+    strbuf_append(sb, &c, 1);
+}
+
+static inline
+void strbuf_free(StrBuf *sb) {
+    free(sb->data);
+    *sb = (StrBuf) { 0 };
+}
+
+
+
+#endif // _STRBUF_H
@@ -0,0 +1,19 @@
+#ifndef _TIMING_H
+#define _TIMING_H
+
+#include <stdint.h>
+#include <time.h>
+
+
+
+// monotonic timestamp in nanoseconds
+static inline
+uint64_t now_ns(void) {
+    struct timespec ts = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+
+#endif // _TIMING_H
@@ -38,16 +38,16 @@
 #endif // UTIL_COLORS
 
 
-#ifdef __STDC11
+#if __STDC11
 
 #define NORETURN noreturn
 #else
-#define NORETURN __attribute((noreturn))
+#define NORETURN __attribute__((__noreturn__))
 
 #endif // __STDC11
 
 
-noreturn static inline void _impl_panic(
+NORETURN static inline void _impl_panic(
     const char *file,
     const char *func,
     int line,
@@ -0,0 +1,82 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "links.h"
+#include "arena.h"
+#include "util.h"
+
+
+
+#define LINKS_MAX   (1 << 16)
+#define LINKS_SLOTS (LINKS_MAX * 2)
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    char *target; // NULL marks an empty slot
+} LinkSlot;
+
+static LinkSlot *slots = NULL;
+static Arena targets = { 0 }; // of every slot, reset on flush
+static size_t count = 0;
+static unsigned generation = 0;
+
+static size_t hash_inode(dev_t dev, ino_t ino) {
+    uint64_t h = (uint64_t) ino * 0x9e3779b97f4a7c15u ^ (uint64_t) dev;
+    return (h ^ (h >> 29)) & (LINKS_SLOTS - 1);
+}
+
+static void flush(void) {
+    for (size_t i=0; i < LINKS_SLOTS; ++i)
+        slots[i].target = NULL;
+    arena_reset(&targets);
+
+    count = 0;
+    generation++;
+}
+
+unsigned links_generation(void) {
+    return generation;
+}
+
+// heap allocations made for targets so far
+size_t links_allocs(void) {
+    return targets.allocs;
+}
+
+// returns the target of the symlink `name` in `dirfd`, which has the inode
+// `ino` on `dev`. only calls readlinkat() on a cache miss.
+// returns NULL if the link could not be read
+const char *links_target(dev_t dev, ino_t ino, int dirfd, const char *name) {
+
+    if (slots == NULL) {
+        slots = calloc(LINKS_SLOTS, sizeof(LinkSlot));
+        NON_NULL(slots);
+    }
+
+    size_t i = hash_inode(dev, ino);
+    for (; slots[i].target != NULL; i = (i + 1) & (LINKS_SLOTS - 1))
+        if (slots[i].dev == dev && slots[i].ino == ino)
+            return slots[i].target;
+
+    char buf[PATH_MAX] = { 0 };
+    ssize_t len = readlinkat(dirfd, name, buf, ARRAY_LEN(buf) - 1);
+    if (len == -1) return NULL;
+    buf[len] = '\0';
+
+    if (count == LINKS_MAX) {
+        flush();
+        i = hash_inode(dev, ino);
+    }
+
+    char *target = arena_strdup(&targets, buf);
+
+    slots[i] = (LinkSlot) { .dev = dev, .ino = ino, .target = target };
+    count++;
+    return target;
+}
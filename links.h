@@ -0,0 +1,28 @@
+#ifndef _LINKS_H
+#define _LINKS_H
+
+#include <sys/types.h>
+
+// cache of symlink targets by inode. the target of a symlink cannot change
+// without replacing the inode, so entries never go stale. when the cache
+// fills up, it is flushed as a whole and the generation is bumped: targets
+// returned before are only valid while links_generation() stays the same
+
+
+
+typedef enum {
+    LINK_UNRESOLVED,
+    LINK_OK,
+    LINK_BROKEN,
+    LINK_LOOP,
+    LINK_ERROR,
+} LinkStatus;
+
+
+const char *links_target     (dev_t dev, ino_t ino, int dirfd, const char *name);
+unsigned    links_generation (void);
+size_t      links_allocs     (void);
+
+
+
+#endif // _LINKS_H
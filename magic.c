@@ -0,0 +1,359 @@
+#define _GNU_SOURCE // O_NOATIME
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "magic.h"
+#include "iosched.h"
+#include "arena.h"
+#include "util.h"
+
+
+
+// a signature matches if `bytes` is found at `offset`, and the optional
+// second signature at `offset2` matches too
+typedef struct {
+    MagicType type;
+    size_t offset;
+    const char *bytes;
+    size_t len;
+    size_t offset2;
+    const char *bytes2;
+    size_t len2;
+} Signature;
+
+#define SIG(label, class, off, bytes) \
+    { { label, class }, off, bytes, sizeof(bytes) - 1, 0, NULL, 0 }
+
+#define SIG2(label, class, off, bytes, off2, bytes2) \
+    { { label, class }, off, bytes, sizeof(bytes) - 1, off2, bytes2, sizeof(bytes2) - 1 }
+
+static const Signature signatures[] = {
+    SIG ("elf",     MAGIC_EXEC,     0,   "\x7f" "ELF"),
+    SIG ("script",  MAGIC_EXEC,     0,   "#!"),
+    SIG ("wasm",    MAGIC_EXEC,     0,   "\0asm"),
+    SIG ("macho",   MAGIC_EXEC,     0,   "\xcf\xfa\xed\xfe"),
+    SIG ("macho",   MAGIC_EXEC,     0,   "\xfe\xed\xfa\xcf"),
+    SIG ("class",   MAGIC_EXEC,     0,   "\xca\xfe\xba\xbe"),
+    SIG ("pe",      MAGIC_EXEC,     0,   "MZ"),
+    SIG ("png",     MAGIC_IMAGE,    0,   "\x89PNG\r\n\x1a\n"),
+    SIG ("jpeg",    MAGIC_IMAGE,    0,   "\xff\xd8\xff"),
+    SIG ("gif",     MAGIC_IMAGE,    0,   "GIF87a"),
+    SIG ("gif",     MAGIC_IMAGE,    0,   "GIF89a"),
+    SIG ("tiff",    MAGIC_IMAGE,    0,   "II*\0"),
+    SIG ("tiff",    MAGIC_IMAGE,    0,   "MM\0*"),
+    SIG2("webp",    MAGIC_IMAGE,    0,   "RIFF", 8, "WEBP"),
+    SIG ("pdf",     MAGIC_DOCUMENT, 0,   "%PDF-"),
+    SIG ("sqlite",  MAGIC_DOCUMENT, 0,   "SQLite format 3\0"),
+    SIG ("zip",     MAGIC_ARCHIVE,  0,   "PK\x03\x04"),
+    SIG ("zip",     MAGIC_ARCHIVE,  0,   "PK\x05\x06"),
+    SIG ("gzip",    MAGIC_ARCHIVE,  0,   "\x1f\x8b"),
+    SIG ("bzip2",   MAGIC_ARCHIVE,  0,   "BZh"),
+    SIG ("xz",      MAGIC_ARCHIVE,  0,   "\xfd" "7zXZ\0"),
+    SIG ("zstd",    MAGIC_ARCHIVE,  0,   "\x28\xb5\x2f\xfd"),
+    SIG ("lz4",     MAGIC_ARCHIVE,  0,   "\x04\x22\x4d\x18"),
+    SIG ("7z",      MAGIC_ARCHIVE,  0,   "7z\xbc\xaf\x27\x1c"),
+    SIG ("rar",     MAGIC_ARCHIVE,  0,   "Rar!\x1a\x07"),
+    SIG ("tar",     MAGIC_ARCHIVE,  257, "ustar"),
+    SIG ("ogg",     MAGIC_MEDIA,    0,   "OggS"),
+    SIG ("flac",    MAGIC_MEDIA,    0,   "fLaC"),
+    SIG ("mp3",     MAGIC_MEDIA,    0,   "ID3"),
+    SIG ("mkv",     MAGIC_MEDIA,    0,   "\x1a\x45\xdf\xa3"),
+    SIG ("mp4",     MAGIC_MEDIA,    4,   "ftyp"),
+    SIG2("wav",     MAGIC_MEDIA,    0,   "RIFF", 8, "WAVE"),
+    SIG2("avi",     MAGIC_MEDIA,    0,   "RIFF", 8, "AVI "),
+};
+
+// fallbacks, for files matching no signature
+static const MagicType type_empty = { "empty", MAGIC_TEXT };
+static const MagicType type_text  = { "text",  MAGIC_TEXT };
+static const MagicType type_data  = { "data",  MAGIC_DATA };
+
+#define ID_EMPTY ((MagicId) (ARRAY_LEN(signatures) + 1))
+#define ID_TEXT  ((MagicId) (ARRAY_LEN(signatures) + 2))
+#define ID_DATA  ((MagicId) (ARRAY_LEN(signatures) + 3))
+
+const MagicType *magic_type(MagicId id) {
+    if (id == 0) return NULL;
+    if (id == ID_EMPTY) return &type_empty;
+    if (id == ID_TEXT)  return &type_text;
+    if (id == ID_DATA)  return &type_data;
+    return &signatures[id - 1].type;
+}
+
+static bool matches(const unsigned char *buf, size_t len, size_t offset, const char *bytes, size_t n) {
+    return offset + n <= len && !memcmp(buf + offset, bytes, n);
+}
+
+// text is anything without NUL bytes and with few control characters.
+// bytes >= 0x80 are accepted, as they are most likely UTF-8
+static bool looks_like_text(const unsigned char *buf, size_t len) {
+    size_t control = 0;
+
+    for (size_t i=0; i < len; ++i) {
+        unsigned char c = buf[i];
+        if (c == '\0') return false;
+        if (c < 0x20 && c != '\n' && c != '\r' && c != '\t' && c != '\f' && c != 0x1b)
+            control++;
+    }
+
+    return control * 32 <= len;
+}
+
+MagicId magic_classify(const unsigned char *buf, size_t len) {
+
+    if (len == 0) return ID_EMPTY;
+
+    for (size_t i=0; i < ARRAY_LEN(signatures); ++i) {
+        const Signature *sig = &signatures[i];
+
+        if (!matches(buf, len, sig->offset, sig->bytes, sig->len)) continue;
+        if (sig->bytes2 != NULL && !matches(buf, len, sig->offset2, sig->bytes2, sig->len2)) continue;
+
+        return i + 1;
+    }
+
+    return looks_like_text(buf, len) ? ID_TEXT : ID_DATA;
+}
+
+
+
+#define SNIFF_QUEUE   256 // sniffs queued or running at most
+#define CACHE_SLOTS   (1 << 16)
+#define CACHE_MAX     (CACHE_SLOTS / 2)
+
+typedef enum {
+    SLOT_EMPTY,
+    SLOT_QUEUED,
+    SLOT_DROPPED, // scrolled off screen while queued, requested again later
+    SLOT_RUNNING,
+    SLOT_DONE,
+} SlotState;
+
+typedef struct SniffJob SniffJob;
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime;
+    SlotState state;
+    MagicId id;
+    SniffJob *job; // while queued
+} CacheSlot;
+
+struct SniffJob {
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime;
+    IoGroup *group;   // of this job alone, so that it is dropped by itself
+    unsigned frame;   // of the last request for it
+    bool dropped;
+    SniffJob *prev;   // in `queued`, unless dropped
+    SniffJob *next;
+    char path[PATH_MAX];
+};
+
+// everything below is guarded by `lock`
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static CacheSlot *cache = NULL;
+static size_t cache_count = 0;
+
+static SniffJob *queued = NULL; // not started yet
+static unsigned frame = 0;      // requests since the last sweep
+static size_t pending = 0;      // sniffs queued or running
+static Pool jobs = POOL_INIT(SniffJob);
+
+static int64_t timespec_ns(struct timespec ts) {
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// returns the slot of the given inode, or the empty slot it belongs into
+static CacheSlot *cache_slot(dev_t dev, ino_t ino) {
+
+    if (cache == NULL) {
+        cache = calloc(CACHE_SLOTS, sizeof(CacheSlot));
+        NON_NULL(cache);
+    }
+
+    uint64_t h = (uint64_t) ino * 0x9e3779b97f4a7c15u ^ (uint64_t) dev;
+    size_t i = (h ^ (h >> 29)) & (CACHE_SLOTS - 1);
+
+    while (cache[i].state != SLOT_EMPTY && (cache[i].dev != dev || cache[i].ino != ino))
+        i = (i + 1) & (CACHE_SLOTS - 1);
+
+    return &cache[i];
+}
+
+static CacheSlot *cache_insert(dev_t dev, ino_t ino) {
+
+    CacheSlot *slot = cache_slot(dev, ino);
+    if (slot->state != SLOT_EMPTY) return slot;
+
+    // start over once full, queued and running sniffs reinsert their result
+    if (cache_count == CACHE_MAX) {
+        memset(cache, 0, CACHE_SLOTS * sizeof(CacheSlot));
+        cache_count = 0;
+        slot = cache_slot(dev, ino);
+    }
+
+    cache_count++;
+    *slot = (CacheSlot) { .dev = dev, .ino = ino };
+    return slot;
+}
+
+static void unlink_job(SniffJob *job) {
+    if (job->prev != NULL) job->prev->next = job->next;
+    else                   queued = job->next;
+    if (job->next != NULL) job->next->prev = job->prev;
+}
+
+static MagicId sniff(const char *path) {
+
+    int fd = open(path, O_RDONLY | O_NOATIME | O_NONBLOCK | O_CLOEXEC);
+
+    // O_NOATIME is only allowed on files we own
+    if (fd == -1 && errno == EPERM)
+        fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd == -1) return ID_DATA;
+
+    unsigned char buf[MAGIC_BYTES];
+    ssize_t len = pread(fd, buf, ARRAY_LEN(buf), 0);
+    close(fd);
+
+    return magic_classify(buf, len > 0 ? len : 0);
+}
+
+static void run_sniff(void *arg) {
+    SniffJob *job = arg;
+
+    pthread_mutex_lock(&lock);
+
+    // the file scrolled off screen while queued
+    if (job->dropped) {
+        pending--;
+        pool_put(&jobs, job);
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    unlink_job(job);
+    iosched_release(job->group);
+
+    // the cache may have started over since the request
+    CacheSlot *slot = cache_insert(job->dev, job->ino);
+    slot->state = SLOT_RUNNING;
+    slot->mtime = job->mtime;
+    slot->job = NULL;
+    pthread_mutex_unlock(&lock);
+
+    MagicId id = sniff(job->path);
+
+    pthread_mutex_lock(&lock);
+
+    slot = cache_insert(job->dev, job->ino);
+    slot->state = SLOT_DONE;
+    slot->mtime = job->mtime;
+    slot->id = id;
+    pending--;
+    pool_put(&jobs, job);
+
+    pthread_mutex_unlock(&lock);
+}
+
+// returns the type of the file at `path` if it is cached, otherwise queues
+// it for sniffing and returns 0. `size` avoids opening empty files
+MagicId magic_request(dev_t dev, ino_t ino, struct timespec mtime, size_t size, const char *path) {
+
+    if (size == 0) return ID_EMPTY;
+
+    int64_t ns = timespec_ns(mtime);
+    MagicId id = 0;
+
+    pthread_mutex_lock(&lock);
+
+    CacheSlot *slot = cache_slot(dev, ino);
+    bool fresh = slot->mtime == ns
+        && (slot->state == SLOT_RUNNING || slot->state == SLOT_DONE);
+
+    if (slot->state == SLOT_QUEUED) {
+        // still on screen, it keeps its place in the queue
+        slot->job->frame = frame;
+        slot->job->mtime = slot->mtime = ns;
+
+    } else if (fresh && slot->state == SLOT_DONE) {
+        id = slot->id;
+
+    } else if (!fresh && pending < SNIFF_QUEUE) {
+        SniffJob *job = pool_get(&jobs);
+        *job = (SniffJob) {
+            .dev   = dev,
+            .ino   = ino,
+            .mtime = ns,
+            .group = iosched_group(IO_PREVIEW),
+            .frame = frame,
+            .next  = queued,
+        };
+        snprintf(job->path, ARRAY_LEN(job->path), "%s", path);
+
+        if (queued != NULL) queued->prev = job;
+        queued = job;
+
+        slot = cache_insert(dev, ino);
+        slot->state = SLOT_QUEUED;
+        slot->mtime = ns;
+        slot->job = job;
+
+        pending++;
+        iosched_submit(job->group, dev, run_sniff, job);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return id;
+}
+
+// drops the requests that have not started yet and were not made again since
+// the last sweep, ie: whose files are not on screen anymore. called once per
+// frame, after every view requested what it shows
+void magic_sweep_requests(void) {
+    pthread_mutex_lock(&lock);
+
+    SniffJob *job = queued;
+    while (job != NULL) {
+        SniffJob *next = job->next;
+
+        if (job->frame != frame) {
+            unlink_job(job);
+            job->dropped = true;
+
+            CacheSlot *slot = cache_slot(job->dev, job->ino);
+            if (slot->job == job) {
+                slot->state = SLOT_DROPPED;
+                slot->job = NULL;
+            }
+
+            iosched_cancel(job->group);
+            iosched_release(job->group);
+        }
+
+        job = next;
+    }
+
+    frame++;
+    pthread_mutex_unlock(&lock);
+}
+
+// returns true while requests are queued or running
+bool magic_busy(void) {
+    pthread_mutex_lock(&lock);
+    bool busy = pending > 0;
+    pthread_mutex_unlock(&lock);
+    return busy;
+}
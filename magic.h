@@ -0,0 +1,50 @@
+#ifndef _MAGIC_H
+#define _MAGIC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+// content based file type detection. only the first MAGIC_BYTES of a file are
+// read, on worker threads, and the result is cached by inode and mtime.
+//
+// requests are per frame: magic_sweep_requests() drops the ones that have
+// not started yet and were not made again during the frame, so files that
+// scrolled off screen are never opened, while the ones still on screen keep
+// their place in the queue
+
+
+
+#define MAGIC_BYTES 512
+
+typedef enum {
+    MAGIC_EXEC,
+    MAGIC_IMAGE,
+    MAGIC_ARCHIVE,
+    MAGIC_MEDIA,
+    MAGIC_DOCUMENT,
+    MAGIC_TEXT,
+    MAGIC_DATA,
+} MagicClass;
+
+typedef struct {
+    const char *label;
+    MagicClass class;
+} MagicType;
+
+// type ids are indices into the magic table, offset by one. 0 means the
+// type is not known (yet)
+typedef unsigned char MagicId;
+
+
+MagicId          magic_classify       (const unsigned char *buf, size_t len);
+MagicId          magic_request        (dev_t dev, ino_t ino, struct timespec mtime, size_t size, const char *path);
+void             magic_sweep_requests (void);
+bool             magic_busy           (void);
+const MagicType *magic_type           (MagicId id);
+
+
+
+#endif // _MAGIC_H
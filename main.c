@@ -2,342 +2,337 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
 #include <assert.h>
 #include <unistd.h>
-#include <ctype.h>
-#include <fcntl.h>
-
-#include <sys/stat.h>
+#include <poll.h>
 
 #include <ncurses.h>
 
 #include "fm.h"
+#include "ui.h"
+#include "batch.h"
+#include "tabs.h"
+#include "dircache.h"
+#include "prof.h"
+#include "magic.h"
 #include "next.h"
 #include "util.h"
 
 
 
-#define PAIR_WHITE       1
-#define PAIR_BLUE        2
-#define PAIR_GREEN       3
-#define PAIR_RED         4
-#define PAIR_SELECTED    5
-#define PAIR_SELECTED_HL 6
-#define PAIR_GREY        7
-#define PAIR_YELLOW      8
-
-static void curses_init(void) {
-    initscr();
-    noecho();
-    keypad(stdscr, true);
-    raw();
-    curs_set(0);
-
-    ESCDELAY = 0;
-
-    if (!has_colors())
-        fprintf(stderr, "Your terminal does not support colors\n");
+static void exit_routine(void) {
+    curses_deinit();
+    prof_trace_close();
+}
 
-    start_color();
-    use_default_colors();
-    init_pair(PAIR_WHITE,       COLOR_BRIGHT_WHITE, COLOR_BLACK);
-    init_pair(PAIR_RED,         COLOR_RED,          COLOR_BLACK);
-    init_pair(PAIR_BLUE,        COLOR_BLUE,         COLOR_BLACK);
-    init_pair(PAIR_GREEN,       COLOR_GREEN,        COLOR_BLACK);
-    init_pair(PAIR_GREY,        COLOR_GRAY,         COLOR_BLACK);
-    init_pair(PAIR_YELLOW,      COLOR_YELLOW,       COLOR_BLACK);
-    init_pair(PAIR_SELECTED,    COLOR_BLACK,        COLOR_BRIGHT_WHITE);
-    init_pair(PAIR_SELECTED_HL, COLOR_BLACK,        COLOR_BLACK);
+static void draw_pane(FileManager *fm, int off_x, int height) {
+    fm_set_viewport(fm, height);
+    fm_resolve_visible(fm);
 
+    uint64_t start = prof_begin();
+    draw_entries(fm, 2, off_x, fm->height, 30);
+    prof_end(PROF_DRAW, start, fm->height);
 }
 
-static void curses_deinit(void) {
-    endwin();
+// blocks until a key is pressed, or a watched directory changed.
+// returns false for the latter
+static bool wait_key(void) {
+    struct pollfd fds[] = {
+        { .fd = STDIN_FILENO,  .events = POLLIN },
+        { .fd = dircache_fd(), .events = POLLIN },
+    };
+
+    // interrupted eg: by a resize, which getch() reports
+    if (poll(fds, fds[1].fd == -1 ? 1 : 2, -1) == -1) return true;
+    return fds[0].revents != 0;
 }
 
-static void draw_topbar(const FileManager *fm) {
-
-    char hostname[HOST_NAME_MAX] = { 0 };
-    int err = gethostname(hostname, ARRAY_LEN(hostname));
-    assert(err == 0);
-
-    char *username = getlogin();
-    assert(username != NULL);
-
-    attrset(COLOR_PAIR(PAIR_GREEN) | A_BOLD);
-    mvprintw(0, 0, "%s@%s", username, hostname);
-
-    attrset(COLOR_PAIR(0));
-    printw(":");
-
-    attrset(COLOR_PAIR(PAIR_BLUE) | A_BOLD);
-    printw("%s", fm->cwd);
-    if (strcmp(fm->cwd, "/"))
-        printw("/");
-
-    attrset(A_BOLD);
-    Entry *e = fm_get_current(fm);
-    if (e != NULL)
-        printw("%s", e->name);
-
-    standend();
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-t trace.json] [-c col,...] [-I root] [-b | -s socket] [dir]\n", prog);
+    exit(EXIT_FAILURE);
 }
 
-// insert needed amount of spaces to align current x cell to
-// padding. keeps track of previous padding, `-1` for reset
-static void align(int padding) {
-    static int offset = 0;
-
-    if (padding == -1) {
-        offset = 0;
-        return;
-    }
-
-    int x, _y;
-    getyx(stdscr, _y, x);
-    (void) _y;
+// a comma separated list of column names into Column flags.
+// returns -1 on an unknown name
+static int parse_columns(char *list, unsigned int *columns) {
+    *columns = 0;
 
-    for (int _=0; _ < offset + padding - x; ++_)
-        printw(" ");
+    for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        int i = 0;
+        while (i < COLUMN_COUNT && strcmp(name, column_name(1 << i)))
+            i++;
 
-    offset += padding;
-}
-
-static void print_permissions(bool r, bool w, bool x, bool colored) {
+        if (i == COLUMN_COUNT) return -1;
+        *columns |= 1 << i;
+    }
 
-    printw_attrs_cond(COLOR_PAIR(r ? PAIR_YELLOW : PAIR_GREY), colored, r ? "r" : "-");
-    printw_attrs_cond(COLOR_PAIR(w ? PAIR_RED    : PAIR_GREY), colored, w ? "w" : "-");
-    printw_attrs_cond(COLOR_PAIR(x ? PAIR_GREEN  : PAIR_GREY), colored, x ? "x" : "-");
+    return 0;
 }
 
-static void draw_permissions(const Entry *e, bool colored) {
-
-    unsigned int m = e->mode;
-    print_permissions(m & S_IRUSR, m & S_IWUSR, m & S_IXUSR, colored);
-    print_permissions(m & S_IRGRP, m & S_IWGRP, m & S_IXGRP, colored);
-    print_permissions(m & S_IROTH, m & S_IWOTH, m & S_IXOTH, colored);
-}
+int main(int argc, char **argv) {
 
-static void draw_filesize(size_t size, bool colored) {
+    unsigned int columns = 0;
+    bool batch = false;
+    const char *socket = NULL;
+    const char *index_root = NULL;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "t:c:bs:I:")) != -1) {
+        switch (opt) {
+            case 't':
+                if (prof_trace_open(optarg) == -1) {
+                    perror(optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
 
-    const char *suffix = "";
+            case 'c':
+                if (parse_columns(optarg, &columns) == -1) {
+                    fprintf(stderr, "unknown column in `%s`\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
 
-    if (size > 1024 * 1024) {
-        size = size / (1024 * 1024);
-        suffix = "M";
+            case 'b': batch = true;    break;
+            case 's': socket = optarg; break;
+            case 'I': index_root = optarg; break;
 
-    } else if (size > 1024) {
-        size = size / 1024;
-        suffix = "K";
+            default: usage(argv[0]);
+        }
     }
 
-    printw_attrs_cond(COLOR_PAIR(PAIR_BLUE), colored, "%lu%s", size, suffix);
-}
-
-static void draw_entries(
-    const FileManager *fm,
-    int off_y,
-    int off_x,
-    int height,
-    int width
-) {
+    const char *startdir = optind < argc
+        ? argv[optind]
+        : ".";
 
-    const Directory *dir = &fm->dir;
+    // headless, see batch.h. scripted visits are not recorded as jumps
+    if (batch || socket != NULL) {
+        FileManager fm = { 0 };
+        fm_init(&fm, startdir);
+        fm_set_columns(&fm, columns);
 
-    if (dir->size == 0) {
-        move(off_y, off_x);
-        printw_attrs(COLOR_PAIR(PAIR_GREY), "<empty>");
-    }
+        int err = 0;
 
-    for (size_t i=0; i < dir->size; ++i) {
+        if (socket != NULL) {
+            err = batch_listen(&fm, socket);
+            if (err == -1) perror(socket);
 
-        Entry *e = &dir->entries[i];
-        bool cur = i == (size_t) fm->cursor;
-        bool sel = fm_is_selected(fm, e->abspath);
-
-        move(i + off_y, off_x);
+        } else {
+            // replies go to stdout, the output of commands to stderr
+            int out = dup(STDOUT_FILENO);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+            err = batch_run(&fm, STDIN_FILENO, out);
+            close(out);
+        }
 
-        if (sel)
-            printw(">");
-        align(4);
+        fm_destroy(&fm);
+        prof_trace_close();
+        return err == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
 
-        if (cur)
-            attron(COLOR_PAIR(PAIR_SELECTED));
-        draw_permissions(e, !cur);
-        align(14);
+    Tabs tabs;
+    tabs_init(&tabs, startdir);
+    fm_set_columns(tabs_current(&tabs), columns);
 
-        attron(COLOR_PAIR(cur ? PAIR_SELECTED : PAIR_BLUE));
-        draw_filesize(e->size, !cur);
-        align(10);
+    // jumping is not essential, fm works without a database. new tabs
+    // inherit it
+    JumpDb jumps;
+    if (jumpdb_open(&jumps, NULL) == 0) {
+        tabs_current(&tabs)->jumps = &jumps;
+        jumpdb_visit(&jumps, tabs_current(&tabs)->dir->path);
+    }
 
-        attron(COLOR_PAIR(cur ? PAIR_SELECTED : PAIR_GREEN));
-        printw("%s", e->type);
-        align(10);
+    // the index is optional too, built in the background
+    PathIndex index;
+    bool has_index = false;
+    if (index_root != NULL) {
+        has_index = pathindex_open(&index, index_root, NULL) == 0;
+        if (has_index)
+            tabs_current(&tabs)->index = &index;
+        else
+            perror(index_root);
+    }
 
-        if (e->dtype == DT_DIR)
-            attron(A_BOLD);
+    curses_init();
+    atexit(exit_routine);
 
-        attron(COLOR_PAIR(
-            cur
-            ? PAIR_SELECTED
-            : e->dtype == DT_DIR
-            ? PAIR_BLUE
-            : PAIR_WHITE));
-        printw("%s ", e->name);
-        align(width);
-        align(-1);
+    bool quit = false;
+    bool show_stats = false;
+    while (!quit) {
 
-        standend();
-    }
+        frame_reset();
 
-}
+        FileManager *fm = tabs_current(&tabs);
+        FileManager *other = tabs_other(&tabs);
 
-static void exit_routine(void) {
-    curses_deinit();
-}
+        clear();
+        draw_topbar(fm);
+        draw_tabs(&tabs);
+
+        // leave room for the top bar and the prompt
+        int height = getmaxy(stdscr) - 4;
+        if (height < 1) height = 1;
+
+        // the pane of the lower tab goes left
+        if (other == NULL) {
+            draw_pane(fm, 2, height);
+        } else {
+            bool left = tabs.current < tabs.other;
+            draw_pane(left ? fm : other, 2, height);
+            draw_pane(left ? other : fm, getmaxx(stdscr) / 2, height);
+        }
 
-static char *show_prompt(const char *prompt) {
+        // whatever is not on screen anymore is not worth sniffing
+        magic_sweep_requests();
 
-    int offsety = 2;
-    int y = getmaxy(stdscr);
+        if (show_stats)
+            draw_stats();
 
-    size_t bufsize = getmaxx(stdscr) - strlen(prompt) - strlen(": ");
-    char *buf = malloc(bufsize * sizeof(char));
-    NON_NULL(buf);
-    memset(buf, 0, bufsize * sizeof(char));
-    size_t i = 0;
+        uint64_t start = prof_begin();
+        refresh();
+        prof_end(PROF_REFRESH, start, 0);
 
-    while (1) {
+        // redraw periodically while background stats come in, and whenever
+        // a directory on screen changes
+        bool busy = fm_poll(fm);
+        if (other != NULL)
+            busy |= fm_poll(other);
 
-        move(y - offsety, 0);
-        clrtoeol();
-        printw("%s: %s", prompt, buf);
+        if (has_index)
+            pathindex_poll(&index);
 
-        int ch = getch();
-        switch (ch) {
+        timeout(busy ? 100 : -1);
+        if (!busy && !wait_key()) continue;
 
-            case 'u' & KEY_MASK_CTRL:
-                memset(buf, 0, bufsize * sizeof(char));
-                i = 0;
-                break;
+        int c = getch();
+        switch (c) {
 
             case KEY_ESCAPE:
-                free(buf);
-                return NULL;
+            case 'q':
+                quit = true;
                 break;
 
-            case KEY_RETURN:
-                return buf;
+            case 'T':
+                tabs_open(&tabs);
                 break;
 
-            case KEY_BACKSPACE:
-                if (i > 0)
-                    buf[--i] = '\0';
+            case 'Q':
+                tabs_close(&tabs);
                 break;
 
-            default:
-                if (i >= bufsize - 1)
-                    break;
-
-                if (isascii(ch))
-                    buf[i++] = (char) ch;
-
+            case ']':
+                tabs_cycle(&tabs, 1);
                 break;
 
-        }
-
-    }
-
-    UNREACHABLE();
-
-}
-
-
-
-int main(int argc, char **argv) {
-
-    const char *startdir = argc > 1
-        ? argv[1]
-        : ".";
-
-    FileManager fm = { 0 };
-    fm_init(&fm, startdir);
-
-    curses_init();
-    atexit(exit_routine);
-
-    bool quit = false;
-    while (!quit) {
+            case '[':
+                tabs_cycle(&tabs, -1);
+                break;
 
-        clear();
-        draw_topbar(&fm);
-        draw_entries(&fm, 2, 2, 10, 30);
-        refresh();
+            case '|':
+                tabs_split(&tabs);
+                break;
 
-        int c = getch();
-        switch (c) {
+            case 'w' & KEY_MASK_CTRL:
+                tabs_swap(&tabs);
+                break;
 
-            case KEY_ESCAPE:
-            case 'q':
-                quit = true;
+            case 'w': fm_toggle_cursor_wrapping(fm);
                 break;
 
-            case 'w': fm_toggle_cursor_wrapping(&fm);
+            case 'S':
+                show_stats = !show_stats;
                 break;
 
             case 'n' & KEY_MASK_CTRL:
             case 'j':
-                fm_go_down(&fm);
+                fm_go_down(fm);
                 break;
 
             case 'p' & KEY_MASK_CTRL:
             case 'k':
-                fm_go_up(&fm);
+                fm_go_up(fm);
                 break;
 
             case 'R':
-                fm_cd_abs(&fm, "/");
+                fm_cd_abs(fm, "/");
                 break;
 
             case 'H': {
                 char *home = getenv("HOME");
                 assert(home != NULL);
-                fm_cd_abs(&fm, home);
+                fm_cd_abs(fm, home);
             } break;
 
             case '.':
-                fm_toggle_hidden(&fm);
+                fm_toggle_hidden(fm);
                 break;
 
             case 'c': {
                 char *cmd = show_prompt("run cmd");
-                fm_run_cmd_selected(&fm, cmd);
-                free(cmd);
+                fm_run_cmd_selected(fm, cmd);
             } break;
 
+            case 'A':
+                show_attrs(fm);
+                break;
+
+            case 'D':
+                show_dupes(fm);
+                break;
+
+            case 'C':
+                show_compare(fm);
+                break;
+
+            case 't':
+                show_tree(fm);
+                break;
+
+            case 'J':
+                show_jump(fm);
+                break;
+
+            case 'F':
+                show_search(fm);
+                break;
+
+            case 'v':
+                show_preview(fm);
+                break;
+
+            case 'x':
+                fm_extract(fm);
+                break;
+
+            case 'o':
+                show_columns(fm);
+                break;
+
+            case 'r':
+                show_rename(fm);
+                break;
+
             case '\t':
             case 's':
             case ' ':
-                fm_toggle_select(&fm);
+                fm_toggle_select(fm);
                 break;
 
             case KEY_RETURN: {
                 char *cmd = show_prompt("exec");
                 if (cmd != NULL)
-                    fm_exec(&fm, cmd, exit_routine);
-                // NOTE: technically theres a memory leak here
+                    fm_exec(fm, cmd, exit_routine);
             } break;
 
             case 'b' & KEY_MASK_CTRL:
             case 'h':
             case '-':
-                fm_cd_parent(&fm);
+                fm_cd_parent(fm);
                 break;
 
             case 'f' & KEY_MASK_CTRL:
             case 'l':
-                fm_cd(&fm);
+                show_cd(fm);
                 break;
 
             default: break;
@@ -346,7 +341,12 @@ int main(int argc, char **argv) {
 
     }
 
-    fm_destroy(&fm);
+    bool has_jumps = tabs_current(&tabs)->jumps != NULL;
+    tabs_free(&tabs);
+    if (has_jumps)
+        jumpdb_close(&jumps);
+    if (has_index)
+        pathindex_close(&index);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,87 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pwd.h>
+#include <grp.h>
+
+#include "owners.h"
+#include "util.h"
+
+
+
+// systems rarely have more than a handful of ids in use
+#define OWNER_SLOTS 256
+#define OWNER_NAME  32
+
+typedef struct {
+    unsigned int id;
+    bool used;
+    char name[OWNER_NAME];
+} OwnerSlot;
+
+typedef struct {
+    OwnerSlot slots[OWNER_SLOTS];
+} OwnerCache;
+
+static OwnerCache users = { 0 };
+static OwnerCache groups = { 0 };
+
+static size_t hash_id(unsigned int id) {
+    uint32_t h = id * 0x9e3779b1u;
+    return (h >> 24) & (OWNER_SLOTS - 1);
+}
+
+// the slot of `id`, or the empty slot to put it in. NULL once the cache is
+// full, which only happens with hundreds of distinct ids
+static OwnerSlot *find_slot(OwnerCache *cache, unsigned int id) {
+    size_t i = hash_id(id);
+
+    for (size_t n=0; n < OWNER_SLOTS; ++n, i = (i + 1) & (OWNER_SLOTS - 1)) {
+        OwnerSlot *slot = &cache->slots[i];
+        if (!slot->used || slot->id == id) return slot;
+    }
+
+    return NULL;
+}
+
+static const char *lookup(OwnerCache *cache, unsigned int id, bool user) {
+
+    OwnerSlot *slot = find_slot(cache, id);
+
+    // past the limit names are looked up every time, into a shared buffer
+    static OwnerSlot overflow;
+    if (slot == NULL) slot = &overflow;
+    else if (slot->used) return slot->name;
+
+    const char *name = NULL;
+    if (user) {
+        struct passwd *pw = getpwuid(id);
+        if (pw != NULL) name = pw->pw_name;
+    } else {
+        struct group *gr = getgrgid(id);
+        if (gr != NULL) name = gr->gr_name;
+    }
+
+    if (name != NULL)
+        snprintf(slot->name, ARRAY_LEN(slot->name), "%s", name);
+    else
+        snprintf(slot->name, ARRAY_LEN(slot->name), "%u", id);
+
+    if (slot != &overflow) {
+        slot->id = id;
+        slot->used = true;
+    }
+
+    return slot->name;
+}
+
+const char *owner_user(uid_t uid) {
+    return lookup(&users, uid, true);
+}
+
+const char *owner_group(gid_t gid) {
+    return lookup(&groups, gid, false);
+}
@@ -0,0 +1,17 @@
+#ifndef _OWNERS_H
+#define _OWNERS_H
+
+#include <sys/types.h>
+
+// cache of user and group names by id, so that listings don't call
+// getpwuid()/getgrgid() per row. ids without a name are shown as numbers.
+// names stay valid until exit, the cache is never flushed
+
+
+
+const char *owner_user  (uid_t uid);
+const char *owner_group (gid_t gid);
+
+
+
+#endif // _OWNERS_H
@@ -0,0 +1,714 @@
+#define _GNU_SOURCE // qsort_r()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pathindex.h"
+#include "hash.h"
+#include "timing.h"
+#include "util.h"
+
+
+
+// changes trigger a rescan no more often than this
+#define RESCAN_INTERVAL_NS (10 * 1000000000ull)
+
+static void put_u8(StrBuf *out, uint8_t v) {
+    strbuf_append(out, (const char*) &v, 1);
+}
+
+static void put_u16(StrBuf *out, uint16_t v) {
+    strbuf_append(out, (const char*) &v, sizeof(v));
+}
+
+static void put_u32(StrBuf *out, uint32_t v) {
+    strbuf_append(out, (const char*) &v, sizeof(v));
+}
+
+static void put_i64(StrBuf *out, int64_t v) {
+    strbuf_append(out, (const char*) &v, sizeof(v));
+}
+
+static size_t shared_prefix(const char *a, size_t a_len, const char *b, size_t b_len, size_t max) {
+    size_t n = 0;
+    while (n < a_len && n < b_len && n < max && a[n] == b[n])
+        n++;
+    return n;
+}
+
+// decodes the records of a mapped index, checking every length against the
+// end of the map, so a damaged file just ends early
+typedef struct {
+    const char *p;
+    const char *end;
+    uint32_t dirs_left;
+    char dir[PATH_MAX];
+    size_t dir_len;
+    struct timespec mtime;
+    uint32_t entries_left; // of the current directory
+    char name[NAME_MAX + 1];
+    size_t name_len;
+    bool is_dir;
+} Reader;
+
+static bool take(Reader *r, void *dst, size_t size) {
+    if ((size_t) (r->end - r->p) < size) return false;
+    memcpy(dst, r->p, size);
+    r->p += size;
+    return true;
+}
+
+// returns false if `map` is no index of `root`
+static bool reader_init(Reader *r, const char *map, size_t size, const char *root, uint32_t *entries) {
+
+    *r = (Reader) { .p = map, .end = map + size };
+
+    char magic[4];
+    uint32_t dirs = 0;
+    uint32_t count = 0;
+    uint16_t root_len = 0;
+
+    if (!take(r, magic, 4) || memcmp(magic, PATHINDEX_MAGIC, 4)) return false;
+    if (!take(r, &dirs, 4) || !take(r, &count, 4) || !take(r, &root_len, 2)) return false;
+    if ((size_t) (r->end - r->p) < root_len) return false;
+    if (strlen(root) != root_len || memcmp(r->p, root, root_len)) return false;
+
+    // every directory takes 20 bytes at least, more can't be right
+    if (dirs > size / 20) return false;
+
+    r->p += root_len;
+    r->dirs_left = dirs;
+    if (entries != NULL) *entries = count;
+    return true;
+}
+
+static bool next_entry(Reader *r) {
+    if (r->entries_left == 0) return false;
+
+    uint8_t is_dir, shared, len;
+    if (!take(r, &is_dir, 1) || !take(r, &shared, 1) || !take(r, &len, 1)) goto damaged;
+    if (shared > r->name_len || shared + len > NAME_MAX) goto damaged;
+    if (!take(r, r->name + shared, len)) goto damaged;
+
+    r->name_len = shared + len;
+    r->name[r->name_len] = '\0';
+    r->is_dir = is_dir;
+    r->entries_left--;
+    return true;
+
+damaged:
+    r->entries_left = 0;
+    r->dirs_left = 0;
+    return false;
+}
+
+// moves on to the next directory, skipping the entries of the current one
+static bool next_dir(Reader *r) {
+    while (next_entry(r))
+        ;
+    if (r->dirs_left == 0) return false;
+
+    uint16_t shared, len;
+    int64_t sec;
+    uint32_t nsec, count;
+
+    if (!take(r, &shared, 2) || !take(r, &len, 2)) goto damaged;
+    if (shared > r->dir_len || shared + len >= PATH_MAX) goto damaged;
+    if (!take(r, r->dir + shared, len)) goto damaged;
+    if (!take(r, &sec, 8) || !take(r, &nsec, 4) || !take(r, &count, 4)) goto damaged;
+
+    r->dir_len = shared + len;
+    r->dir[r->dir_len] = '\0';
+    r->mtime = (struct timespec) { .tv_sec = sec, .tv_nsec = nsec };
+    r->entries_left = count;
+    r->name_len = 0;
+    r->dirs_left--;
+    return true;
+
+damaged:
+    r->dirs_left = 0;
+    return false;
+}
+
+static void unmap(PathIndex *idx) {
+    if (idx->map != NULL)
+        munmap((void*) idx->map, idx->map_size);
+    idx->map = NULL;
+    idx->map_size = 0;
+    idx->dirs = 0;
+    idx->entries = 0;
+}
+
+// maps the index file, if it is one of `idx->root`
+static void remap(PathIndex *idx) {
+    unmap(idx);
+
+    int fd = open(idx->file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= PATHINDEX_HEADER) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            idx->map = map;
+            idx->map_size = st.st_size;
+        }
+    }
+    close(fd);
+
+    Reader r;
+    if (idx->map == NULL || !reader_init(&r, idx->map, idx->map_size, idx->root, &idx->entries)) {
+        unmap(idx);
+        return;
+    }
+    idx->dirs = r.dirs_left;
+}
+
+// ---- scanning, in the background ----
+
+// the previous index, whose directories are reused while unchanged
+typedef struct {
+    const char *map;
+    size_t map_size;
+    StrBuf paths;    // of the directories, nul-separated
+    size_t *slots;   // open-addressing, `index + 1` into `records`
+    size_t mask;
+    struct { size_t path; const char *record; } *records; // `record` at its mtime
+    size_t count;
+} OldIndex;
+
+typedef struct {
+    size_t name; // offset into `Listing.names`
+    bool is_dir;
+} ListingItem;
+
+// entries of the directory being written
+typedef struct {
+    StrBuf names; // nul-separated
+    ListingItem *items;
+    size_t count;
+    size_t cap;
+} Listing;
+
+typedef struct {
+    PathIndex *idx;
+    OldIndex old;
+    StrBuf changed;   // directories to read in any case
+    StrBuf out;       // the records, written after the header
+    char prev_dir[PATH_MAX];
+    size_t prev_len;
+    uint32_t dirs;
+    uint32_t entries;
+} Scan;
+
+static size_t *old_slot(const OldIndex *old, const char *path) {
+    size_t i = xxh64(path, strlen(path), 0) & old->mask;
+    while (old->slots[i] != 0) {
+        if (!strcmp(old->paths.data + old->records[old->slots[i] - 1].path, path))
+            break;
+        i = (i + 1) & old->mask;
+    }
+    return &old->slots[i];
+}
+
+static void old_load(OldIndex *old, const char *file, const char *root) {
+
+    *old = (OldIndex) { 0 };
+
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= PATHINDEX_HEADER) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            old->map = map;
+            old->map_size = st.st_size;
+        }
+    }
+    close(fd);
+    if (old->map == NULL) return;
+
+    Reader r;
+    if (!reader_init(&r, old->map, old->map_size, root, NULL)) return;
+
+    size_t size = 16;
+    while (size < (size_t) r.dirs_left * 2)
+        size *= 2;
+    old->slots = calloc(size, sizeof(size_t));
+    old->records = malloc((r.dirs_left + 1) * sizeof(*old->records));
+    NON_NULL(old->slots);
+    NON_NULL(old->records);
+    old->mask = size - 1;
+
+    while (next_dir(&r)) {
+        size_t *slot = old_slot(old, r.dir);
+        if (*slot != 0) continue;
+
+        old->records[old->count].path = old->paths.len;
+        // back to the mtime of the record, just before the entries
+        old->records[old->count].record = r.p - 16;
+        strbuf_append(&old->paths, r.dir, r.dir_len + 1);
+        *slot = ++old->count;
+    }
+}
+
+static void old_free(OldIndex *old) {
+    if (old->map != NULL)
+        munmap((void*) old->map, old->map_size);
+    strbuf_free(&old->paths);
+    free(old->slots);
+    free(old->records);
+}
+
+static void listing_add(Listing *l, const char *name, bool is_dir) {
+    if (l->count == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 64;
+        l->items = realloc(l->items, l->cap * sizeof(ListingItem));
+        NON_NULL(l->items);
+    }
+
+    l->items[l->count++] = (ListingItem) {
+        .name   = l->names.len,
+        .is_dir = is_dir,
+    };
+    strbuf_append(&l->names, name, strlen(name) + 1);
+}
+
+static const char *listing_name(const Listing *l, size_t i) {
+    return l->names.data + l->items[i].name;
+}
+
+// the entries of the old record of `path`, if its mtime is still `mtime`
+static bool reuse_listing(Scan *s, const char *path, struct timespec mtime, Listing *l) {
+    if (s->old.slots == NULL) return false;
+
+    size_t slot = *old_slot(&s->old, path);
+    if (slot == 0) return false;
+
+    for (const char *c = s->changed.data; c != NULL && c < s->changed.data + s->changed.len; c += strlen(c) + 1)
+        if (!strcmp(c, path)) return false;
+
+    Reader r = {
+        .p   = s->old.records[slot - 1].record,
+        .end = s->old.map + s->old.map_size,
+    };
+
+    int64_t sec;
+    uint32_t nsec;
+    if (!take(&r, &sec, 8) || !take(&r, &nsec, 4) || !take(&r, &r.entries_left, 4)) return false;
+    if (sec != mtime.tv_sec || nsec != (uint32_t) mtime.tv_nsec) return false;
+
+    while (next_entry(&r))
+        listing_add(l, r.name, r.is_dir);
+    return true;
+}
+
+static int compare_names(const void *a, const void *b, void *arg) {
+    const char *names = arg;
+    const ListingItem *x = a;
+    const ListingItem *y = b;
+    return strcmp(names + x->name, names + y->name);
+}
+
+// reads the directory `dirfd` into `l`, sorted by name, for front-coding.
+// symlinks to directories don't count as directories
+static void read_listing(int dirfd, Listing *l) {
+
+    DIR *dirp = fdopendir(dup(dirfd));
+    if (dirp == NULL) return;
+
+    struct dirent *d = NULL;
+    while ((d = readdir(dirp)) != NULL) {
+        if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) continue;
+
+        bool is_dir = d->d_type == DT_DIR;
+        if (d->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+        }
+        listing_add(l, d->d_name, is_dir);
+    }
+    closedir(dirp);
+
+    qsort_r(l->items, l->count, sizeof(ListingItem), compare_names, l->names.data);
+}
+
+static void write_dir(Scan *s, const char *path, struct timespec mtime, const Listing *l) {
+    size_t len = strlen(path);
+    size_t shared = shared_prefix(s->prev_dir, s->prev_len, path, len, UINT16_MAX);
+
+    put_u16(&s->out, shared);
+    put_u16(&s->out, len - shared);
+    strbuf_append(&s->out, path + shared, len - shared);
+    put_i64(&s->out, mtime.tv_sec);
+    put_u32(&s->out, mtime.tv_nsec);
+    put_u32(&s->out, l->count);
+
+    const char *prev = "";
+    for (size_t i=0; i < l->count; ++i) {
+        const char *name = listing_name(l, i);
+        size_t name_len = strlen(name);
+        size_t same = shared_prefix(prev, strlen(prev), name, name_len, UINT8_MAX);
+
+        put_u8(&s->out, l->items[i].is_dir);
+        put_u8(&s->out, same);
+        put_u8(&s->out, name_len - same);
+        strbuf_append(&s->out, name + same, name_len - same);
+        prev = name;
+    }
+
+    memcpy(s->prev_dir, path, len + 1);
+    s->prev_len = len;
+    s->dirs++;
+    s->entries += l->count;
+}
+
+static bool scan_cancelled(PathIndex *idx) {
+    pthread_mutex_lock(&idx->lock);
+    bool c = idx->cancelled;
+    pthread_mutex_unlock(&idx->lock);
+    return c;
+}
+
+// walks the tree depth first, children in name order, so that directories
+// sharing a prefix follow each other
+static bool walk(Scan *s) {
+
+    PathIndex *idx = s->idx;
+    StrBuf stack = { 0 }; // paths still to visit, nul-separated
+    size_t *starts = NULL;
+    size_t depth = 0;
+    size_t cap = 0;
+    Listing l = { 0 };
+    bool ok = true;
+
+    strbuf_append(&stack, idx->root, strlen(idx->root) + 1);
+    starts = malloc(sizeof(size_t));
+    NON_NULL(starts);
+    starts[depth++] = 0;
+    cap = 1;
+
+    while (depth > 0) {
+        if (scan_cancelled(idx)) {
+            ok = false;
+            break;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, ARRAY_LEN(path), "%s", stack.data + starts[--depth]);
+        stack.len = starts[depth];
+
+        int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) continue;
+
+        struct stat st;
+        if (fstat(fd, &st) == -1 || st.st_dev != idx->dev) {
+            close(fd);
+            continue;
+        }
+
+        strbuf_clear(&l.names);
+        l.count = 0;
+        if (!reuse_listing(s, path, st.st_mtim, &l))
+            read_listing(fd, &l);
+        close(fd);
+
+        write_dir(s, path, st.st_mtim, &l);
+
+        // pushed in reverse, to be visited in order
+        const char *sep = strcmp(path, "/") ? "/" : "";
+        for (size_t i = l.count; i-- > 0; ) {
+            if (!l.items[i].is_dir) continue;
+
+            if (depth == cap) {
+                cap *= 2;
+                starts = realloc(starts, cap * sizeof(size_t));
+                NON_NULL(starts);
+            }
+            starts[depth++] = stack.len;
+
+            char child[PATH_MAX];
+            int n = snprintf(child, ARRAY_LEN(child), "%s%s%s", path, sep, listing_name(&l, i));
+            if (n >= (int) ARRAY_LEN(child)) {
+                depth--;
+                continue;
+            }
+            strbuf_append(&stack, child, n + 1);
+        }
+    }
+
+    strbuf_free(&stack);
+    strbuf_free(&l.names);
+    free(l.items);
+    free(starts);
+    return ok;
+}
+
+// writes the records into a new file, replacing the old one
+static int write_index(Scan *s) {
+
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, ARRAY_LEN(tmp), "%s.%ld", s->idx->file, (long) getpid());
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) return -1;
+
+    StrBuf header = { 0 };
+    const char *root = s->idx->root;
+    strbuf_append(&header, PATHINDEX_MAGIC, 4);
+    put_u32(&header, s->dirs);
+    put_u32(&header, s->entries);
+    put_u16(&header, strlen(root));
+    strbuf_append_str(&header, root);
+
+    bool ok = write(fd, header.data, header.len) == (ssize_t) header.len;
+    size_t done = 0;
+    while (ok && done < s->out.len) {
+        ssize_t n = write(fd, s->out.data + done, s->out.len - done);
+        if (n <= 0) ok = false;
+        else done += n;
+    }
+
+    strbuf_free(&header);
+    close(fd);
+
+    if (!ok || rename(tmp, s->idx->file) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void run_scan(void *arg) {
+    Scan *s = arg;
+    PathIndex *idx = s->idx;
+
+    old_load(&s->old, idx->file, idx->root);
+    if (walk(s))
+        write_index(s);
+    old_free(&s->old);
+
+    strbuf_free(&s->changed);
+    strbuf_free(&s->out);
+    free(s);
+
+    pthread_mutex_lock(&idx->lock);
+    idx->done = true;
+    pthread_mutex_unlock(&idx->lock);
+}
+
+// starts a scan, handing it the directories changed so far
+static void start_scan(PathIndex *idx) {
+    Scan *s = calloc(1, sizeof(Scan));
+    NON_NULL(s);
+    s->idx = idx;
+
+    pthread_mutex_lock(&idx->lock);
+    s->changed = idx->changed;
+    idx->changed = (StrBuf) { 0 };
+    idx->scanning = true;
+    idx->again = false;
+    idx->last_scan_ns = now_ns();
+    pthread_mutex_unlock(&idx->lock);
+
+    idx->scan = iosched_group(IO_PREFETCH);
+    iosched_submit(idx->scan, idx->dev, run_scan, s);
+}
+
+// ---- the main thread ----
+
+// indexes everything below `root` into `file`, or into
+// $XDG_DATA_HOME/fm/index-<hash of root> if it is NULL. an existing index is
+// usable right away, and brought up to date in the background.
+// returns -1 if `root` could not be resolved
+int pathindex_open(PathIndex *idx, const char *root, const char *file) {
+
+    *idx = (PathIndex) { 0 };
+    if (realpath(root, idx->root) == NULL) return -1;
+
+    struct stat st;
+    if (stat(idx->root, &st) == -1) return -1;
+    idx->dev = st.st_dev;
+
+    if (file != NULL) {
+        snprintf(idx->file, ARRAY_LEN(idx->file), "%s", file);
+
+    } else {
+        const char *data = getenv("XDG_DATA_HOME");
+        const char *home = getenv("HOME");
+        unsigned long long hash = xxh64(idx->root, strlen(idx->root), 0);
+
+        if (data != NULL && *data != '\0')
+            snprintf(idx->file, ARRAY_LEN(idx->file), "%s/fm/index-%016llx", data, hash);
+        else if (home != NULL)
+            snprintf(idx->file, ARRAY_LEN(idx->file), "%s/.local/share/fm/index-%016llx", home, hash);
+        else
+            return -1;
+
+        // like the jump database, which lives next to it
+        char dir[PATH_MAX];
+        snprintf(dir, ARRAY_LEN(dir), "%s", idx->file);
+        for (char *p = dir + 1; *p != '\0'; ++p) {
+            if (*p != '/') continue;
+            *p = '\0';
+            mkdir(dir, 0700);
+            *p = '/';
+        }
+    }
+
+    pthread_mutex_init(&idx->lock, NULL);
+    remap(idx);
+    start_scan(idx);
+    return 0;
+}
+
+void pathindex_close(PathIndex *idx) {
+    pthread_mutex_lock(&idx->lock);
+    idx->cancelled = true;
+    bool scanning = idx->scanning;
+    pthread_mutex_unlock(&idx->lock);
+
+    if (scanning) {
+        iosched_cancel(idx->scan);
+        iosched_wait(idx->scan);
+        iosched_release(idx->scan);
+    }
+
+    unmap(idx);
+    strbuf_free(&idx->changed);
+    strbuf_free(&idx->hits);
+    pthread_mutex_destroy(&idx->lock);
+}
+
+// schedules a scan, to start as soon as the running one is done
+void pathindex_rescan(PathIndex *idx) {
+    pthread_mutex_lock(&idx->lock);
+    idx->again = true;
+    idx->last_scan_ns = 0;
+    pthread_mutex_unlock(&idx->lock);
+
+    pathindex_poll(idx);
+}
+
+// marks `dir` as changed, to be read again by the next rescan, which starts
+// once RESCAN_INTERVAL_NS passed since the last one
+void pathindex_changed(PathIndex *idx, const char *dir) {
+    size_t len = strlen(idx->root);
+    bool inside = !strncmp(dir, idx->root, len)
+        && (dir[len] == '\0' || dir[len] == '/' || len == 1);
+    if (!inside) return;
+
+    pthread_mutex_lock(&idx->lock);
+    strbuf_append(&idx->changed, dir, strlen(dir) + 1);
+    idx->again = true;
+    pthread_mutex_unlock(&idx->lock);
+}
+
+// picks up a finished scan, and starts the next one when it is due.
+// returns true while a scan is running
+bool pathindex_poll(PathIndex *idx) {
+    pthread_mutex_lock(&idx->lock);
+    bool done = idx->done;
+    pthread_mutex_unlock(&idx->lock);
+
+    if (done) {
+        iosched_wait(idx->scan);
+        iosched_release(idx->scan);
+        pthread_mutex_lock(&idx->lock);
+        idx->done = false;
+        idx->scanning = false;
+        pthread_mutex_unlock(&idx->lock);
+        remap(idx);
+    }
+
+    pthread_mutex_lock(&idx->lock);
+    bool start = !idx->scanning && idx->again
+        && now_ns() - idx->last_scan_ns >= RESCAN_INTERVAL_NS;
+    bool scanning = idx->scanning;
+    pthread_mutex_unlock(&idx->lock);
+
+    if (start) {
+        start_scan(idx);
+        scanning = true;
+    }
+    return scanning;
+}
+
+bool pathindex_busy(PathIndex *idx) {
+    pthread_mutex_lock(&idx->lock);
+    bool scanning = idx->scanning;
+    pthread_mutex_unlock(&idx->lock);
+    return scanning;
+}
+
+// whether `name` contains `query`. without uppercase letters in the query,
+// case is ignored
+static bool name_matches(const char *name, size_t len, const char *query, size_t qlen, bool fold) {
+    if (qlen > len) return false;
+
+    for (size_t i=0; i + qlen <= len; ++i) {
+        size_t j = 0;
+        if (fold)
+            while (j < qlen && tolower((unsigned char) name[i + j]) == query[j]) j++;
+        else
+            while (j < qlen && name[i + j] == query[j]) j++;
+        if (j == qlen) return true;
+    }
+    return false;
+}
+
+// the first `max` entries whose name contains `query`, in the order of the
+// index (directories depth first, names sorted). an empty query matches
+// nothing. returns how many were found
+size_t pathindex_query(PathIndex *idx, const char *query, IndexHit *out, size_t max) {
+
+    pathindex_poll(idx);
+
+    size_t qlen = strlen(query);
+    if (idx->map == NULL || qlen == 0 || max == 0) return 0;
+
+    bool fold = true;
+    for (const char *c = query; *c; ++c)
+        fold &= !isupper((unsigned char) *c);
+
+    Reader r;
+    if (!reader_init(&r, idx->map, idx->map_size, idx->root, NULL)) return 0;
+
+    strbuf_clear(&idx->hits);
+    size_t count = 0;
+
+    // paths are collected first, the buffer may move while it grows
+    size_t *offsets = malloc(max * sizeof(size_t));
+    NON_NULL(offsets);
+
+    while (count < max && next_dir(&r)) {
+        const char *sep = strcmp(r.dir, "/") ? "/" : "";
+
+        while (count < max && next_entry(&r)) {
+            if (!name_matches(r.name, r.name_len, query, qlen, fold)) continue;
+
+            offsets[count] = idx->hits.len;
+            out[count].is_dir = r.is_dir;
+            strbuf_append(&idx->hits, r.dir, r.dir_len);
+            strbuf_append_str(&idx->hits, sep);
+            strbuf_append(&idx->hits, r.name, r.name_len + 1);
+            count++;
+        }
+    }
+
+    for (size_t i=0; i < count; ++i)
+        out[i].path = idx->hits.data + offsets[i];
+
+    free(offsets);
+    return count;
+}
@@ -0,0 +1,75 @@
+#ifndef _PATHINDEX_H
+#define _PATHINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+
+#include "strbuf.h"
+#include "iosched.h"
+
+// index of every path below a root, for searching names without walking the
+// tree. like locate's, the file lists directories with their mtime and their
+// entries, and is mapped as is for queries:
+//
+//   "FMI1" | u32 dirs | u32 entries | u16 len, root
+//   dir:   u16 shared, u16 len, path suffix | i64 mtime_s | u32 mtime_ns | u32 count
+//   entry: u8 is_dir | u8 shared, u8 len, name suffix
+//
+// directory paths are front-coded against the previous directory, entry
+// names against the previous entry of the same directory (they are sorted).
+//
+// scans run in the background, as prefetch work (see iosched.h), and write a
+// new file, which replaces the old one when done. rescans reuse the entries of
+// every directory whose mtime is unchanged, so they cost a stat per directory.
+// directories reported with pathindex_changed() (eg: by inotify, for
+// directories fm watches) are always read again, by the next rescan.
+// pathindex_rescan() starts one right away
+
+
+
+#define PATHINDEX_MAGIC  "FMI1"
+#define PATHINDEX_HEADER 14 // up to the root
+
+typedef struct {
+    const char *path; // valid until the next query
+    bool is_dir;
+} IndexHit;
+
+typedef struct {
+    char root[PATH_MAX];
+    char file[PATH_MAX];
+    dev_t dev; // of the root, scans stay on its filesystem
+
+    const char *map;
+    size_t map_size;
+    uint32_t dirs;
+    uint32_t entries;
+    StrBuf hits; // paths of the last query
+
+    IoGroup *scan; // of the running scan, a single prefetch task
+    pthread_mutex_t lock; // guards the fields below
+    bool scanning;
+    bool done;      // the scan finished, and is waiting to be picked up
+    bool again;     // changes came in during the scan
+    bool cancelled;
+    StrBuf changed; // directories to read again, nul-separated
+    uint64_t last_scan_ns; // start of the last scan
+} PathIndex;
+
+
+int    pathindex_open    (PathIndex *idx, const char *root, const char *file);
+void   pathindex_close   (PathIndex *idx);
+void   pathindex_rescan  (PathIndex *idx);
+void   pathindex_changed (PathIndex *idx, const char *dir);
+bool   pathindex_poll    (PathIndex *idx);
+bool   pathindex_busy    (PathIndex *idx);
+size_t pathindex_query   (PathIndex *idx, const char *query, IndexHit *out, size_t max);
+
+
+
+#endif // _PATHINDEX_H
@@ -0,0 +1,109 @@
+#define _DEFAULT_SOURCE // getpid()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prof.h"
+#include "util.h"
+
+
+
+static const char *probe_names[PROF_COUNT] = {
+    [PROF_LOAD_DIR] = "load_dir",
+    [PROF_READDIR]  = "readdir",
+    [PROF_STAT]     = "stat",
+    [PROF_SORT]     = "sort",
+    [PROF_LINKS]    = "readlink",
+    [PROF_DRAW]     = "draw_entries",
+    [PROF_REFRESH]  = "refresh",
+    [PROF_CMD]      = "run_cmd",
+    [PROF_RENAME]   = "rename",
+    [PROF_ATTRS]    = "attrs",
+};
+
+static ProfStats stats[PROF_COUNT] = { 0 };
+
+static struct {
+    FILE *file;
+    size_t events;
+} trace = { 0 };
+
+static void trace_event(ProfProbe probe, uint64_t start, uint64_t dur, size_t items) {
+
+    fprintf(
+        trace.file,
+        "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+        "\"pid\":%d,\"tid\":%d,\"args\":{\"items\":%zu}}",
+        trace.events++ ? ",\n" : "",
+        probe_names[probe],
+        start / 1000.0,
+        dur / 1000.0,
+        (int) getpid(),
+        (int) getpid(),
+        items
+    );
+}
+
+void prof_end(ProfProbe probe, uint64_t start, size_t items) {
+    uint64_t dur = now_ns() - start;
+
+    ProfStats *s = &stats[probe];
+    s->window[s->calls % PROF_WINDOW] = dur;
+    s->calls++;
+    s->items += items;
+    s->last_ns = dur;
+
+    if (trace.file != NULL)
+        trace_event(probe, start, dur, items);
+}
+
+const char *prof_name(ProfProbe probe) {
+    return probe_names[probe];
+}
+
+const ProfStats *prof_stats(ProfProbe probe) {
+    return &stats[probe];
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile over the recent samples of `probe`, 0 <= p <= 1
+uint64_t prof_percentile(ProfProbe probe, double p) {
+    const ProfStats *s = &stats[probe];
+
+    size_t count = s->calls < PROF_WINDOW ? s->calls : PROF_WINDOW;
+    if (count == 0) return 0;
+
+    uint64_t sorted[PROF_WINDOW] = { 0 };
+    memcpy(sorted, s->window, count * sizeof(*sorted));
+    qsort(sorted, count, sizeof(*sorted), compare_u64);
+
+    return sorted[(size_t) (p * (count - 1) + 0.5)];
+}
+
+// starts writing every span to `path`, in the Chrome trace event format.
+// returns -1 if the file could not be opened
+int prof_trace_open(const char *path) {
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) return -1;
+
+    prof_trace_close();
+    trace.file = file;
+    trace.events = 0;
+    fprintf(file, "[\n");
+    return 0;
+}
+
+void prof_trace_close(void) {
+    if (trace.file == NULL) return;
+
+    fprintf(trace.file, "\n]\n");
+    fclose(trace.file);
+    trace.file = NULL;
+}
@@ -0,0 +1,56 @@
+#ifndef _PROF_H
+#define _PROF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "timing.h"
+
+// always-on timers for the hot paths. every probe keeps its call count, the
+// last duration and a window of recent samples for percentiles. optionally,
+// every span is also written to a Chrome trace file (chrome://tracing, perfetto)
+//
+//   uint64_t start = prof_begin();
+//   ...
+//   prof_end(PROF_SORT, start, dir->size);
+
+
+
+typedef enum {
+    PROF_LOAD_DIR,
+    PROF_READDIR,
+    PROF_STAT,
+    PROF_SORT,
+    PROF_LINKS,
+    PROF_DRAW,
+    PROF_REFRESH,
+    PROF_CMD,
+    PROF_RENAME,
+    PROF_ATTRS,
+    PROF_COUNT,
+} ProfProbe;
+
+#define PROF_WINDOW 128
+
+typedef struct {
+    uint64_t calls;
+    uint64_t items;    // eg: entries stat'ed, summed over all calls
+    uint64_t last_ns;
+    uint64_t window[PROF_WINDOW];
+} ProfStats;
+
+
+static inline uint64_t prof_begin(void) {
+    return now_ns();
+}
+
+void             prof_end         (ProfProbe probe, uint64_t start, size_t items);
+const char      *prof_name        (ProfProbe probe);
+const ProfStats *prof_stats       (ProfProbe probe);
+uint64_t         prof_percentile  (ProfProbe probe, double p);
+int              prof_trace_open  (const char *path);
+void             prof_trace_close (void);
+
+
+
+#endif // _PROF_H
@@ -0,0 +1,492 @@
+#define _GNU_SOURCE // renameat2()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "renames.h"
+#include "hash.h"
+#include "prof.h"
+#include "util.h"
+
+
+
+#define NO_OP SIZE_MAX
+
+const char *renames_name(const RenamePlan *p, size_t offset) {
+    return p->names.data + offset;
+}
+
+// appends `name` with its nul, returns its offset
+static size_t push_name(RenamePlan *p, const char *name) {
+    size_t offset = p->names.len;
+    strbuf_append(&p->names, name, strlen(name) + 1);
+    return offset;
+}
+
+static bool valid_name(const char *name) {
+    if (*name == '\0' || strchr(name, '/') != NULL) {
+        errno = EINVAL;
+        return false;
+    }
+    if (!strcmp(name, ".") || !strcmp(name, "..")) {
+        errno = EINVAL;
+        return false;
+    }
+    if (strlen(name) > NAME_MAX) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    return true;
+}
+
+// open-addressing index of ops by one of their names, storing `op + 1`
+typedef struct {
+    size_t *slots;
+    size_t mask;
+} NameIndex;
+
+static void index_init(NameIndex *idx, size_t count) {
+    size_t size = 16;
+    while (size < count * 2)
+        size *= 2;
+
+    idx->slots = calloc(size, sizeof(size_t));
+    NON_NULL(idx->slots);
+    idx->mask = size - 1;
+}
+
+// the slot holding `name`, or the empty one it would go to
+static size_t *index_slot(const NameIndex *idx, const RenamePlan *p, const char *name, bool by_to) {
+    size_t i = xxh64(name, strlen(name), 0) & idx->mask;
+
+    while (idx->slots[i] != 0) {
+        const RenameStep *op = &p->ops[idx->slots[i] - 1];
+        if (!strcmp(renames_name(p, by_to ? op->to : op->from), name))
+            break;
+        i = (i + 1) & idx->mask;
+    }
+
+    return &idx->slots[i];
+}
+
+static void push_step(RenamePlan *p, RenameKind kind, size_t from, size_t to) {
+    p->steps[p->step_count++] = (RenameStep) {
+        .kind = kind,
+        .from = from,
+        .to   = to,
+    };
+}
+
+// plans renaming `from[i]` to `to[i]` inside of `dirfd`. names that stay the
+// same are left out. returns -1 if a rename is impossible, with `p->failed`
+// set to its index and errno to the reason: EINVAL for invalid names (or a
+// name listed twice), ENAMETOOLONG, or EEXIST for a target taken by another
+// rename or by an entry staying where it is
+int renames_plan(RenamePlan *p, int dirfd, char *const *from, char *const *to, size_t count) {
+
+    *p = (RenamePlan) { .dirfd = dirfd };
+
+    p->ops = malloc((count + 1) * sizeof(RenameStep));
+    NON_NULL(p->ops);
+    size_t *origin = malloc((count + 1) * sizeof(size_t));
+    NON_NULL(origin);
+
+    int err = 0;
+
+    for (size_t i=0; i < count; ++i) {
+        if (!valid_name(from[i]) || !valid_name(to[i])) {
+            err = errno;
+            p->failed = i;
+            goto fail;
+        }
+        if (!strcmp(from[i], to[i])) continue;
+
+        origin[p->count] = i;
+        p->ops[p->count++] = (RenameStep) {
+            .kind = RENAME_MOVE,
+            .from = push_name(p, from[i]),
+            .to   = push_name(p, to[i]),
+        };
+    }
+
+    NameIndex sources, targets;
+    index_init(&sources, p->count);
+    index_init(&targets, p->count);
+
+    // `waits[i]` is the op moving the entry out of the way of op `i`, which
+    // has to go first. `blocks` is the inverse
+    size_t *waits = malloc((p->count + 1) * sizeof(size_t));
+    size_t *blocks = malloc((p->count + 1) * sizeof(size_t));
+    NON_NULL(waits);
+    NON_NULL(blocks);
+
+    for (size_t i=0; i < p->count; ++i) {
+        size_t *src = index_slot(&sources, p, renames_name(p, p->ops[i].from), false);
+        size_t *dst = index_slot(&targets, p, renames_name(p, p->ops[i].to), true);
+
+        if (*src != 0 || *dst != 0) {
+            err = *src != 0 ? EINVAL : EEXIST;
+            p->failed = origin[i];
+            goto fail_index;
+        }
+        *src = i + 1;
+        *dst = i + 1;
+        blocks[i] = NO_OP;
+    }
+
+    for (size_t i=0; i < p->count; ++i) {
+        const char *target = renames_name(p, p->ops[i].to);
+        size_t slot = *index_slot(&sources, p, target, false);
+        waits[i] = slot != 0 ? slot - 1 : NO_OP;
+
+        if (waits[i] != NO_OP) {
+            blocks[waits[i]] = i;
+            continue;
+        }
+
+        // the target is no source, it must not exist at all
+        struct stat st;
+        if (fstatat(dirfd, target, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            err = EEXIST;
+        else if (errno != ENOENT)
+            err = errno;
+
+        if (err != 0) {
+            p->failed = origin[i];
+            goto fail_index;
+        }
+    }
+
+    // a cycle of n ops takes n - 1 swaps, so there are never more steps
+    // than ops
+    p->steps = malloc((p->count + 1) * sizeof(RenameStep));
+    NON_NULL(p->steps);
+
+    // chains first: every op without a target in the way starts one, and is
+    // followed by the op that was waiting for it, and so on
+    bool *planned = calloc(p->count + 1, sizeof(bool));
+    NON_NULL(planned);
+
+    for (size_t i=0; i < p->count; ++i) {
+        if (waits[i] != NO_OP) continue;
+
+        for (size_t op = i; op != NO_OP; op = blocks[op]) {
+            push_step(p, RENAME_MOVE, p->ops[op].from, p->ops[op].to);
+            planned[op] = true;
+        }
+    }
+
+    // what is left are cycles n1 -> n2 -> ... -> nk -> n1. swapping n1 with
+    // n2, then n3, ..., then nk moves every entry into place
+    for (size_t i=0; i < p->count; ++i) {
+        if (planned[i]) continue;
+
+        size_t first = p->ops[i].from;
+        for (size_t op = i; !planned[op]; op = waits[op]) {
+            planned[op] = true;
+            if (waits[op] != i)
+                push_step(p, RENAME_SWAP, first, p->ops[op].to);
+        }
+        p->cycles++;
+    }
+
+    free(planned);
+    free(waits);
+    free(blocks);
+    free(sources.slots);
+    free(targets.slots);
+    free(origin);
+    return 0;
+
+fail_index:
+    free(waits);
+    free(blocks);
+    free(sources.slots);
+    free(targets.slots);
+fail:
+    free(origin);
+    size_t failed = p->failed;
+    renames_free(p);
+    p->failed = failed;
+    errno = err;
+    return -1;
+}
+
+// renames without replacing an existing entry
+static int move(int dirfd, const char *from, const char *to) {
+    if (renameat2(dirfd, from, dirfd, to, RENAME_NOREPLACE) == 0) return 0;
+    if (errno != EINVAL && errno != ENOSYS) return -1;
+
+    // the filesystem has no RENAME_NOREPLACE
+    struct stat st;
+    if (fstatat(dirfd, to, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return renameat(dirfd, from, dirfd, to);
+}
+
+// exchanges the names `a` and `b`, through a temporary name where the
+// filesystem cannot do so atomically
+static int swap(int dirfd, const char *a, const char *b) {
+    if (renameat2(dirfd, a, dirfd, b, RENAME_EXCHANGE) == 0) return 0;
+    if (errno != EINVAL && errno != ENOSYS) return -1;
+
+    char tmp[NAME_MAX + 1];
+    for (unsigned n=0; ; ++n) {
+        snprintf(tmp, ARRAY_LEN(tmp), ".fm-rename.%ld.%u", (long) getpid(), n);
+        if (move(dirfd, a, tmp) == 0) break;
+        if (errno != EEXIST) return -1;
+    }
+
+    int err = 0;
+    if (move(dirfd, b, a) == -1) {
+        err = errno;
+        move(dirfd, tmp, a);
+        errno = err;
+        return -1;
+    }
+    if (move(dirfd, tmp, b) == -1) {
+        err = errno;
+        move(dirfd, a, b);
+        move(dirfd, tmp, a);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static int apply_step(int dirfd, const RenamePlan *p, const RenameStep *s, bool undo) {
+    const char *from = renames_name(p, s->from);
+    const char *to = renames_name(p, s->to);
+
+    if (s->kind == RENAME_SWAP)
+        return swap(dirfd, from, to);
+    return undo ? move(dirfd, to, from) : move(dirfd, from, to);
+}
+
+// applies the steps of `p` in order. returns -1 if one fails, with errno set
+// and `p->failed` its index. the steps applied before it are undone,
+// `p->rolled_back` tells whether that worked out
+int renames_apply(RenamePlan *p) {
+
+    uint64_t start = prof_begin();
+
+    for (p->done = 0; p->done < p->step_count; ++p->done) {
+        if (apply_step(p->dirfd, p, &p->steps[p->done], false) == 0) continue;
+
+        int err = errno;
+        p->failed = p->done;
+        p->rolled_back = true;
+
+        while (p->done > 0) {
+            p->done--;
+            if (apply_step(p->dirfd, p, &p->steps[p->done], true) == -1)
+                p->rolled_back = false;
+        }
+
+        prof_end(PROF_RENAME, start, p->failed);
+        errno = err;
+        return -1;
+    }
+
+    prof_end(PROF_RENAME, start, p->step_count);
+    return 0;
+}
+
+void renames_free(RenamePlan *p) {
+    strbuf_free(&p->names);
+    free(p->ops);
+    free(p->steps);
+    *p = (RenamePlan) { .dirfd = p->dirfd };
+}
+
+// returns -1 if `expr` is no `s/regex/replacement/flags`, or the regex does
+// not compile
+int renames_pattern(RenamePattern *pat, const char *expr) {
+
+    *pat = (RenamePattern) { 0 };
+    if (expr[0] != 's' || expr[1] == '\0') return -1;
+
+    char delim = expr[1];
+    const char *re = expr + 2;
+    const char *re_end = strchr(re, delim);
+    if (re_end == NULL) return -1;
+
+    const char *repl = re_end + 1;
+    const char *repl_end = strchr(repl, delim);
+    if (repl_end == NULL) return -1;
+
+    int cflags = REG_EXTENDED;
+    for (const char *f = repl_end + 1; *f; ++f) {
+        switch (*f) {
+            case 'g': pat->global = true; break;
+            case 'i': cflags |= REG_ICASE; break;
+            default: return -1;
+        }
+    }
+
+    char *src = strndup(re, re_end - re);
+    NON_NULL(src);
+    int err = regcomp(&pat->re, src, cflags);
+    free(src);
+    if (err != 0) return -1;
+
+    pat->repl = strndup(repl, repl_end - repl);
+    NON_NULL(pat->repl);
+    return 0;
+}
+
+static void append_replacement(StrBuf *out, const char *repl, const char *str, const regmatch_t *m) {
+    for (const char *c = repl; *c; ++c) {
+        int group = -1;
+
+        if (*c == '&') {
+            group = 0;
+        } else if (*c == '\\' && c[1] >= '0' && c[1] <= '9') {
+            group = *++c - '0';
+        } else if (*c == '\\' && c[1] != '\0') {
+            c++;
+        }
+
+        if (group == -1)
+            strbuf_append_char(out, *c);
+        else if (m[group].rm_so != -1)
+            strbuf_append(out, str + m[group].rm_so, m[group].rm_eo - m[group].rm_so);
+    }
+}
+
+// writes `name` with the pattern applied into `out`, which is cleared first.
+// returns the new name, owned by `out`
+const char *renames_substitute(const RenamePattern *pat, const char *name, StrBuf *out) {
+
+    strbuf_clear(out);
+    strbuf_reserve(out, 0);
+
+    const char *str = name;
+    int eflags = 0;
+    bool after_match = false;
+    regmatch_t m[10];
+
+    while (regexec(&pat->re, str, ARRAY_LEN(m), m, eflags) == 0) {
+        bool empty = m[0].rm_so == m[0].rm_eo;
+
+        // like sed, no empty match right after the previous match
+        if (!(empty && after_match && m[0].rm_so == 0)) {
+            strbuf_append(out, str, m[0].rm_so);
+            append_replacement(out, pat->repl, str, m);
+            if (!pat->global) {
+                str += m[0].rm_eo;
+                break;
+            }
+        } else {
+            m[0].rm_eo = 0;
+        }
+
+        // step over a character after an empty match, it would match again
+        str += m[0].rm_eo;
+        after_match = !empty;
+        if (empty) {
+            if (*str == '\0') break;
+            strbuf_append_char(out, *str++);
+        }
+        eflags = REG_NOTBOL;
+    }
+
+    strbuf_append_str(out, str);
+    return out->data;
+}
+
+void renames_pattern_free(RenamePattern *pat) {
+    if (pat->repl != NULL)
+        regfree(&pat->re);
+    free(pat->repl);
+    *pat = (RenamePattern) { 0 };
+}
+
+// writes `names` into a temporary file, one per line, to be edited with
+// `editor`, and reads back the new names into `to`, pointing into `buf`.
+// returns -1 if a name spans lines, the editor failed, or the line count
+// changed (EINVAL)
+int renames_edit(const char *editor, char *const *names, size_t count, StrBuf *buf, char **to) {
+
+    char path[] = "/tmp/fm-rename.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) return -1;
+
+    FILE *f = fdopen(fd, "w+");
+    NON_NULL(f);
+
+    int err = 0;
+    for (size_t i=0; i < count && err == 0; ++i) {
+        if (strchr(names[i], '\n') != NULL) err = EINVAL;
+        else fprintf(f, "%s\n", names[i]);
+    }
+    if (err == 0 && fflush(f) == EOF) err = errno;
+
+    if (err == 0) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            execlp("/bin/sh", "sh", "-c", "exec $0 \"$1\"", editor, path, NULL);
+            _exit(127);
+        }
+
+        int status = 0;
+        bool ok = pid != -1 && waitpid(pid, &status, 0) == pid
+            && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!ok) err = ECANCELED;
+    }
+
+    // the editor may have replaced the file, read it by name
+    if (err == 0) {
+        FILE *edited = fopen(path, "r");
+        if (edited == NULL) {
+            err = errno;
+        } else {
+            strbuf_clear(buf);
+            char chunk[4096];
+            size_t n;
+            while ((n = fread(chunk, 1, sizeof(chunk), edited)) > 0)
+                strbuf_append(buf, chunk, n);
+            fclose(edited);
+        }
+    }
+
+    fclose(f);
+    unlink(path);
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    // a missing newline after the last name is fine
+    if (buf->len > 0 && buf->data[buf->len - 1] != '\n')
+        strbuf_append_char(buf, '\n');
+
+    size_t lines = 0;
+    for (size_t i=0; i < buf->len; ++i) {
+        if (buf->data[i] != '\n') continue;
+        buf->data[i] = '\0';
+        lines++;
+    }
+
+    if (lines != count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char *line = buf->data;
+    for (size_t i=0; i < count; ++i) {
+        to[i] = line;
+        line += strlen(line) + 1;
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef _RENAMES_H
+#define _RENAMES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <regex.h>
+
+#include "strbuf.h"
+
+// renames many entries of one directory at once. the renames are planned
+// first: names are checked, targets must be unique and free (or renamed away
+// themselves), and renames are ordered so that no rename has to wait for one
+// after it. what is left are cycles (`a -> b -> a`), which are applied with
+// RENAME_EXCHANGE, or through a temporary name where the filesystem has none.
+// all renames are relative to the fd of the directory, no paths are resolved.
+// if a rename fails, the ones before it are undone
+
+
+
+typedef enum {
+    RENAME_MOVE,
+    RENAME_SWAP, // exchanges both names
+} RenameKind;
+
+// `from` and `to` are offsets into `RenamePlan.names`
+typedef struct {
+    RenameKind kind;
+    size_t from;
+    size_t to;
+} RenameStep;
+
+typedef struct {
+    int dirfd;
+    StrBuf names;      // every name, nul-terminated
+    RenameStep *ops;   // as requested, without the ones keeping their name
+    size_t count;
+    RenameStep *steps; // in the order they are applied
+    size_t step_count;
+    size_t cycles;     // among the ops
+    size_t failed;     // the op or step that failed, see renames_plan()
+    size_t done;       // steps applied by renames_apply()
+    bool rolled_back;  // renames_apply() failed, and undid every step
+} RenamePlan;
+
+// a sed-like `s/regex/replacement/flags`. the delimiter is whatever follows
+// the `s`. `&` and `\1`...`\9` insert the match and its groups, flags are
+// `g` (every match) and `i` (ignore case)
+typedef struct {
+    regex_t re;
+    char *repl;
+    bool global;
+} RenamePattern;
+
+
+int   renames_plan        (RenamePlan *p, int dirfd, char *const *from, char *const *to, size_t count);
+int   renames_apply       (RenamePlan *p);
+void  renames_free        (RenamePlan *p);
+const char *renames_name  (const RenamePlan *p, size_t offset);
+int   renames_pattern     (RenamePattern *pat, const char *expr);
+const char *renames_substitute (const RenamePattern *pat, const char *name, StrBuf *out);
+void  renames_pattern_free(RenamePattern *pat);
+int   renames_edit        (const char *editor, char *const *names, size_t count, StrBuf *buf, char **to);
+
+
+
+#endif // _RENAMES_H
@@ -0,0 +1,136 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "tabs.h"
+#include "util.h"
+
+
+
+// points the panes at each other, for `{other}`
+static void link_panes(Tabs *t) {
+    for (size_t i=0; i < t->count; ++i)
+        t->views[i]->other = NULL;
+
+    if (!t->split) return;
+
+    t->views[t->current]->other = t->views[t->other];
+    t->views[t->other]->other = t->views[t->current];
+}
+
+// a view on the directory of `from`, with its settings, inserted after `at`
+static size_t insert_view(Tabs *t, size_t at, const FileManager *from) {
+
+    t->views = realloc(t->views, (t->count + 1) * sizeof(FileManager*));
+    NON_NULL(t->views);
+
+    FileManager *fm = malloc(sizeof(FileManager));
+    NON_NULL(fm);
+    fm_clone(fm, from);
+
+    size_t i = at + 1;
+    memmove(&t->views[i + 1], &t->views[i], (t->count - i) * sizeof(FileManager*));
+    t->views[i] = fm;
+    t->count++;
+
+    if (t->split && t->other >= i) t->other++;
+    if (t->current >= i) t->current++;
+    return i;
+}
+
+// a single tab on `dir`. exits if it can't be opened, like fm_init()
+void tabs_init(Tabs *t, const char *dir) {
+    *t = (Tabs) { 0 };
+
+    t->views = malloc(sizeof(FileManager*));
+    NON_NULL(t->views);
+    t->views[0] = malloc(sizeof(FileManager));
+    NON_NULL(t->views[0]);
+
+    fm_init(t->views[0], dir);
+    t->count = 1;
+}
+
+void tabs_free(Tabs *t) {
+    for (size_t i=0; i < t->count; ++i) {
+        fm_destroy(t->views[i]);
+        free(t->views[i]);
+    }
+    free(t->views);
+    *t = (Tabs) { 0 };
+}
+
+FileManager *tabs_current(const Tabs *t) {
+    return t->views[t->current];
+}
+
+// the other pane, or NULL if not split
+FileManager *tabs_other(const Tabs *t) {
+    return t->split ? t->views[t->other] : NULL;
+}
+
+// a new tab on the current directory, which becomes the current one
+void tabs_open(Tabs *t) {
+    t->current = insert_view(t, t->current, tabs_current(t));
+    link_panes(t);
+}
+
+// closes the current tab. returns false if it is the last one
+bool tabs_close(Tabs *t) {
+    if (t->count == 1) return false;
+
+    size_t i = t->current;
+    fm_destroy(t->views[i]);
+    free(t->views[i]);
+
+    memmove(&t->views[i], &t->views[i + 1], (t->count - i - 1) * sizeof(FileManager*));
+    t->count--;
+
+    // the other pane takes over, or the tab before the closed one
+    if (t->split) {
+        t->current = t->other > i ? t->other - 1 : t->other;
+        t->split = false;
+    } else if (t->current == t->count) {
+        t->current--;
+    }
+
+    link_panes(t);
+    return true;
+}
+
+// moves to the next tab, or the previous one if `step` is negative
+void tabs_cycle(Tabs *t, int step) {
+    size_t prev = t->current;
+    t->current = step < 0
+        ? (t->current + t->count - 1) % t->count
+        : (t->current + 1) % t->count;
+
+    // onto the other pane: the panes trade places
+    if (t->split && t->current == t->other)
+        t->other = prev;
+    link_panes(t);
+}
+
+// splits the current tab, or unsplits it. the other pane is the next tab,
+// or a new one on the current directory
+void tabs_split(Tabs *t) {
+    t->split = !t->split;
+
+    if (t->split) {
+        if (t->count == 1)
+            insert_view(t, t->current, tabs_current(t));
+        t->other = (t->current + 1) % t->count;
+    }
+
+    link_panes(t);
+}
+
+// focuses the other pane
+void tabs_swap(Tabs *t) {
+    if (!t->split) return;
+
+    size_t current = t->current;
+    t->current = t->other;
+    t->other = current;
+    link_panes(t);
+}
@@ -0,0 +1,37 @@
+#ifndef _TABS_H
+#define _TABS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "fm.h"
+
+// tabs, each a view of its own (cursor, selection, hidden files, columns).
+// the current tab can be split, showing a second tab next to it as the other
+// pane, which `{other}` in commands refers to. views on the same directory
+// share its listing, see dircache.h
+
+
+
+typedef struct {
+    FileManager **views; // allocated one by one, views point to each other
+    size_t count;
+    size_t current;
+    size_t other; // shown next to `current`, if split
+    bool split;
+} Tabs;
+
+
+void         tabs_init    (Tabs *t, const char *dir);
+void         tabs_free    (Tabs *t);
+FileManager *tabs_current (const Tabs *t);
+FileManager *tabs_other   (const Tabs *t);
+void         tabs_open    (Tabs *t);
+bool         tabs_close   (Tabs *t);
+void         tabs_cycle   (Tabs *t, int step);
+void         tabs_split   (Tabs *t);
+void         tabs_swap    (Tabs *t);
+
+
+
+#endif // _TABS_H
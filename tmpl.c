@@ -0,0 +1,226 @@
+#define _DEFAULT_SOURCE // strdup(), strnlen()
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmpl.h"
+#include "util.h"
+
+
+
+static const struct {
+    const char *name;
+    TmplKind kind;
+} placeholders[] = {
+    { "",      TMPL_PATH  },
+    { "name",  TMPL_NAME  },
+    { "dir",   TMPL_DIR   },
+    { "ext",   TMPL_EXT   },
+    { "other", TMPL_OTHER },
+};
+
+// parses the placeholder starting at `str` (pointing at `{`).
+// returns its length, or 0 if `str` does not start a known placeholder
+static size_t parse_placeholder(const char *str, TmplPart *part) {
+
+    // longest placeholder is `{+other}`, no need to look any further
+    size_t max = strnlen(str, 8);
+    const char *end = memchr(str, '}', max);
+    if (end == NULL) return 0;
+
+    const char *name = str + 1;
+    bool batch = *name == '+';
+    if (batch) name++;
+
+    size_t len = end - name;
+    for (size_t i=0; i < ARRAY_LEN(placeholders); ++i) {
+        if (strlen(placeholders[i].name) == len
+            && !strncmp(placeholders[i].name, name, len)) {
+
+            *part = (TmplPart) {
+                .kind  = placeholders[i].kind,
+                .batch = batch,
+            };
+            return end - str + 1;
+        }
+    }
+
+    return 0;
+}
+
+static void push_part(Template *t, TmplPart part) {
+
+    // merge adjacent literals, so unknown braces don't split the text
+    if (part.kind == TMPL_LITERAL && t->count > 0) {
+        TmplPart *last = &t->parts[t->count - 1];
+        if (last->kind == TMPL_LITERAL && last->offset + last->len == part.offset) {
+            last->len += part.len;
+            return;
+        }
+    }
+
+    t->parts[t->count++] = part;
+}
+
+// returns -1 if `src` is NULL
+int tmpl_compile(Template *t, const char *src) {
+
+    *t = (Template) { 0 };
+    if (src == NULL) return -1;
+
+    t->src = strdup(src);
+    NON_NULL(t->src);
+
+    // every `{` may start a placeholder, so this is an upper bound for
+    // the amount of parts
+    size_t max_parts = 1;
+    for (const char *c = src; *c; ++c)
+        max_parts += *c == '{' ? 2 : 0;
+
+    t->parts = malloc(max_parts * sizeof(TmplPart));
+    NON_NULL(t->parts);
+
+    const char *lit = src;
+    const char *c = src;
+
+    while ((c = strchr(c, '{')) != NULL) {
+
+        TmplPart part = { 0 };
+        size_t len = parse_placeholder(c, &part);
+        if (len == 0) {
+            c++;
+            continue;
+        }
+
+        if (c > lit) {
+            push_part(t, (TmplPart) {
+                .kind   = TMPL_LITERAL,
+                .offset = lit - src,
+                .len    = c - lit,
+            });
+        }
+
+        // there is only one other directory, `{+other}` means `{other}`
+        if (part.kind == TMPL_OTHER)
+            part.batch = false;
+
+        push_part(t, part);
+        t->batch |= part.batch;
+        t->uses_other |= part.kind == TMPL_OTHER;
+        c += len;
+        lit = c;
+    }
+
+    if (*lit) {
+        push_part(t, (TmplPart) {
+            .kind   = TMPL_LITERAL,
+            .offset = lit - src,
+            .len    = strlen(lit),
+        });
+    }
+
+    return 0;
+}
+
+void tmpl_destroy(Template *t) {
+    free(t->src);
+    free(t->parts);
+    *t = (Template) { 0 };
+}
+
+// appends `str` wrapped in single quotes, escaping embedded quotes as '\''
+static void append_quoted(StrBuf *out, const char *str, size_t len) {
+
+    // worst case: every character is a quote
+    strbuf_reserve(out, len * 4 + 2);
+
+    char *dst = out->data + out->len;
+    *dst++ = '\'';
+
+    for (size_t i=0; i < len; ++i) {
+        if (str[i] == '\'') {
+            memcpy(dst, "'\\''", 4);
+            dst += 4;
+        } else {
+            *dst++ = str[i];
+        }
+    }
+
+    *dst++ = '\'';
+    *dst = '\0';
+    out->len = dst - out->data;
+}
+
+static void append_field(StrBuf *out, TmplKind kind, const char *path) {
+
+    const char *slash = strrchr(path, '/');
+    const char *name = slash == NULL ? path : slash + 1;
+
+    switch (kind) {
+        case TMPL_PATH:
+            append_quoted(out, path, strlen(path));
+            break;
+
+        case TMPL_NAME:
+            append_quoted(out, name, strlen(name));
+            break;
+
+        case TMPL_DIR:
+            if (slash == NULL)
+                append_quoted(out, ".", 1);
+            else if (slash == path)
+                append_quoted(out, "/", 1);
+            else
+                append_quoted(out, path, slash - path);
+            break;
+
+        case TMPL_EXT: {
+            // leading dots mark hidden files, not extensions
+            const char *dot = strrchr(name, '.');
+            if (dot == NULL || dot == name)
+                append_quoted(out, "", 0);
+            else
+                append_quoted(out, dot + 1, strlen(dot + 1));
+        } break;
+
+        case TMPL_LITERAL:
+        default:
+            UNREACHABLE();
+    }
+}
+
+// expands `t` into `out`, which is cleared first. non-batch placeholders refer
+// to the first path. returns the expanded command, owned by `out`
+const char *tmpl_expand(
+    const Template *t,
+    StrBuf *out,
+    const char *const *paths,
+    size_t count
+) {
+
+    strbuf_clear(out);
+    strbuf_reserve(out, 0);
+
+    for (size_t i=0; i < t->count; ++i) {
+        const TmplPart *part = &t->parts[i];
+
+        if (part->kind == TMPL_LITERAL) {
+            strbuf_append(out, t->src + part->offset, part->len);
+
+        } else if (part->kind == TMPL_OTHER) {
+            const char *other = t->other != NULL ? t->other : "";
+            append_quoted(out, other, strlen(other));
+
+        } else if (!part->batch) {
+            if (count > 0)
+                append_field(out, part->kind, paths[0]);
+
+        } else {
+            for (size_t j=0; j < count; ++j) {
+                if (j > 0) strbuf_append_char(out, ' ');
+                append_field(out, part->kind, paths[j]);
+            }
+        }
+    }
+
+    return out->data;
+}
@@ -0,0 +1,58 @@
+#ifndef _TMPL_H
+#define _TMPL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "strbuf.h"
+
+// command templates are parsed once into a list of parts, so expanding them
+// for every selected path is a single pass over the parts.
+//
+// placeholders:
+//   {}      full path
+//   {name}  last path component
+//   {dir}   parent directory
+//   {ext}   extension of the last component, without the dot
+//   {other} directory of the other pane, see `Template.other`
+//   {+}, {+name}, {+dir}, {+ext}
+//           batch variants: expand to the value of every path, space separated.
+//           a template containing one of these is run once for all paths
+//
+// every substituted value is single-quoted for /bin/sh. braces that do not
+// form a known placeholder (eg: `${HOME}`, `awk '{print}'`) are kept as is
+
+
+
+typedef enum {
+    TMPL_LITERAL,
+    TMPL_PATH,
+    TMPL_NAME,
+    TMPL_DIR,
+    TMPL_EXT,
+    TMPL_OTHER,
+} TmplKind;
+
+typedef struct {
+    TmplKind kind;
+    bool batch;
+    size_t offset, len; // literal text in `Template.src`
+} TmplPart;
+
+typedef struct {
+    char *src;
+    TmplPart *parts;
+    size_t count;
+    bool batch; // true if any part is a batch placeholder
+    bool uses_other; // true if any part is `{other}`
+    const char *other; // what `{other}` expands to, set before expanding
+} Template;
+
+
+int         tmpl_compile (Template *t, const char *src);
+void        tmpl_destroy (Template *t);
+const char *tmpl_expand  (const Template *t, StrBuf *out, const char *const *paths, size_t count);
+
+
+
+#endif // _TMPL_H
@@ -0,0 +1,172 @@
+#define _DEFAULT_SOURCE // required for file type macro constants by dirent
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "tree.h"
+#include "util.h"
+
+
+
+static void reserve(Tree *tree, size_t extra) {
+    if (tree->size + extra <= tree->capacity) return;
+
+    while (tree->size + extra > tree->capacity)
+        tree->capacity = tree->capacity ? tree->capacity * 2 : 256;
+
+    tree->nodes = realloc(tree->nodes, tree->capacity * sizeof(TreeNode));
+    NON_NULL(tree->nodes);
+}
+
+// makes room for `count` nodes at `at`
+static TreeNode *open_gap(Tree *tree, size_t at, size_t count) {
+    reserve(tree, count + 1);
+
+    TreeNode *gap = &tree->nodes[at];
+    memmove(gap + count, gap, (tree->size - at) * sizeof(TreeNode));
+    tree->size += count;
+    return gap;
+}
+
+// one past the last node of the subtree of `index`
+static size_t subtree_end(const Tree *tree, size_t index) {
+    unsigned depth = tree->nodes[index].depth;
+
+    size_t end = index + 1;
+    while (end < tree->size && tree->nodes[end].depth > depth)
+        end++;
+    return end;
+}
+
+// inserts the children of the directory `path` at `at`.
+// returns -1 if the directory could not be read
+static int load_children(Tree *tree, size_t at, const char *path, unsigned depth) {
+    Directory *dir = &tree->scratch;
+
+    if (dir_read(dir, path) == -1) return -1;
+    if (!tree->show_hidden)
+        dir_filter_hidden(dir);
+
+    dir_stat(dir);
+    dir_sort(dir);
+
+    size_t count = 0;
+    for (size_t i=0; i < dir->size; ++i)
+        if (strcmp(dir->entries[i].name, ".") && strcmp(dir->entries[i].name, ".."))
+            dir->entries[count++] = dir->entries[i];
+
+    TreeNode *nodes = open_gap(tree, at, count);
+    for (size_t i=0; i < count; ++i)
+        nodes[i] = (TreeNode) { .entry = dir->entries[i], .depth = depth };
+
+    return 0;
+}
+
+static void free_nodes(TreeNode *nodes, size_t size) {
+    for (size_t i=0; i < size; ++i) {
+        free_nodes(nodes[i].stash, nodes[i].stash_size);
+        free(nodes[i].stash);
+    }
+}
+
+// returns -1 if `root` could not be read
+int tree_init(Tree *tree, const char *root, bool show_hidden) {
+    *tree = (Tree) {
+        .show_hidden = show_hidden,
+        .scratch     = DIRECTORY_INIT,
+    };
+
+    if (load_children(tree, 0, root, 0) == -1) {
+        tree_free(tree);
+        return -1;
+    }
+
+    snprintf(tree->root, ARRAY_LEN(tree->root), "%s", tree->scratch.path);
+    return 0;
+}
+
+void tree_free(Tree *tree) {
+    free_nodes(tree->nodes, tree->size);
+    free(tree->nodes);
+    dir_free(&tree->scratch);
+    *tree = (Tree) { .scratch = DIRECTORY_INIT };
+}
+
+// expands a collapsed directory, or collapses an expanded one.
+// returns -1 if the directory could not be read
+int tree_toggle(Tree *tree, size_t index) {
+    TreeNode *node = &tree->nodes[index];
+    if (node->entry.dtype != DT_DIR) return 0;
+
+    if (node->expanded) {
+        size_t end = subtree_end(tree, index);
+        size_t count = end - index - 1;
+
+        node->stash = malloc((count + 1) * sizeof(TreeNode));
+        NON_NULL(node->stash);
+        node->stash_size = count;
+        node->expanded = false;
+
+        memcpy(node->stash, node + 1, count * sizeof(TreeNode));
+        memmove(node + 1, &tree->nodes[end], (tree->size - end) * sizeof(TreeNode));
+        tree->size -= count;
+        return 0;
+    }
+
+    if (node->loaded) {
+        size_t count = node->stash_size;
+        TreeNode *stash = node->stash;
+
+        TreeNode *gap = open_gap(tree, index + 1, count); // invalidates `node`
+        memcpy(gap, stash, count * sizeof(TreeNode));
+        free(stash);
+
+        node = &tree->nodes[index];
+        node->stash = NULL;
+        node->stash_size = 0;
+        node->expanded = true;
+        return 0;
+    }
+
+    char path[PATH_MAX] = { 0 };
+    tree_path(tree, index, path, ARRAY_LEN(path));
+
+    if (load_children(tree, index + 1, path, node->depth + 1) == -1)
+        return -1;
+
+    node = &tree->nodes[index];
+    node->loaded = true;
+    node->expanded = true;
+    return 0;
+}
+
+// returns `index` itself for top level nodes
+size_t tree_parent(const Tree *tree, size_t index) {
+    unsigned depth = tree->nodes[index].depth;
+
+    size_t i = index;
+    while (i > 0 && tree->nodes[i].depth >= depth && depth > 0)
+        i--;
+    return i;
+}
+
+// writes the absolute path of the node at `index` into `buf`
+char *tree_path(const Tree *tree, size_t index, char *buf, size_t size) {
+
+    // collect the ancestors, walking backwards
+    size_t chain[PATH_MAX / 2];
+    size_t n = 0;
+
+    chain[n++] = index;
+    while (tree->nodes[index].depth > 0 && n < ARRAY_LEN(chain)) {
+        index = tree_parent(tree, index);
+        chain[n++] = index;
+    }
+
+    size_t len = snprintf(buf, size, "%s", strcmp(tree->root, "/") ? tree->root : "");
+    while (n > 0 && len < size)
+        len += snprintf(buf + len, size - len, "/%s", tree->nodes[chain[--n]].entry.name);
+
+    return buf;
+}
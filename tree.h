@@ -0,0 +1,45 @@
+#ifndef _TREE_H
+#define _TREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+
+#include "dir.h"
+
+// a directory tree, flattened into one array in display order. every node
+// is followed by its expanded subtree, which ends at the next node that is
+// not deeper. directories are loaded on their first expansion only.
+// collapsing moves the subtree out of the array into a stash on the node,
+// expanding again moves it back without touching the filesystem
+
+
+
+typedef struct TreeNode {
+    Entry entry;
+    unsigned depth;
+    bool loaded;
+    bool expanded;
+    struct TreeNode *stash; // subtree while collapsed
+    size_t stash_size;
+} TreeNode;
+
+typedef struct {
+    char root[PATH_MAX];
+    bool show_hidden;
+    TreeNode *nodes;
+    size_t size;
+    size_t capacity;
+    Directory scratch; // reused for loading subtrees
+} Tree;
+
+
+int    tree_init   (Tree *tree, const char *root, bool show_hidden);
+void   tree_free   (Tree *tree);
+int    tree_toggle (Tree *tree, size_t index);
+size_t tree_parent (const Tree *tree, size_t index);
+char  *tree_path   (const Tree *tree, size_t index, char *buf, size_t size);
+
+
+
+#endif // _TREE_H
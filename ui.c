@@ -0,0 +1,1351 @@
+#define _DEFAULT_SOURCE // required for file type macro constants by dirent
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <assert.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+#include <ncurses.h>
+
+#include "ui.h"
+#include "prof.h"
+#include "dupes.h"
+#include "compare.h"
+#include "tree.h"
+#include "owners.h"
+#include "dircache.h"
+#include "iosched.h"
+#include "next.h"
+#include "arena.h"
+#include "util.h"
+
+
+
+// temporaries of one iteration of the main loop, eg: prompt input
+static Arena frame = { 0 };
+
+#define PAIR_WHITE       1
+#define PAIR_BLUE        2
+#define PAIR_GREEN       3
+#define PAIR_RED         4
+#define PAIR_SELECTED    5
+#define PAIR_SELECTED_HL 6
+#define PAIR_GREY        7
+#define PAIR_YELLOW      8
+
+void curses_init(void) {
+    initscr();
+    noecho();
+    keypad(stdscr, true);
+    raw();
+    curs_set(0);
+
+    ESCDELAY = 0;
+
+    if (!has_colors())
+        fprintf(stderr, "Your terminal does not support colors\n");
+
+    curses_init_colors();
+}
+
+// split from curses_init(), so screens created with newterm() can share it
+void curses_init_colors(void) {
+    start_color();
+    use_default_colors();
+    init_pair(PAIR_WHITE,       COLOR_BRIGHT_WHITE, COLOR_BLACK);
+    init_pair(PAIR_RED,         COLOR_RED,          COLOR_BLACK);
+    init_pair(PAIR_BLUE,        COLOR_BLUE,         COLOR_BLACK);
+    init_pair(PAIR_GREEN,       COLOR_GREEN,        COLOR_BLACK);
+    init_pair(PAIR_GREY,        COLOR_GRAY,         COLOR_BLACK);
+    init_pair(PAIR_YELLOW,      COLOR_YELLOW,       COLOR_BLACK);
+    init_pair(PAIR_SELECTED,    COLOR_BLACK,        COLOR_BRIGHT_WHITE);
+    init_pair(PAIR_SELECTED_HL, COLOR_BLACK,        COLOR_BLACK);
+}
+
+void curses_deinit(void) {
+    endwin();
+}
+
+// takes back the temporaries of the last frame
+void frame_reset(void) {
+    arena_reset(&frame);
+}
+
+// heap allocations made for temporaries so far
+size_t frame_allocs(void) {
+    return frame.allocs;
+}
+
+void draw_topbar(const FileManager *fm) {
+
+    char hostname[HOST_NAME_MAX + 1] = { 0 };
+    MUST_ZERO(gethostname(hostname, ARRAY_LEN(hostname)));
+
+    char *username = getlogin();
+    assert(username != NULL);
+
+    attrset(COLOR_PAIR(PAIR_GREEN) | A_BOLD);
+    mvprintw(0, 0, "%s@%s", username, hostname);
+
+    attrset(COLOR_PAIR(0));
+    printw(":");
+
+    attrset(COLOR_PAIR(PAIR_BLUE) | A_BOLD);
+    printw("%s", fm->dir->path);
+    if (strcmp(fm->dir->path, "/"))
+        printw("/");
+
+    attrset(A_BOLD);
+    Entry *e = fm_get_current(fm);
+    if (e != NULL)
+        printw("%s", e->name);
+
+    // stats were too slow, the listing relies on worker threads
+    if (fm->dir->degraded) {
+        attrset(COLOR_PAIR(PAIR_RED) | A_BOLD);
+        printw("  [slow fs%s]", fm->dir->batch != NULL ? ", loading" : "");
+    }
+
+    standend();
+}
+
+// the tabs by the name of their directory, below the top bar. nothing for a
+// single tab
+void draw_tabs(const Tabs *t) {
+    if (t->count == 1) return;
+
+    move(1, 0);
+    for (size_t i=0; i < t->count; ++i) {
+        const char *path = t->views[i]->dir->path;
+        const char *slash = strrchr(path, '/');
+        const char *name = slash != NULL && slash[1] != '\0' ? slash + 1 : path;
+
+        int pair = i == t->current                ? PAIR_SELECTED
+                 : t->split && i == t->other      ? PAIR_BLUE
+                 : PAIR_GREY;
+
+        printw_attrs(COLOR_PAIR(pair), " %zu:%s ", i + 1, name);
+        printw(" ");
+    }
+}
+
+// insert needed amount of spaces to align current x cell to
+// padding. keeps track of previous padding, `-1` for reset
+static int align_offset = 0;
+
+static void align(int padding) {
+
+    if (padding == -1) {
+        align_offset = 0;
+        return;
+    }
+
+    int x, _y;
+    getyx(stdscr, _y, x);
+    (void) _y;
+
+    for (int _=0; _ < align_offset + padding - x; ++_)
+        printw(" ");
+
+    align_offset += padding;
+}
+
+// paddings from here on are relative to column `x`, eg: for a second pane
+static void align_start(int x) {
+    align_offset = x;
+}
+
+static void print_permissions(bool r, bool w, bool x, bool colored) {
+
+    printw_attrs_cond(COLOR_PAIR(r ? PAIR_YELLOW : PAIR_GREY), colored, r ? "r" : "-");
+    printw_attrs_cond(COLOR_PAIR(w ? PAIR_RED    : PAIR_GREY), colored, w ? "w" : "-");
+    printw_attrs_cond(COLOR_PAIR(x ? PAIR_GREEN  : PAIR_GREY), colored, x ? "x" : "-");
+}
+
+static void draw_permissions(const Entry *e, bool colored) {
+
+    unsigned int m = e->mode;
+    print_permissions(m & S_IRUSR, m & S_IWUSR, m & S_IXUSR, colored);
+    print_permissions(m & S_IRGRP, m & S_IWGRP, m & S_IXGRP, colored);
+    print_permissions(m & S_IROTH, m & S_IWOTH, m & S_IXOTH, colored);
+}
+
+static void draw_filesize(size_t size, bool colored) {
+
+    const char *suffix = "";
+
+    if (size > 1024 * 1024) {
+        size = size / (1024 * 1024);
+        suffix = "M";
+
+    } else if (size > 1024) {
+        size = size / 1024;
+        suffix = "K";
+    }
+
+    printw_attrs_cond(COLOR_PAIR(PAIR_BLUE), colored, "%lu%s", size, suffix);
+}
+
+static void draw_time(struct timespec t, bool colored) {
+
+    // no birth time on this filesystem
+    if (t.tv_sec == 0 && t.tv_nsec == 0) {
+        printw_attrs_cond(COLOR_PAIR(PAIR_GREY), colored, "-");
+        return;
+    }
+
+    struct tm tm = { 0 };
+    localtime_r(&t.tv_sec, &tm);
+
+    char buf[32] = { 0 };
+    strftime(buf, ARRAY_LEN(buf), "%Y-%m-%d %H:%M", &tm);
+    printw_attrs_cond(COLOR_PAIR(PAIR_YELLOW), colored, "%s", buf);
+}
+
+static void draw_column(const Entry *e, Column column, bool colored) {
+
+    if (!entry_has_column(e, column)) {
+        printw_attrs_cond(COLOR_PAIR(PAIR_GREY), colored, "-");
+        return;
+    }
+
+    switch (column) {
+        case COLUMN_LINKS:
+            printw_attrs_cond(COLOR_PAIR(PAIR_WHITE), colored, "%lu", (unsigned long) e->nlink);
+            break;
+
+        case COLUMN_OWNER:
+            printw_attrs_cond(COLOR_PAIR(PAIR_GREEN), colored, "%.9s", owner_user(e->uid));
+            break;
+
+        case COLUMN_GROUP:
+            printw_attrs_cond(COLOR_PAIR(PAIR_GREEN), colored, "%.9s", owner_group(e->gid));
+            break;
+
+        case COLUMN_MTIME: draw_time(e->mtime, colored); break;
+        case COLUMN_BTIME: draw_time(e->btime, colored); break;
+
+        case COLUMN_INODE:
+            printw_attrs_cond(COLOR_PAIR(PAIR_GREY), colored, "%lu", (unsigned long) e->ino);
+            break;
+    }
+}
+
+// widths of the optional columns, by bit
+static const int column_widths[COLUMN_COUNT] = { 4, 10, 10, 18, 18, 12 };
+
+// the optional columns of `which` that are enabled in `columns`
+static void draw_columns(const Entry *e, unsigned int columns, unsigned int which, bool cur) {
+    for (int i=0; i < COLUMN_COUNT; ++i) {
+        Column column = 1 << i;
+        if (!(columns & which & column)) continue;
+
+        if (e->stat == STAT_DONE)
+            draw_column(e, column, !cur);
+        align(column_widths[i]);
+    }
+}
+
+static int magic_pair(MagicClass class) {
+    switch (class) {
+        case MAGIC_EXEC:     return PAIR_GREEN;
+        case MAGIC_IMAGE:    return PAIR_YELLOW;
+        case MAGIC_ARCHIVE:  return PAIR_RED;
+        case MAGIC_MEDIA:    return PAIR_BLUE;
+        case MAGIC_DOCUMENT: return PAIR_WHITE;
+        case MAGIC_TEXT:     return PAIR_WHITE;
+        case MAGIC_DATA:     return PAIR_GREY;
+        default:             return PAIR_WHITE;
+    }
+}
+
+// the content type if known, the d_type otherwise
+static void draw_type(const Entry *e, bool cur) {
+    const MagicType *type = magic_type(e->magic);
+
+    if (type == NULL) {
+        attron(COLOR_PAIR(cur ? PAIR_SELECTED : PAIR_GREEN));
+        printw("%s", e->type);
+        return;
+    }
+
+    attron(COLOR_PAIR(cur ? PAIR_SELECTED : magic_pair(type->class)));
+    printw("%s", type->label);
+}
+
+static void draw_link(const Entry *e, bool cur) {
+
+    const char *target = entry_link(e);
+    if (target == NULL) return;
+
+    bool ok = e->link_status == LINK_OK;
+    int pair = cur ? PAIR_SELECTED : ok ? PAIR_GREY : PAIR_RED;
+
+    attron(COLOR_PAIR(pair));
+    printw("-> %s", target);
+
+    switch (e->link_status) {
+        case LINK_BROKEN: printw(" (broken)"); break;
+        case LINK_LOOP:   printw(" (loop)");   break;
+        case LINK_ERROR:  printw(" (error)");  break;
+        default: break;
+    }
+
+    attroff(COLOR_PAIR(pair));
+}
+
+static void draw_git(const Entry *e) {
+    switch (e->git) {
+        case GIT_MODIFIED:  printw_attrs(COLOR_PAIR(PAIR_YELLOW), "M"); break;
+        case GIT_UNTRACKED: printw_attrs(COLOR_PAIR(PAIR_GREEN),  "?"); break;
+        case GIT_IGNORED:   printw_attrs(COLOR_PAIR(PAIR_GREY),   "!"); break;
+        default: break;
+    }
+}
+
+void draw_entries(
+    const FileManager *fm,
+    int off_y,
+    int off_x,
+    int height,
+    int width
+) {
+
+    const Directory *dir = fm->dir;
+
+    // names of a pane to the left may run into this one
+    for (int row=0; row < height; ++row) {
+        move(row + off_y, off_x);
+        clrtoeol();
+    }
+
+    if (dir->size == 0) {
+        move(off_y, off_x);
+        printw_attrs(COLOR_PAIR(PAIR_GREY), "<empty>");
+    }
+
+    // only the rows on screen are drawn
+    for (int row=0; row < height && fm->scroll + row < dir->size; ++row) {
+
+        size_t i = fm->scroll + row;
+        Entry *e = &dir->entries[i];
+        bool cur = i == (size_t) fm->cursor;
+
+        char path[PATH_MAX] = { 0 };
+        bool sel = fm_is_selected(fm, fm_get_path(fm, e, path, ARRAY_LEN(path)));
+
+        move(row + off_y, off_x);
+        align_start(off_x);
+
+        if (sel)
+            printw(">");
+
+        move(row + off_y, off_x + 1);
+        draw_git(e);
+        align(2);
+
+        if (cur)
+            attron(COLOR_PAIR(PAIR_SELECTED));
+
+        // in the order of `ls -l`
+        unsigned int before_size = COLUMN_LINKS | COLUMN_OWNER | COLUMN_GROUP;
+
+        if (e->stat == STAT_DONE) {
+            draw_permissions(e, !cur);
+            align(14);
+            draw_columns(e, fm->columns, before_size, cur);
+
+            attron(COLOR_PAIR(cur ? PAIR_SELECTED : PAIR_BLUE));
+            draw_filesize(e->size, !cur);
+            align(10);
+
+        } else {
+            printw_attrs_cond(COLOR_PAIR(PAIR_GREY), !cur, "?????????");
+            align(14);
+            draw_columns(e, fm->columns, before_size, cur);
+
+            bool timeout = e->stat == STAT_TIMEOUT;
+            printw_attrs_cond(
+                COLOR_PAIR(timeout ? PAIR_RED : PAIR_GREY),
+                !cur,
+                timeout ? "timeout" : "?"
+            );
+            align(10);
+        }
+
+        draw_columns(e, fm->columns, ~before_size, cur);
+
+        draw_type(e, cur);
+        align(10);
+
+        if (e->dtype == DT_DIR)
+            attron(A_BOLD);
+
+        attron(COLOR_PAIR(
+            cur
+            ? PAIR_SELECTED
+            : e->dtype == DT_DIR
+            ? PAIR_BLUE
+            : PAIR_WHITE));
+        printw("%s ", e->name);
+        standend();
+
+        if (entry_is_link(e))
+            draw_link(e, cur);
+
+        align(width);
+        align(-1);
+
+        standend();
+    }
+
+}
+
+// last and p99 duration of every probe, in the bottom right corner
+void draw_stats(void) {
+
+    int width = 50;
+    int y = getmaxy(stdscr) - PROF_COUNT - 5;
+    int x = getmaxx(stdscr) - width - 1;
+    if (y < 0) y = 0;
+    if (x < 0) x = 0;
+
+    attrset(COLOR_PAIR(PAIR_GREY) | A_BOLD);
+    mvprintw(y, x, "%-14s %9s %9s %8s", "probe", "last ms", "p99 ms", "calls");
+    attrset(COLOR_PAIR(PAIR_WHITE));
+
+    for (int i=0; i < PROF_COUNT; ++i) {
+        const ProfStats *s = prof_stats(i);
+        mvprintw(
+            y + 1 + i,
+            x,
+            "%-14s %9.3f %9.3f %8lu",
+            prof_name(i),
+            s->last_ns / 1e6,
+            prof_percentile(i, 0.99) / 1e6,
+            (unsigned long) s->calls
+        );
+    }
+
+    // these stop growing once navigation runs on recycled memory
+    mvprintw(y + 1 + PROF_COUNT, x, "%-14s dirs %lu, links %lu, frame %lu", "heap allocs",
+             (unsigned long) dircache_allocs(), (unsigned long) links_allocs(),
+             (unsigned long) frame_allocs());
+
+    // background work by priority, running/queued
+    IoStats io = iosched_stats();
+    mvprintw(y + 2 + PROF_COUNT, x, "%-14s", "io");
+    for (int p=0; p < IO_PRIORITIES; ++p)
+        printw(" %s %lu/%lu", iosched_priority_name(p),
+               (unsigned long) io.running[p], (unsigned long) io.queued[p]);
+
+    standend();
+}
+
+// cursor and scroll offset of a modal list, shared by the list views
+typedef struct {
+    size_t cursor;
+    size_t scroll;
+    size_t count;
+} ListView;
+
+// returns false if `ch` is no movement key
+static bool list_key(ListView *lv, int ch) {
+    switch (ch) {
+        case 'n' & KEY_MASK_CTRL:
+        case KEY_DOWN:
+        case 'j':
+            if (lv->cursor + 1 < lv->count) lv->cursor++;
+            return true;
+
+        case 'p' & KEY_MASK_CTRL:
+        case KEY_UP:
+        case 'k':
+            if (lv->cursor > 0) lv->cursor--;
+            return true;
+
+        default: return false;
+    }
+}
+
+static void list_fit(ListView *lv, size_t height) {
+    if (lv->cursor < lv->scroll)
+        lv->scroll = lv->cursor;
+    else if (lv->cursor >= lv->scroll + height)
+        lv->scroll = lv->cursor - height + 1;
+}
+
+static void draw_dupes_progress(DupeProgress p) {
+    static const char *phases[] = {
+        [DUPES_WALK]  = "finding files",
+        [DUPES_EDGES] = "hashing edges",
+        [DUPES_FULL]  = "hashing content",
+        [DUPES_DONE]  = "done",
+    };
+
+    clear();
+    attrset(A_BOLD);
+    mvprintw(0, 0, "duplicates: %s", phases[p.phase]);
+    standend();
+
+    mvprintw(2, 2, "%lu files, %lu candidates, ", (unsigned long) p.files, (unsigned long) p.candidates);
+    draw_filesize(p.hashed, true);
+    printw(" hashed");
+
+    printw_attrs(COLOR_PAIR(PAIR_GREY), "  (esc to cancel)");
+    refresh();
+}
+
+static void draw_dupes(
+    const FileManager *fm,
+    const DupeFile *files,
+    const ListView *lv,
+    size_t groups,
+    size_t wasted,
+    size_t height
+) {
+    clear();
+    attrset(A_BOLD);
+    mvprintw(0, 0, "duplicates: %lu groups, ", (unsigned long) groups);
+    draw_filesize(wasted, false);
+    printw(" wasted");
+    standend();
+    printw_attrs(COLOR_PAIR(PAIR_GREY), "  (space select, a select all but first, enter reveal, q quit)");
+
+    if (lv->count == 0) {
+        mvprintw(2, 2, "<no duplicates>");
+    }
+
+    for (size_t row=0; row < height && lv->scroll + row < lv->count; ++row) {
+        size_t i = lv->scroll + row;
+        const DupeFile *f = &files[i];
+        bool cur = i == lv->cursor;
+        bool first = i == 0 || files[i - 1].group != f->group;
+
+        move(row + 2, 0);
+        if (fm_is_selected(fm, f->path))
+            printw(">");
+
+        move(row + 2, 4);
+        if (first)
+            draw_filesize(f->size, !cur);
+
+        // alternate colors, so neighbouring groups are told apart
+        int pair = cur ? PAIR_SELECTED : f->group % 2 ? PAIR_WHITE : PAIR_YELLOW;
+        attron(COLOR_PAIR(pair));
+        mvprintw(row + 2, 12, "%s", f->path);
+        standend();
+    }
+
+    refresh();
+}
+
+// finds duplicates among the selection, or in the current directory and below.
+// files can be selected from the results, or revealed in the file manager
+void show_dupes(FileManager *fm) {
+
+    DupeScan *scan = dupes_start(fm->dir, (const char *const *) fm->sel.paths, fm->sel.size);
+
+    size_t count = 0;
+    size_t groups = 0;
+    const DupeFile *files = NULL;
+
+    timeout(100);
+    while ((files = dupes_result(scan, &count, &groups)) == NULL) {
+        draw_dupes_progress(dupes_progress(scan));
+
+        int ch = getch();
+        if (ch == KEY_ESCAPE || ch == 'q') {
+            dupes_free(scan);
+            return;
+        }
+    }
+    timeout(-1);
+
+    size_t wasted = 0;
+    for (size_t i=1; i < count; ++i)
+        if (files[i].group == files[i - 1].group)
+            wasted += files[i].size;
+
+    ListView lv = { .count = count };
+
+    while (1) {
+        int height = getmaxy(stdscr) - 3;
+        list_fit(&lv, height > 0 ? height : 1);
+        draw_dupes(fm, files, &lv, groups, wasted, height > 0 ? height : 1);
+
+        int ch = getch();
+        if (list_key(&lv, ch)) continue;
+
+        switch (ch) {
+            case KEY_ESCAPE:
+            case 'q':
+                dupes_free(scan);
+                return;
+
+            case '\t':
+            case 's':
+            case ' ':
+                if (count == 0) break;
+                fm_select_path(fm, files[lv.cursor].path, !fm_is_selected(fm, files[lv.cursor].path));
+                if (lv.cursor + 1 < count) lv.cursor++;
+                break;
+
+            // keep the first file of every group, select the rest
+            case 'a':
+                for (size_t i=0; i < count; ++i) {
+                    bool first = i == 0 || files[i - 1].group != files[i].group;
+                    fm_select_path(fm, files[i].path, !first);
+                }
+                break;
+
+            case KEY_RETURN:
+                if (count == 0) break;
+                fm_reveal(fm, files[lv.cursor].path);
+                dupes_free(scan);
+                return;
+
+            default: break;
+        }
+    }
+}
+
+static void draw_compare(
+    const CompareScan *scan,
+    const CompareItem *items,
+    const size_t *shown,
+    const ListView *lv,
+    size_t height
+) {
+    static const struct { const char *mark; int pair; } states[] = {
+        [CMP_SAME]       = { "=", PAIR_GREY   },
+        [CMP_DIFFERENT]  = { "!", PAIR_YELLOW },
+        [CMP_ONLY_LEFT]  = { "<", PAIR_RED    },
+        [CMP_ONLY_RIGHT] = { ">", PAIR_GREEN  },
+        [CMP_PENDING]    = { "?", PAIR_GREY   },
+    };
+
+    clear();
+    attrset(A_BOLD);
+    mvprintw(0, 0, "< %s", compare_root(scan, false));
+    mvprintw(1, 0, "> %s", compare_root(scan, true));
+    standend();
+    printw_attrs(COLOR_PAIR(PAIR_GREY), "  (= toggle same, enter reveal, q quit)");
+
+    if (lv->count == 0)
+        mvprintw(3, 2, "<no differences>");
+
+    for (size_t row=0; row < height && lv->scroll + row < lv->count; ++row) {
+        size_t i = lv->scroll + row;
+        const CompareItem *item = &items[shown[i]];
+        bool cur = i == lv->cursor;
+
+        attron(COLOR_PAIR(cur ? PAIR_SELECTED : states[item->state].pair));
+        mvprintw(row + 3, 2, "%s", states[item->state].mark);
+
+        move(row + 3, 4);
+        if (item->state != CMP_ONLY_RIGHT && !item->is_dir)
+            draw_filesize(item->left_size, !cur);
+
+        move(row + 3, 12);
+        if (item->state != CMP_ONLY_LEFT && !item->is_dir)
+            draw_filesize(item->right_size, !cur);
+
+        attron(COLOR_PAIR(cur ? PAIR_SELECTED : states[item->state].pair));
+        if (item->is_dir) attron(A_BOLD);
+        mvprintw(row + 3, 20, "%s%s", item->path, item->is_dir ? "/" : "");
+        standend();
+    }
+
+    refresh();
+}
+
+// rebuilds the rows of the list, which are indices into `items`
+static size_t compare_filter(const CompareItem *items, size_t count, size_t *shown, bool hide_same) {
+    size_t n = 0;
+    for (size_t i=0; i < count; ++i)
+        if (!hide_same || items[i].state != CMP_SAME)
+            shown[n++] = i;
+    return n;
+}
+
+// compares the current directory with another one, recursively
+void show_compare(FileManager *fm) {
+
+    // split, the other pane is what to compare with
+    const char *other = fm->other != NULL
+        ? fm->other->dir->path
+        : show_prompt("compare with");
+    if (other == NULL) return;
+
+    CompareScan *scan = compare_start(fm->dir->path, other, true);
+    if (scan == NULL) return;
+
+    size_t count = 0;
+    const CompareItem *items = NULL;
+
+    timeout(100);
+    while ((items = compare_result(scan, &count)) == NULL) {
+        CompareProgress p = compare_progress(scan);
+
+        clear();
+        attrset(A_BOLD);
+        mvprintw(0, 0, "comparing");
+        standend();
+        mvprintw(2, 2, "%lu directories, %lu entries, %lu files hashing",
+                 (unsigned long) p.dirs, (unsigned long) p.items, (unsigned long) p.pending);
+        printw_attrs(COLOR_PAIR(PAIR_GREY), "  (esc to cancel)");
+        refresh();
+
+        int ch = getch();
+        if (ch == KEY_ESCAPE || ch == 'q') {
+            compare_free(scan);
+            return;
+        }
+    }
+    timeout(-1);
+
+    size_t *shown = malloc((count + 1) * sizeof(size_t));
+    NON_NULL(shown);
+
+    bool hide_same = true;
+    ListView lv = { .count = compare_filter(items, count, shown, hide_same) };
+
+    while (1) {
+        int height = getmaxy(stdscr) - 4;
+        list_fit(&lv, height > 0 ? height : 1);
+        draw_compare(scan, items, shown, &lv, height > 0 ? height : 1);
+
+        int ch = getch();
+        if (list_key(&lv, ch)) continue;
+
+        switch (ch) {
+            case '=':
+                hide_same = !hide_same;
+                lv = (ListView) { .count = compare_filter(items, count, shown, hide_same) };
+                break;
+
+            case KEY_RETURN: {
+                if (lv.count == 0) break;
+                const CompareItem *item = &items[shown[lv.cursor]];
+
+                char path[PATH_MAX] = { 0 };
+                const char *root = compare_root(scan, item->state == CMP_ONLY_RIGHT);
+                snprintf(path, ARRAY_LEN(path), "%s/%s", root, item->path);
+                fm_reveal(fm, path);
+            } // fallthrough
+
+            case KEY_ESCAPE:
+            case 'q':
+                free(shown);
+                compare_free(scan);
+                return;
+
+            default: break;
+        }
+    }
+}
+
+static void draw_tree(const Tree *tree, const ListView *lv, size_t height) {
+    clear();
+    attrset(COLOR_PAIR(PAIR_BLUE) | A_BOLD);
+    mvprintw(0, 0, "%s", tree->root);
+    standend();
+    printw_attrs(COLOR_PAIR(PAIR_GREY), "  (l expand, h collapse, enter reveal, q quit)");
+
+    if (lv->count == 0)
+        mvprintw(2, 2, "<empty>");
+
+    // only the rows on screen are drawn, however large the expanded tree is
+    for (size_t row=0; row < height && lv->scroll + row < lv->count; ++row) {
+        size_t i = lv->scroll + row;
+        const TreeNode *node = &tree->nodes[i];
+        bool cur = i == lv->cursor;
+        bool dir = node->entry.dtype == DT_DIR;
+
+        move(row + 2, 2);
+        if (!dir)
+            draw_filesize(node->entry.size, !cur);
+
+        move(row + 2, 10 + node->depth * 2);
+        if (dir)
+            printw_attrs(COLOR_PAIR(PAIR_GREY), node->expanded ? "- " : "+ ");
+
+        if (dir) attron(A_BOLD);
+        attron(COLOR_PAIR(cur ? PAIR_SELECTED : dir ? PAIR_BLUE : PAIR_WHITE));
+        printw("%s", node->entry.name);
+        standend();
+    }
+
+    refresh();
+}
+
+// a tree of the current directory, with subdirectories expanded in place
+void show_tree(FileManager *fm) {
+
+    Tree tree;
+    if (tree_init(&tree, fm->dir->path, fm->show_hidden) == -1) return;
+
+    ListView lv = { .count = tree.size };
+
+    while (1) {
+        int height = getmaxy(stdscr) - 3;
+        list_fit(&lv, height > 0 ? height : 1);
+        draw_tree(&tree, &lv, height > 0 ? height : 1);
+
+        int ch = getch();
+        if (ch == KEY_ESCAPE || ch == 'q') break;
+        if (list_key(&lv, ch) || lv.count == 0) continue;
+
+        TreeNode *node = &tree.nodes[lv.cursor];
+
+        switch (ch) {
+            case 'f' & KEY_MASK_CTRL:
+            case KEY_RIGHT:
+            case 'l':
+                if (!node->expanded)
+                    tree_toggle(&tree, lv.cursor);
+                break;
+
+            case '\t':
+            case ' ':
+                tree_toggle(&tree, lv.cursor);
+                break;
+
+            // collapse, or move up to the parent if already collapsed
+            case 'b' & KEY_MASK_CTRL:
+            case KEY_LEFT:
+            case 'h':
+            case '-':
+                if (node->expanded)
+                    tree_toggle(&tree, lv.cursor);
+                else
+                    lv.cursor = tree_parent(&tree, lv.cursor);
+                break;
+
+            case KEY_RETURN: {
+                char path[PATH_MAX] = { 0 };
+                tree_path(&tree, lv.cursor, path, ARRAY_LEN(path));
+                fm_reveal(fm, path);
+                tree_free(&tree);
+                return;
+            }
+
+            default: break;
+        }
+
+        lv.count = tree.size;
+    }
+
+    tree_free(&tree);
+}
+
+#define JUMP_MATCHES 256
+
+// jumps to a recorded directory, matching it while the query is typed
+void show_jump(FileManager *fm) {
+    if (fm->jumps == NULL) return;
+
+    char query[NAME_MAX + 1] = { 0 };
+    size_t len = 0;
+    JumpMatch matches[JUMP_MATCHES];
+    ListView lv = { 0 };
+
+    while (1) {
+        lv.count = jumpdb_query(fm->jumps, query, matches, ARRAY_LEN(matches));
+        if (lv.cursor >= lv.count)
+            lv.cursor = lv.count ? lv.count - 1 : 0;
+
+        int height = getmaxy(stdscr) - 3;
+        list_fit(&lv, height > 0 ? height : 1);
+
+        clear();
+        for (size_t row=0; (int) row < height && lv.scroll + row < lv.count; ++row) {
+            size_t i = lv.scroll + row;
+            attron(COLOR_PAIR(i == lv.cursor ? PAIR_SELECTED : PAIR_BLUE));
+            mvprintw(row, 2, "%s", matches[i].path);
+            standend();
+        }
+
+        mvprintw(getmaxy(stdscr) - 2, 0, "jump: %s", query);
+        refresh();
+
+        // letters are part of the query, only ctrl and arrow keys move
+        int ch = getch();
+        if (ch != 'j' && ch != 'k' && list_key(&lv, ch)) continue;
+
+        switch (ch) {
+            case KEY_ESCAPE:
+                return;
+
+            case KEY_RETURN:
+                if (lv.count > 0)
+                    fm_cd_abs(fm, matches[lv.cursor].path);
+                return;
+
+            case 'u' & KEY_MASK_CTRL:
+                len = 0;
+                query[0] = '\0';
+                break;
+
+            case KEY_BACKSPACE:
+                if (len > 0)
+                    query[--len] = '\0';
+                break;
+
+            default:
+                if (len < ARRAY_LEN(query) - 1 && isascii(ch) && isprint(ch)) {
+                    query[len++] = (char) ch;
+                    query[len] = '\0';
+                    lv.cursor = 0;
+                }
+                break;
+        }
+    }
+}
+
+#define SEARCH_HITS 256
+
+// searches the path index for names, while the query is typed
+void show_search(FileManager *fm) {
+    if (fm->index == NULL) return;
+
+    char query[NAME_MAX + 1] = { 0 };
+    size_t len = 0;
+    IndexHit hits[SEARCH_HITS];
+    ListView lv = { 0 };
+
+    while (1) {
+        uint64_t start = prof_begin();
+        lv.count = pathindex_query(fm->index, query, hits, ARRAY_LEN(hits));
+        uint64_t took = prof_begin() - start;
+
+        if (lv.cursor >= lv.count)
+            lv.cursor = lv.count ? lv.count - 1 : 0;
+
+        int height = getmaxy(stdscr) - 3;
+        list_fit(&lv, height > 0 ? height : 1);
+
+        clear();
+        for (size_t row=0; (int) row < height && lv.scroll + row < lv.count; ++row) {
+            size_t i = lv.scroll + row;
+            int pair = hits[i].is_dir ? PAIR_BLUE : PAIR_WHITE;
+            attron(COLOR_PAIR(i == lv.cursor ? PAIR_SELECTED : pair));
+            mvprintw(row, 2, "%s", hits[i].path);
+            standend();
+        }
+
+        mvprintw(getmaxy(stdscr) - 2, 0, "search: %s", query);
+        printw_attrs(COLOR_PAIR(PAIR_GREY), "  (%lu entries%s, %.1f ms)",
+                     (unsigned long) fm->index->entries,
+                     pathindex_busy(fm->index) ? ", indexing" : "",
+                     took / 1e6);
+        move(getmaxy(stdscr) - 2, strlen("search: ") + len);
+        refresh();
+
+        // refresh the status while indexing
+        timeout(pathindex_busy(fm->index) ? 500 : -1);
+        int ch = getch();
+        timeout(-1);
+
+        if (ch != 'j' && ch != 'k' && list_key(&lv, ch)) continue;
+
+        switch (ch) {
+            case KEY_ESCAPE:
+                return;
+
+            case KEY_RETURN:
+                if (lv.count == 0) return;
+                if (hits[lv.cursor].is_dir)
+                    fm_cd_abs(fm, hits[lv.cursor].path);
+                else
+                    fm_reveal(fm, hits[lv.cursor].path);
+                return;
+
+            case 'u' & KEY_MASK_CTRL:
+                len = 0;
+                query[0] = '\0';
+                break;
+
+            // changes fm did not see, eg: made by other programs
+            case 'r' & KEY_MASK_CTRL:
+                pathindex_rescan(fm->index);
+                break;
+
+            case KEY_BACKSPACE:
+                if (len > 0)
+                    query[--len] = '\0';
+                break;
+
+            default:
+                if (len < ARRAY_LEN(query) - 1 && isascii(ch) && isprint(ch)) {
+                    query[len++] = (char) ch;
+                    query[len] = '\0';
+                    lv.cursor = 0;
+                }
+                break;
+        }
+    }
+}
+
+#define PREVIEW_SIZE (64 * 1024)
+
+// the start of the file under the cursor, until a key is pressed.
+// works for members of archives too, which are streamed, not extracted
+void show_preview(const FileManager *fm) {
+    const Entry *e = fm_get_current(fm);
+    if (e == NULL || !S_ISREG(e->mode)) return;
+
+    char *buf = malloc(PREVIEW_SIZE);
+    NON_NULL(buf);
+
+    ssize_t n = fm_read_head(fm, e, buf, PREVIEW_SIZE);
+
+    clear();
+    attrset(A_BOLD);
+    mvprintw(0, 0, "%s", e->name);
+    standend();
+
+    if (n == -1)
+        printw_attrs(COLOR_PAIR(PAIR_RED), "  (%s)", strerror(errno));
+
+    int height = getmaxy(stdscr);
+    int width = getmaxx(stdscr);
+    int y = 2;
+    int x = 0;
+
+    for (ssize_t i=0; i < n && y < height; ++i) {
+        unsigned char c = buf[i];
+
+        if (c == '\n' || x >= width) {
+            y++;
+            x = 0;
+            if (c == '\n') continue;
+        }
+
+        if (y < height)
+            mvaddch(y, x++, isprint(c) || c == '\t' ? c : '.');
+    }
+
+    refresh();
+    free(buf);
+    getch();
+}
+
+// the input, valid until the next frame_reset(), or NULL if cancelled
+// input is never cut shorter than this, however narrow the terminal
+#define PROMPT_MIN 64
+
+char *show_prompt(const char *prompt) {
+
+    int offsety = 2;
+    int y = getmaxy(stdscr);
+
+    int room = getmaxx(stdscr) - (int) strlen(prompt) - (int) strlen(": ");
+    size_t bufsize = room > PROMPT_MIN ? (size_t) room : PROMPT_MIN;
+    char *buf = arena_alloc(&frame, bufsize * sizeof(char));
+    memset(buf, 0, bufsize * sizeof(char));
+    size_t i = 0;
+
+    while (1) {
+
+        move(y - offsety, 0);
+        clrtoeol();
+        printw("%s: %s", prompt, buf);
+
+        int ch = getch();
+        switch (ch) {
+
+            case 'u' & KEY_MASK_CTRL:
+                memset(buf, 0, bufsize * sizeof(char));
+                i = 0;
+                break;
+
+            case KEY_ESCAPE:
+                return NULL;
+                break;
+
+            case KEY_RETURN:
+                return buf;
+                break;
+
+            case KEY_BACKSPACE:
+                if (i > 0)
+                    buf[--i] = '\0';
+                break;
+
+            default:
+                if (i >= bufsize - 1)
+                    break;
+
+                if (isascii(ch))
+                    buf[i++] = (char) ch;
+
+                break;
+
+        }
+
+    }
+
+    UNREACHABLE();
+
+}
+
+// toggles the optional columns of the listing
+void show_columns(FileManager *fm) {
+
+    ListView lv = { .count = COLUMN_COUNT };
+
+    while (1) {
+        clear();
+        attrset(COLOR_PAIR(PAIR_BLUE) | A_BOLD);
+        mvprintw(0, 0, "columns");
+        standend();
+        printw_attrs(COLOR_PAIR(PAIR_GREY), "  (space toggle, q quit)");
+
+        for (size_t i=0; i < lv.count; ++i) {
+            Column column = 1 << i;
+            bool on = fm->columns & column;
+
+            move(i + 2, 2);
+            printw_attrs(COLOR_PAIR(on ? PAIR_GREEN : PAIR_GREY), on ? "[x] " : "[ ] ");
+            printw_attrs(COLOR_PAIR(i == lv.cursor ? PAIR_SELECTED : PAIR_WHITE), "%s", column_name(column));
+        }
+        refresh();
+
+        int ch = getch();
+        if (ch == KEY_ESCAPE || ch == 'q' || ch == KEY_RETURN) break;
+        if (list_key(&lv, ch)) continue;
+
+        if (ch == ' ' || ch == '\t')
+            fm_set_columns(fm, fm->columns ^ (1u << lv.cursor));
+    }
+}
+
+// shows `msg` on the prompt line until a key is pressed
+static void show_error(const char *what, const char *msg) {
+    move(getmaxy(stdscr) - 2, 0);
+    clrtoeol();
+    printw_attrs(COLOR_PAIR(PAIR_RED), "%s: %s", what, msg);
+    refresh();
+    getch();
+}
+
+// the new names, from `$VISUAL`/`$EDITOR` if `expr` is empty, from a pattern
+// otherwise. returns -1 (with an error shown) if there are none
+static int rename_targets(const char *expr, char **names, size_t count, StrBuf *buf, char **to) {
+
+    if (*expr == '\0') {
+        const char *editor = getenv("VISUAL");
+        if (editor == NULL) editor = getenv("EDITOR");
+        if (editor == NULL) editor = "vi";
+
+        endwin();
+        int err = renames_edit(editor, names, count, buf, to);
+        int saved = errno;
+        refresh();
+
+        if (err == -1) {
+            show_error("rename", saved == EINVAL
+                ? "names must stay one per line"
+                : strerror(saved));
+        }
+        return err;
+    }
+
+    RenamePattern pat;
+    if (renames_pattern(&pat, expr) == -1) {
+        show_error("rename", "expected s/regex/replacement/[gi]");
+        return -1;
+    }
+
+    // the names go into one buffer, which may move while it grows
+    size_t *offsets = arena_alloc(&frame, (count + 1) * sizeof(size_t));
+    StrBuf name = { 0 };
+    strbuf_clear(buf);
+
+    for (size_t i=0; i < count; ++i) {
+        offsets[i] = buf->len;
+        renames_substitute(&pat, names[i], &name);
+        strbuf_append(buf, name.data, name.len + 1);
+    }
+    for (size_t i=0; i < count; ++i)
+        to[i] = buf->data + offsets[i];
+
+    strbuf_free(&name);
+    renames_pattern_free(&pat);
+    return 0;
+}
+
+static void draw_rename(const RenamePlan *p, const ListView *lv, size_t height) {
+    clear();
+    attrset(COLOR_PAIR(PAIR_BLUE) | A_BOLD);
+    mvprintw(0, 0, "rename");
+    standend();
+    printw_attrs(COLOR_PAIR(PAIR_GREY), "  %lu entries, %lu cycles (enter apply, q cancel)",
+                 (unsigned long) p->count, (unsigned long) p->cycles);
+
+    for (size_t row=0; row < height && lv->scroll + row < lv->count; ++row) {
+        size_t i = lv->scroll + row;
+        bool cur = i == lv->cursor;
+
+        move(row + 2, 2);
+        printw_attrs(COLOR_PAIR(cur ? PAIR_SELECTED : PAIR_WHITE), "%s", renames_name(p, p->ops[i].from));
+        printw_attrs(COLOR_PAIR(PAIR_GREY), " -> ");
+        printw_attrs(COLOR_PAIR(cur ? PAIR_SELECTED : PAIR_GREEN), "%s", renames_name(p, p->ops[i].to));
+    }
+    refresh();
+}
+
+// renames the selected entries of the current directory (or all of them),
+// after showing what would be renamed
+void show_rename(FileManager *fm) {
+
+    char **names = NULL;
+    size_t count = fm_rename_names(fm, &names);
+    if (count == 0) {
+        free(names);
+        return;
+    }
+
+    char *expr = show_prompt("rename");
+    char **to = arena_alloc(&frame, count * sizeof(char *));
+    StrBuf buf = { 0 };
+    RenamePlan p = { 0 };
+
+    if (expr == NULL || rename_targets(expr, names, count, &buf, to) == -1)
+        goto done;
+
+    if (renames_plan(&p, fm->dir->fd, names, to, count) == -1) {
+        show_error(names[p.failed], strerror(errno));
+        goto done;
+    }
+    if (p.count == 0) goto done;
+
+    ListView lv = { .count = p.count };
+
+    while (1) {
+        int height = getmaxy(stdscr) - 4;
+        list_fit(&lv, height > 0 ? height : 1);
+        draw_rename(&p, &lv, height > 0 ? height : 1);
+
+        int ch = getch();
+        if (list_key(&lv, ch)) continue;
+        if (ch == KEY_ESCAPE || ch == 'q') break;
+        if (ch != KEY_RETURN) continue;
+
+        if (fm_rename(fm, &p) == -1) {
+            char msg[256];
+            snprintf(msg, ARRAY_LEN(msg), "%s%s", strerror(errno),
+                     p.rolled_back ? ", nothing renamed" : ", could not undo every rename");
+            show_error(renames_name(&p, p.steps[p.failed].from), msg);
+        }
+        break;
+    }
+
+done:
+    renames_free(&p);
+    strbuf_free(&buf);
+    free(names);
+}
+
+static void draw_attrs_progress(const char *cmd, AttrProgress p) {
+    move(getmaxy(stdscr) - 2, 0);
+    clrtoeol();
+    printw("%s: %lu changed", cmd, (unsigned long) p.changed);
+    if (p.failed > 0)
+        printw_attrs(COLOR_PAIR(PAIR_RED), ", %lu failed", (unsigned long) p.failed);
+    if (p.pending > 0)
+        printw(", %lu directories left", (unsigned long) p.pending);
+    printw_attrs(COLOR_PAIR(PAIR_GREY), "  (esc to cancel)");
+    refresh();
+}
+
+// changes the mode, owner or times of the selection (or the entry under the
+// cursor), see attrs.h. progress is shown on the prompt line while it takes
+void show_attrs(FileManager *fm) {
+
+    char *cmd = show_prompt("attrs");
+    if (cmd == NULL || *cmd == '\0') return;
+
+    AttrChange c;
+    if (attrs_parse(&c, cmd) == -1) {
+        show_error(cmd, errno == ENOENT
+            ? "no such user or group"
+            : "expected chmod [-R] mode, chown [-R] user:group or touch [-R]");
+        return;
+    }
+
+    AttrJob *job = fm_attrs_start(fm, &c);
+    if (job == NULL) return;
+
+    // keys are only checked between waits
+    timeout(0);
+    while (!attrs_wait(job, 100)) {
+        draw_attrs_progress(cmd, attrs_progress(job));
+
+        int ch = getch();
+        if (ch == KEY_ESCAPE || ch == 'q')
+            attrs_cancel(job);
+    }
+    timeout(-1);
+
+    fm_attrs_finish(fm, job);
+
+    AttrProgress p = attrs_progress(job);
+    if (p.failed > 0) {
+        char msg[256];
+        snprintf(msg, ARRAY_LEN(msg), "%s, %lu failed", strerror(p.error), (unsigned long) p.failed);
+        show_error(p.error_path, msg);
+    }
+
+    attrs_free(job);
+}
+
+static void draw_archive_progress(const char *name, ArchiveProgress p) {
+    move(getmaxy(stdscr) - 2, 0);
+    clrtoeol();
+    printw("%s: %lu members", name, (unsigned long) p.members);
+    if (p.total > 0)
+        printw(", %d%%", (int) (p.read * 100 / p.total));
+    printw_attrs(COLOR_PAIR(PAIR_GREY), "  (esc to cancel)");
+    refresh();
+}
+
+// enters the directory or archive under the cursor, like fm_cd(). indexing an
+// archive shows its progress on the prompt line while it takes
+void show_cd(FileManager *fm) {
+
+    ArchiveJob *job = fm_archive_start(fm);
+    if (job == NULL) {
+        fm_cd(fm);
+        return;
+    }
+
+    // the entry goes away with the listing
+    char name[NAME_MAX + 1] = { 0 };
+    snprintf(name, ARRAY_LEN(name), "%s", fm_get_current(fm)->name);
+
+    // keys are only checked between waits
+    timeout(0);
+    while (!archive_wait(job, 100)) {
+        draw_archive_progress(name, archive_progress(job));
+
+        int ch = getch();
+        if (ch == KEY_ESCAPE || ch == 'q') {
+            // without waiting for a read that may hang
+            archive_cancel(job);
+            timeout(-1);
+            return;
+        }
+    }
+    timeout(-1);
+
+    if (fm_archive_finish(fm, job) == -1)
+        show_error(name, strerror(errno));
+}
@@ -0,0 +1,35 @@
+#ifndef _UI_H
+#define _UI_H
+
+#include "fm.h"
+#include "tabs.h"
+
+// everything that touches ncurses. kept apart from the core, so the core
+// builds into a curses-free libfm
+
+
+
+void  curses_init        (void);
+void  curses_init_colors (void);
+void  curses_deinit      (void);
+void  frame_reset        (void);
+size_t frame_allocs      (void);
+void  draw_topbar        (const FileManager *fm);
+void  draw_tabs          (const Tabs *t);
+void  draw_entries       (const FileManager *fm, int off_y, int off_x, int height, int width);
+void  draw_stats         (void);
+char *show_prompt        (const char *prompt);
+void  show_dupes         (FileManager *fm);
+void  show_compare       (FileManager *fm);
+void  show_tree          (FileManager *fm);
+void  show_jump          (FileManager *fm);
+void  show_search        (FileManager *fm);
+void  show_preview       (const FileManager *fm);
+void  show_columns       (FileManager *fm);
+void  show_rename        (FileManager *fm);
+void  show_attrs         (FileManager *fm);
+void  show_cd            (FileManager *fm);
+
+
+
+#endif // _UI_H